@@ -38,6 +38,13 @@ inline void skb_xmit(struct sk_buff *skb) {
     dev_queue_xmit(skb);
 }
 
+void skb_xmit_list(struct sk_buff_head *list) {
+	struct sk_buff *skb;
+
+	while((skb = __skb_dequeue(list)) != NULL)
+		skb_xmit(skb);
+}
+
 int iso_tx_hook_init() {
 	hook_out.hook = iso_tx_bridge;
 	hook_out.hooknum= NF_BR_POST_ROUTING;
@@ -0,0 +1,168 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include "cc.h"
+#include "vq.h"
+
+/*
+ * RCP: move the advertised rate by how far the arrival rate is from
+ * the VQ's rate.  ECN marks count as extra arrivals, since they mean
+ * a queue is building somewhere before us.
+ */
+static void iso_cc_rcp_init(struct iso_vq *vq) {
+}
+
+static void iso_cc_rcp_update(struct iso_vq *vq, struct iso_vq_sample *s) {
+	u32 den = (1 << ECN_ALPHA_FRAC_SHIFT);
+	u64 rate = s->rate;
+	u64 rx_rate = s->rx_rate;
+	u64 rate2 = rate << 1;
+
+	if(s->frac)
+		rx_rate += (s->cfg->ecn_mark_thresh_bytes << 3) * (den + s->frac) / den / s->dt;
+	rx_rate = min_t(u64, rx_rate, 3 * rate);
+
+	vq->feedback_rate = vq->feedback_rate * (rate2 + rate - rx_rate) / rate2;
+}
+
+/* DCTCP: cut in proportion to the smoothed fraction of marks, else
+ * increase additively */
+static void iso_cc_dctcp_init(struct iso_vq *vq) {
+}
+
+static void iso_cc_dctcp_update(struct iso_vq *vq, struct iso_vq_sample *s) {
+	u32 mult = 1 << (ECN_ALPHA_FRAC_SHIFT + 1);
+
+	if(s->frac)
+		vq->feedback_rate = (vq->feedback_rate * (mult - vq->alpha)) >> (ECN_ALPHA_FRAC_SHIFT + 1);
+	else
+		vq->feedback_rate += ISO_RFAIR_INCREMENT;
+}
+
+/*
+ * Delay: keep the time it would take to drain the virtual queue at
+ * the VQ's rate near ISO_VQ_CC_DELAY_TARGET_US.
+ */
+static void iso_cc_delay_init(struct iso_vq *vq) {
+	vq->cc_state.delay.delay_us = 0;
+}
+
+static void iso_cc_delay_update(struct iso_vq *vq, struct iso_vq_sample *s) {
+	u64 delay = (s->backlog << 3) / max_t(u64, s->rate, 1);
+	u64 target = s->cfg->vq_cc_delay_target_us;
+
+	vq->cc_state.delay.delay_us = (u32)min_t(u64, delay, U32_MAX);
+
+	if(delay > target)
+		vq->feedback_rate -= vq->feedback_rate * (delay - target) / (delay << 1);
+	else
+		vq->feedback_rate += ISO_RFAIR_INCREMENT;
+}
+
+/*
+ * PI: the classic PI AQM controller on the virtual queue, with the
+ * reference queue at ISO_VQ_CC_DELAY_TARGET_US worth of bytes.  Its
+ * output is how far below the VQ's rate to advertise.
+ */
+static void iso_cc_pi_init(struct iso_vq *vq) {
+	vq->cc_state.pi.cut = 0;
+}
+
+static void iso_cc_pi_update(struct iso_vq *vq, struct iso_vq_sample *s) {
+	s64 qref = (s64)s->cfg->vq_cc_delay_target_us * s->rate >> 3;
+	s64 q = s->backlog, qold = s->last_backlog;
+	s64 cut = vq->cc_state.pi.cut;
+
+	cut += (s->cfg->vq_cc_pi_a * (q - qref) - s->cfg->vq_cc_pi_b * (qold - qref)) >> 16;
+	cut = max_t(s64, cut, 0);
+	cut = min_t(s64, cut, s->rate);
+
+	vq->cc_state.pi.cut = cut;
+	vq->feedback_rate = s->rate - cut;
+}
+
+/*
+ * Timely: react to the queueing delay senders' timestamps saw, rather
+ * than to our own virtual queue.  Below ISO_VQ_CC_DELAY_TARGET_US
+ * always increase, and above four times that always cut; in between,
+ * follow the gradient.  Without ISO_DELAY_SIGNAL there are no samples
+ * and this only ever increases, up to the VQ's rate.
+ */
+#define ISO_CC_TIMELY_BETA (819)	/* 0.8 out of 1024 */
+
+static void iso_cc_timely_init(struct iso_vq *vq) {
+	vq->cc_state.timely.last_delay_us = 0;
+	vq->cc_state.timely.grad = 0;
+}
+
+static void iso_cc_timely_update(struct iso_vq *vq, struct iso_vq_sample *s) {
+	struct iso_cc_timely *t = &vq->cc_state.timely;
+	u64 tlow = s->cfg->vq_cc_delay_target_us, thigh = tlow << 2;
+	u64 delay = s->delay_us, rate = vq->feedback_rate;
+	s32 diff;
+
+	if(s->delay_samples == 0) {
+		vq->feedback_rate += ISO_RFAIR_INCREMENT;
+		return;
+	}
+
+	diff = t->last_delay_us ? (s32)(s->delay_us - t->last_delay_us) : 0;
+	t->last_delay_us = s->delay_us;
+	t->grad = (7 * t->grad + diff) / 8;
+
+	if(delay < tlow) {
+		vq->feedback_rate += ISO_RFAIR_INCREMENT;
+	} else if(delay > thigh) {
+		vq->feedback_rate -= (rate * ISO_CC_TIMELY_BETA * (delay - thigh) / delay) >> 10;
+	} else if(t->grad <= 0) {
+		vq->feedback_rate += ISO_RFAIR_INCREMENT;
+	} else {
+		/* Normalise to the target, and never cut more than beta */
+		u64 grad = min_t(u64, t->grad, tlow);
+		vq->feedback_rate -= (rate * ISO_CC_TIMELY_BETA * grad / tlow) >> 10;
+	}
+}
+
+static struct iso_vq_cc_ops iso_vq_cc_algos[] = {
+	{
+		.name = "rcp",
+		.init = iso_cc_rcp_init,
+		.update = iso_cc_rcp_update,
+	},
+	{
+		.name = "dctcp",
+		.init = iso_cc_dctcp_init,
+		.update = iso_cc_dctcp_update,
+	},
+	{
+		.name = "delay",
+		.init = iso_cc_delay_init,
+		.update = iso_cc_delay_update,
+	},
+	{
+		.name = "pi",
+		.init = iso_cc_pi_init,
+		.update = iso_cc_pi_update,
+	},
+	{
+		.name = "timely",
+		.init = iso_cc_timely_init,
+		.update = iso_cc_timely_update,
+	},
+};
+
+struct iso_vq_cc_ops *iso_vq_cc_default = &iso_vq_cc_algos[0];
+
+struct iso_vq_cc_ops *iso_vq_cc_find(const char *name) {
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(iso_vq_cc_algos); i++) {
+		if(strcmp(iso_vq_cc_algos[i].name, name) == 0)
+			return &iso_vq_cc_algos[i];
+	}
+
+	return NULL;
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
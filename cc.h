@@ -0,0 +1,80 @@
+#ifndef __CC_H__
+#define __CC_H__
+
+#include <linux/types.h>
+
+/*
+ * Receiver side congestion control.  Every control interval, each VQ
+ * hands its algorithm what arrived during the interval, and the
+ * algorithm moves vq->feedback_rate, the rate we advertise to
+ * senders.  The drain loop clamps the result to [ISO_MIN_RFAIR,
+ * sample->rate] afterwards.
+ */
+struct iso_vq;
+struct iso_config;
+
+struct iso_vq_sample {
+	/* The config the drain loop is running with */
+	const struct iso_config *cfg;
+	/* Length of the interval in us */
+	u64 dt;
+	/* Bytes and packets that arrived, and how many were CE marked */
+	u64 rx_bytes;
+	u32 rx_pkts;
+	u32 rx_marked;
+	/* Marked fraction in this interval, out of 1 << ECN_ALPHA_FRAC_SHIFT */
+	u32 frac;
+	/* Arrival rate, in Mb/s */
+	u64 rx_rate;
+	/* The most this VQ may be given right now, in Mb/s */
+	u64 rate;
+	/* Virtual queue backlog, in bytes, at the end of the interval
+	 * and at the end of the one before */
+	u64 backlog;
+	u64 last_backlog;
+	/* Mean queueing delay from sender timestamps, in us, and how
+	 * many packets it is over; none unless ISO_DELAY_SIGNAL */
+	u32 delay_us;
+	u32 delay_samples;
+};
+
+struct iso_vq_cc_ops {
+	const char *name;
+	/* Reset the algorithm's state in the VQ */
+	void (*init)(struct iso_vq *);
+	void (*update)(struct iso_vq *, struct iso_vq_sample *);
+};
+
+/* Per-algorithm state; a VQ has room for exactly one of these */
+struct iso_cc_delay {
+	/* Queueing delay at the end of the last interval, us */
+	u32 delay_us;
+};
+
+struct iso_cc_pi {
+	/* PI output, in Mb/s below the VQ's rate */
+	s64 cut;
+};
+
+struct iso_cc_timely {
+	/* Previous delay sample, and the smoothed change per interval,
+	 * both in us */
+	u32 last_delay_us;
+	s32 grad;
+};
+
+union iso_vq_cc_state {
+	struct iso_cc_delay delay;
+	struct iso_cc_pi pi;
+	struct iso_cc_timely timely;
+};
+
+extern struct iso_vq_cc_ops *iso_vq_cc_default;
+
+struct iso_vq_cc_ops *iso_vq_cc_find(const char *name);
+
+#endif /* __CC_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
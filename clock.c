@@ -0,0 +1,62 @@
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include "clock.h"
+#include "params.h"
+
+DEFINE_PER_CPU(ktime_t, iso_clock_cache);
+
+/* The interval checks one packet does on its way through iso_tx:
+ * iso_txc_tick, iso_rl_should_refill and iso_rl_clock */
+#define ISO_CLOCK_BENCH_CHECKS (3)
+
+static inline int iso_clock_bench_check(ktime_t now, ktime_t last, int interval) {
+	return iso_clock_us_since(now, last) > interval;
+}
+
+/*
+ * Time the clock reads a packet does, the old way (a ktime_get per
+ * interval check) and the new way (one read, passed down).  Prints
+ * ns/packet for each; run it on an idle cpu.
+ */
+void iso_clock_bench(int iters) {
+	ktime_t start, last, now;
+	u64 ns_get, ns_before, ns_after;
+	int i, j, sink = 0, interval;
+
+	if(iters <= 0)
+		return;
+
+	preempt_disable();
+	interval = iso_config()->rl_update_interval_us;
+	last = ktime_get();
+
+	start = ktime_get();
+	for(i = 0; i < iters; i++)
+		sink += ktime_to_ns(ktime_get()) & 1;
+	ns_get = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for(i = 0; i < iters; i++) {
+		for(j = 0; j < ISO_CLOCK_BENCH_CHECKS; j++)
+			sink += iso_clock_bench_check(ktime_get(), last, interval);
+	}
+	ns_before = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for(i = 0; i < iters; i++) {
+		now = iso_clock_now();
+		for(j = 0; j < ISO_CLOCK_BENCH_CHECKS; j++)
+			sink += iso_clock_bench_check(now, last, interval);
+	}
+	ns_after = ktime_to_ns(ktime_sub(ktime_get(), start));
+	preempt_enable();
+
+	printk(KERN_INFO "perfiso: clock bench, %d packets (%d): ktime_get %llu ns, "
+	       "per packet before %llu ns, after %llu ns\n",
+	       iters, sink & 1, div_u64(ns_get, iters),
+	       div_u64(ns_before, iters), div_u64(ns_after, iters));
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,41 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+
+/*
+ * ktime_get is not free: on some VMs every call exits to the
+ * hypervisor.  Each entry point into the datapath (a packet in iso_tx
+ * or iso_rx, a rate limiter tasklet, the control loops) reads the
+ * clock once with iso_clock_now() and passes the time down.  Code too
+ * deep to have it passed reads iso_clock(), the time the current entry
+ * point on this cpu took.  That is good enough for interval checks,
+ * but may be behind times other cpus stored.
+ */
+DECLARE_PER_CPU(ktime_t, iso_clock_cache);
+
+static inline ktime_t iso_clock_now(void) {
+	ktime_t now = ktime_get();
+	__this_cpu_write(iso_clock_cache, now);
+	return now;
+}
+
+static inline ktime_t iso_clock(void) {
+	return __this_cpu_read(iso_clock_cache);
+}
+
+/* Microseconds from @then to @now; 0 if @then was stored by a cpu
+ * whose clock reading is newer than ours */
+static inline u64 iso_clock_us_since(ktime_t now, ktime_t then) {
+	s64 us = ktime_us_delta(now, then);
+	return us > 0 ? us : 0;
+}
+
+void iso_clock_bench(int iters);
+
+#endif /* __CLOCK_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,31 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include "cost.h"
+
+DEFINE_PER_CPU(struct iso_cost_cpu, iso_cost);
+
+const char *iso_cost_names[ISO_COST_MAX] = {
+	[ISO_COST_TX] = "tx",
+	[ISO_COST_RX] = "rx",
+	[ISO_COST_RL_DEQUEUE] = "rl_dequeue",
+	[ISO_COST_RL_TASKLET] = "rl_tasklet",
+	[ISO_COST_FEEDBACK] = "feedback",
+};
+
+void iso_cost_read(enum iso_cost_path path, struct iso_cost *sum) {
+	struct iso_cost *c;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(iso_cost, cpu).path[path];
+		sum->calls += c->calls;
+		sum->packets += c->packets;
+		sum->bytes += c->bytes;
+		sum->cycles += c->cycles;
+	}
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,78 @@
+#ifndef __COST_H__
+#define __COST_H__
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/timex.h>
+#include "params.h"
+
+/*
+ * CPU cost of the datapath, for comparing against plain mq or HTB on
+ * live hosts.  With ISO_CPU_ACCOUNTING set, each path reads the cycle
+ * counter on entry and exit and adds the difference, the packets and
+ * the bytes it handled to this cpu's counters.  Off, it's one test
+ * of the config per path.
+ *
+ * Paths nest: tx includes enqueueing and the first dequeue attempt,
+ * rx includes any feedback it generates, and the tasklet includes
+ * its dequeues.  rl_dequeue counts each level of a class hierarchy
+ * separately, without its parents; the tasklet's packets are what
+ * its dequeues moved, once per level.
+ */
+enum iso_cost_path {
+	ISO_COST_TX,
+	ISO_COST_RX,
+	ISO_COST_RL_DEQUEUE,
+	ISO_COST_RL_TASKLET,
+	ISO_COST_FEEDBACK,
+	ISO_COST_MAX,
+};
+
+struct iso_cost {
+	u64 calls;
+	u64 packets;
+	u64 bytes;
+	u64 cycles;
+};
+
+struct iso_cost_cpu {
+	struct iso_cost path[ISO_COST_MAX];
+};
+
+DECLARE_PER_CPU(struct iso_cost_cpu, iso_cost);
+extern const char *iso_cost_names[ISO_COST_MAX];
+
+static inline cycles_t iso_cost_start(const struct iso_config *cfg) {
+	if(likely(!cfg->cpu_accounting))
+		return 0;
+	return get_cycles();
+}
+
+/* @start is what iso_cost_start returned, with the same @cfg */
+static inline void iso_cost_end(const struct iso_config *cfg, enum iso_cost_path path,
+				cycles_t start, u32 packets, u32 bytes) {
+	struct iso_cost *c;
+
+	if(likely(!cfg->cpu_accounting))
+		return;
+
+	c = &this_cpu_ptr(&iso_cost)->path[path];
+	c->cycles += get_cycles() - start;
+	c->calls++;
+	c->packets += packets;
+	c->bytes += bytes;
+}
+
+/* Packets this cpu has counted on @path so far */
+static inline u64 iso_cost_packets(enum iso_cost_path path) {
+	return this_cpu_ptr(&iso_cost)->path[path].packets;
+}
+
+/* Sum of @path over all cpus */
+void iso_cost_read(enum iso_cost_path path, struct iso_cost *sum);
+
+#endif /* __COST_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,58 @@
+#ifndef __COUNTER_H__
+#define __COUNTER_H__
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <asm/atomic.h>
+#include "clock.h"
+#include "params.h"
+
+/*
+ * Counters bumped on every cpu and read by a control loop.  Each cpu
+ * keeps its own running total in its own per-cpu structure, next to
+ * the other fields the fast path touches.  At most once every
+ * ISO_COUNTER_PUBLISH_US it adds what it counted since its last
+ * publish to a shared atomic.  The control loop reads that atomic
+ * instead of pulling in a cache line from every cpu.
+ *
+ * The aggregate lags each cpu by up to one publish interval, and a
+ * cpu that goes idle holds its last few counts until its next
+ * packet.  Rates computed from differences of the aggregate are
+ * smeared a little in time, but nothing is lost.
+ */
+struct iso_counter {
+	atomic64_t total;
+};
+
+static inline void iso_counter_init(struct iso_counter *c) {
+	atomic64_set(&c->total, 0);
+}
+
+static inline u64 iso_counter_read(struct iso_counter *c) {
+	return (u64)atomic64_read(&c->total);
+}
+
+/* Is it time for this cpu to publish?  @last is the cpu's own
+ * publish time, kept in its per-cpu structure; @interval_us is
+ * ISO_COUNTER_PUBLISH_US from the caller's config */
+static inline int iso_counter_due(ktime_t *last, ktime_t now, u32 interval_us) {
+	if(iso_clock_us_since(now, *last) < interval_us)
+		return 0;
+	*last = now;
+	return 1;
+}
+
+/* Publish one cpu's running total @local; @published is what it
+ * has published so far */
+static inline void iso_counter_publish(struct iso_counter *c, u64 local, u64 *published) {
+	if(local != *published) {
+		atomic64_add(local - *published, &c->total);
+		*published = local;
+	}
+}
+
+#endif /* __COUNTER_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
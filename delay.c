@@ -0,0 +1,89 @@
+#include "delay.h"
+#include "rx.h"
+#include "vq.h"
+
+/* Called as a packet leaves the rate limiters for the device.  This
+ * reads the clock itself: the tasklet's cached time could be a whole
+ * burst old. */
+void __iso_delay_stamp(struct sk_buff *skb, const struct iso_config *cfg) {
+	struct iso_delay_opt opt;
+
+	if(unlikely(eth_hdr(skb)->h_proto != __constant_htons(ETH_P_IP)))
+		return;
+
+	if(unlikely(ip_hdr(skb)->protocol == cfg->feedback_packet_ipproto))
+		return;
+
+	if(!iso_ip_opt_room(skb, skb->dev, ISO_DELAY_OPT_LEN))
+		return;
+
+	opt.type = ISO_DELAY_OPT_TYPE;
+	opt.len = ISO_DELAY_OPT_LEN;
+	opt.reserved = 0;
+	opt.tstamp = htonl((u32)ktime_to_us(ktime_get()));
+	iso_ip_opt_insert(skb, &opt, ISO_DELAY_OPT_LEN);
+}
+
+/*
+ * A stamped packet for @vq arrived; the option is at @off in the IP
+ * header.  Turn it into a queueing delay sample for the VQ.  The
+ * caller strips the option.
+ */
+void iso_delay_rx(struct iso_rx_context *rxctx, struct iso_vq *vq, struct sk_buff *skb, int off,
+		  ktime_t now) {
+	struct iso_delay_opt *opt;
+	struct iso_feedback_peer *peer;
+	struct iso_vq_stats *stats;
+	struct iphdr *iph = ip_hdr(skb);
+	u32 owd, qdelay, base;
+	s64 sub = ISO_DELAY_MIN_OWD_WINDOW_US / ISO_DELAY_OWD_WINDOWS;
+	int i;
+
+	opt = (struct iso_delay_opt *)((u8 *)iph + off);
+	/* Modulo 2^32: only differences between these mean anything */
+	owd = (u32)ktime_to_us(now) - ntohl(opt->tstamp);
+
+	peer = iso_feedback_peer_get(rxctx, iph->saddr, 1, now);
+	if(peer == NULL)
+		return;
+
+	if(!peer->owd_valid ||
+	   ktime_us_delta(now, peer->owd_window_start) > ISO_DELAY_MIN_OWD_WINDOW_US) {
+		/* New sender, or silent for the whole window */
+		for(i = 0; i < ISO_DELAY_OWD_WINDOWS; i++)
+			peer->owd_min[i] = owd;
+		peer->owd_window = 0;
+		peer->owd_window_start = now;
+		peer->owd_valid = 1;
+	}
+
+	while(ktime_us_delta(now, peer->owd_window_start) > sub) {
+		/* Start a new sub-window; the oldest one ages out */
+		peer->owd_window = (peer->owd_window + 1) % ISO_DELAY_OWD_WINDOWS;
+		peer->owd_min[peer->owd_window] = owd;
+		peer->owd_window_start = ktime_add_us(peer->owd_window_start, sub);
+	}
+
+	if((s32)(owd - peer->owd_min[peer->owd_window]) < 0)
+		peer->owd_min[peer->owd_window] = owd;
+
+	/* Not just the current sub-window's: under a standing queue
+	 * that would make the queue the baseline */
+	base = peer->owd_min[0];
+	for(i = 1; i < ISO_DELAY_OWD_WINDOWS; i++) {
+		if((s32)(peer->owd_min[i] - base) < 0)
+			base = peer->owd_min[i];
+	}
+
+	qdelay = owd - base;
+	iso_feedback_peer_put(rxctx, peer);
+
+	/* iso_vq_enqueue publishes these with the packet's other counts */
+	stats = per_cpu_ptr(vq->percpu_stats, smp_processor_id());
+	stats->delay_sum_us += qdelay;
+	stats->delay_samples++;
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
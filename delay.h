@@ -0,0 +1,67 @@
+#ifndef __DELAY_H__
+#define __DELAY_H__
+
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include "params.h"
+
+/*
+ * Optional delay signal.  With ISO_DELAY_SIGNAL set, senders stamp
+ * packets with their clock as they leave the rate limiters, in an IP
+ * option.  The receiver compares that with its own clock.  The clocks
+ * aren't synchronised, so it only trusts the difference from the
+ * smallest one-way delay it has recently seen from that sender: that
+ * is the queueing delay along the path.  Each VQ averages this over
+ * its control interval, for algorithms like "timely" to use.
+ */
+
+/* RFC 4727 experimental option number, with the copy bit set */
+#define ISO_DELAY_OPT_TYPE (0x9e)
+
+struct iso_delay_opt {
+	u8 type;
+	u8 len;
+	__be16 reserved;
+	/* Sender's clock, us */
+	__be32 tstamp;
+} __attribute__((packed));
+
+#define ISO_DELAY_OPT_LEN (sizeof(struct iso_delay_opt))
+
+/* A sender's smallest delay is the minimum over the last
+ * ISO_DELAY_OWD_WINDOWS sub-windows, together this long.  Old ones
+ * age out so clock drift between hosts doesn't accumulate, but a
+ * standing queue shorter than the whole window can't hide itself. */
+#define ISO_DELAY_MIN_OWD_WINDOW_US (10 * 1000 * 1000)
+#define ISO_DELAY_OWD_WINDOWS (4)
+
+/*
+ * Only packets that aren't GSO are stamped.  An option on a GSO
+ * packet would shrink the MSS the sender's TCP chose, and packets
+ * with IP options skip GRO at the receiver, which costs far more CPU
+ * per byte for big flows.
+ */
+enum iso_delay_signal {
+	ISO_DELAY_SIGNAL_OFF = 0,
+	ISO_DELAY_SIGNAL_NOGSO = 1,
+};
+
+struct iso_rx_context;
+struct iso_vq;
+
+void __iso_delay_stamp(struct sk_buff *, const struct iso_config *);
+void iso_delay_rx(struct iso_rx_context *, struct iso_vq *, struct sk_buff *, int off, ktime_t now);
+
+static inline void iso_delay_stamp(struct sk_buff *skb, const struct iso_config *cfg) {
+	if(likely(cfg->delay_signal == ISO_DELAY_SIGNAL_OFF))
+		return;
+	if(skb_is_gso(skb))
+		return;
+	__iso_delay_stamp(skb, cfg);
+}
+
+#endif /* __DELAY_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
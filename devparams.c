@@ -0,0 +1,117 @@
+#include <linux/slab.h>
+#include <linux/ethtool.h>
+#include <linux/rtnetlink.h>
+#include "devparams.h"
+#include "tx.h"
+#include "rx.h"
+#include "vq.h"
+
+/* Called with rtnl held */
+static u32 iso_dev_link_speed(struct net_device *dev) {
+	struct ethtool_cmd cmd;
+	u32 speed;
+
+	ASSERT_RTNL();
+	if(__ethtool_get_settings(dev, &cmd))
+		return 0;
+
+	speed = ethtool_cmd_speed(&cmd);
+	if(speed == 0 || speed == (u16)-1 || speed == (u32)-1)
+		return 0;
+	return speed;
+}
+
+/* Build a fresh parameter block for @dev and publish it in @slot.
+ * Called with rtnl held. */
+int iso_dev_params_refresh(struct iso_dev_params __rcu **slot, struct net_device *dev) {
+	struct iso_dev_params *p, *old;
+	const struct iso_config *cfg;
+	u64 max_tx_rate, drain_rate;
+
+	p = kmalloc(sizeof(*p), GFP_KERNEL);
+	if(p == NULL)
+		return -ENOMEM;
+
+	rcu_read_lock();
+	cfg = iso_config();
+	max_tx_rate = cfg->max_tx_rate;
+	drain_rate = cfg->vq_drain_rate_mbps;
+	rcu_read_unlock();
+
+	p->link_speed = iso_dev_link_speed(dev);
+	if(p->link_speed) {
+		p->max_tx_rate = p->link_speed * max_tx_rate / ISO_REF_LINK_SPEED_MBPS;
+		p->drain_rate = p->link_speed * drain_rate / ISO_REF_LINK_SPEED_MBPS;
+	} else {
+		p->max_tx_rate = max_tx_rate;
+		p->drain_rate = drain_rate;
+	}
+
+	old = rcu_dereference_protected(*slot, 1);
+	rcu_assign_pointer(*slot, p);
+	if(old == NULL || old->link_speed != p->link_speed)
+		printk(KERN_INFO "perfiso: %s link %u Mb/s, max tx rate %llu, drain rate %llu\n",
+		       dev->name, p->link_speed, p->max_tx_rate, p->drain_rate);
+	if(old)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+
+void iso_dev_params_free(struct iso_dev_params __rcu **slot) {
+	struct iso_dev_params *old = rcu_dereference_protected(*slot, 1);
+
+	RCU_INIT_POINTER(*slot, NULL);
+	if(old)
+		kfree_rcu(old, rcu);
+}
+
+/* The link (or the 10G reference rates) changed: rescale everything
+ * on @dev that depends on them.  Called with rtnl held. */
+void iso_dev_refresh(struct net_device *dev) {
+	struct iso_tx_context *txctx, *txctx_next;
+	struct iso_rx_context *rxctx, *rxctx_next;
+	unsigned long flags;
+
+	for_each_tx_context(txctx) {
+		if(txctx->netdev != dev || iso_dev_params_refresh(&txctx->params, dev))
+			continue;
+		iso_txc_recompute_rates(txctx);
+	}
+
+	for_each_rx_context(rxctx) {
+		if(rxctx->netdev != dev || iso_dev_params_refresh(&rxctx->params, dev))
+			continue;
+		spin_lock_irqsave(&rxctx->vq_spinlock, flags);
+		iso_vq_calculate_rates(rxctx);
+		spin_unlock_irqrestore(&rxctx->vq_spinlock, flags);
+	}
+}
+
+static int iso_netdev_event(struct notifier_block *nb, unsigned long event, void *ptr) {
+	struct net_device *dev = ptr;
+
+	switch(event) {
+	case NETDEV_UP:
+	case NETDEV_CHANGE:
+		iso_dev_refresh(dev);
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block iso_netdev_notifier = {
+	.notifier_call = iso_netdev_event,
+};
+
+int iso_dev_params_init() {
+	return register_netdevice_notifier(&iso_netdev_notifier);
+}
+
+void iso_dev_params_exit() {
+	unregister_netdevice_notifier(&iso_netdev_notifier);
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,42 @@
+#ifndef __DEVPARAMS_H__
+#define __DEVPARAMS_H__
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+
+/*
+ * Parameters that depend on the device's hardware.  ISO_MAX_TX_RATE
+ * and ISO_VQ_DRAIN_RATE_MBPS are for a 10G link; each device scales
+ * them to its own link speed, as ethtool reports it, and keeps up as
+ * that changes.  Devices that don't report a speed (veth, some
+ * virtual NICs) use them as they are.
+ *
+ * The datapath reads a device's block under rcu_read_lock.  Updates
+ * run under rtnl, replace the whole block and free the old one after
+ * a grace period.
+ */
+struct iso_dev_params {
+	/* Mb/s; 0 if the driver doesn't say */
+	u32 link_speed;
+	/* Most we send, and the rate VQs drain at, in Mb/s */
+	u64 max_tx_rate;
+	u64 drain_rate;
+	struct rcu_head rcu;
+};
+
+/* The link speed ISO_MAX_TX_RATE and ISO_VQ_DRAIN_RATE_MBPS are for */
+#define ISO_REF_LINK_SPEED_MBPS (10000)
+
+int iso_dev_params_refresh(struct iso_dev_params __rcu **, struct net_device *);
+void iso_dev_params_free(struct iso_dev_params __rcu **);
+void iso_dev_refresh(struct net_device *);
+int iso_dev_params_init(void);
+void iso_dev_params_exit(void);
+
+#endif /* __DEVPARAMS_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
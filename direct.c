@@ -51,6 +51,45 @@ inline void skb_xmit(struct sk_buff *skb) {
 	}
 }
 
+/*
+ * Called with bh disabled.  All skbs on @list must be for the same
+ * tx queue, so we take the queue's lock once for all of them.
+ */
+void skb_xmit_list(struct sk_buff_head *list) {
+	struct netdev_queue *txq;
+	struct sk_buff *skb = skb_peek(list);
+	int cpu;
+	int locked = 0;
+
+	if(skb == NULL)
+		return;
+
+	if(unlikely(old_ndo_start_xmit == NULL)) {
+		__skb_queue_purge(list);
+		return;
+	}
+
+	cpu = smp_processor_id();
+	txq = netdev_get_tx_queue(iso_netdev, skb_get_queue_mapping(skb));
+
+	if(txq->xmit_lock_owner != cpu) {
+		HARD_TX_LOCK(iso_netdev, txq, cpu);
+		locked = 1;
+	}
+
+	while((skb = __skb_dequeue(list)) != NULL) {
+		if(!netif_tx_queue_stopped(txq)) {
+			old_ndo_start_xmit(skb, iso_netdev);
+		} else {
+			kfree_skb(skb);
+		}
+	}
+
+	if(locked) {
+		HARD_TX_UNLOCK(iso_netdev, txq);
+	}
+}
+
 int iso_tx_hook_init(struct iso_tx_context *txctx) {
 	struct net_device_ops *ops;
 
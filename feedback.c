@@ -0,0 +1,670 @@
+#include <linux/jhash.h>
+#include <net/checksum.h>
+#include <linux/vmalloc.h>
+#include "rx.h"
+#include "vq.h"
+#include "feedback.h"
+#include "trace.h"
+#include "cost.h"
+
+int iso_feedback_init(struct iso_rx_context *rxctx) {
+	int cpu, i;
+
+	rxctx->fbpeers = vzalloc(sizeof(struct iso_feedback_peer_set) * ISO_FEEDBACK_PEER_SETS);
+	if(rxctx->fbpeers == NULL)
+		return -ENOMEM;
+
+	for(i = 0; i < ISO_FEEDBACK_PEER_SETS; i++)
+		spin_lock_init(&rxctx->fbpeers[i].lock);
+	atomic_set(&rxctx->fb_seq, 0);
+	do {
+		get_random_bytes(&rxctx->fb_epoch, sizeof(rxctx->fb_epoch));
+	} while(rxctx->fb_epoch == 0);
+
+	rxctx->fbcache = alloc_percpu(struct iso_feedback_cpu);
+	if(rxctx->fbcache == NULL) {
+		vfree(rxctx->fbpeers);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct iso_feedback_cpu *fbc = per_cpu_ptr(rxctx->fbcache, cpu);
+		memset(fbc->templates, 0, sizeof(fbc->templates));
+		skb_queue_head_init(&fbc->pool);
+		skb_queue_head_init(&fbc->batch);
+		tasklet_init(&fbc->flush, iso_feedback_flush, (unsigned long)fbc);
+	}
+
+	INIT_WORK(&rxctx->fb_refill, iso_feedback_refill);
+	iso_feedback_refill(&rxctx->fb_refill);
+	return 0;
+}
+
+void iso_feedback_exit(struct iso_rx_context *rxctx) {
+	int cpu;
+
+	cancel_work_sync(&rxctx->fb_refill);
+	for_each_possible_cpu(cpu) {
+		struct iso_feedback_cpu *fbc = per_cpu_ptr(rxctx->fbcache, cpu);
+		tasklet_kill(&fbc->flush);
+		__skb_queue_purge(&fbc->batch);
+		skb_queue_purge(&fbc->pool);
+	}
+
+	free_percpu(rxctx->fbcache);
+	vfree(rxctx->fbpeers);
+}
+
+/* Process context: top up every cpu's pool */
+void iso_feedback_refill(struct work_struct *work) {
+	struct iso_rx_context *rxctx = container_of(work, struct iso_rx_context, fb_refill);
+	struct sk_buff *skb;
+	int cpu;
+
+	/* XXX: netdev_alloc_skb's meant to allocate packets for receiving.
+	 * Is it okay to use for transmitting?
+	 */
+	for_each_possible_cpu(cpu) {
+		struct iso_feedback_cpu *fbc = per_cpu_ptr(rxctx->fbcache, cpu);
+
+		while(skb_queue_len(&fbc->pool) < ISO_FEEDBACK_POOL_SIZE) {
+			skb = __netdev_alloc_skb(rxctx->netdev, ISO_FEEDBACK_PACKET_SIZE, GFP_KERNEL);
+			if(skb == NULL)
+				return;
+			skb_queue_tail(&fbc->pool, skb);
+		}
+	}
+}
+
+static void iso_feedback_template_build(struct iso_feedback_template *t, struct sk_buff *pkt,
+					const struct iso_config *cfg) {
+	struct ethhdr *eth_to, *eth_from;
+	struct iphdr *iph_to, *iph_from;
+
+	eth_from = eth_hdr(pkt);
+	iph_from = ip_hdr(pkt);
+	eth_to = (struct ethhdr *)t->hdr;
+	iph_to = (struct iphdr *)(t->hdr + ETH_HLEN);
+
+	memcpy(eth_to->h_source, eth_from->h_dest, ETH_ALEN);
+	memcpy(eth_to->h_dest, eth_from->h_source, ETH_ALEN);
+	eth_to->h_proto = eth_from->h_proto;
+
+	iph_to->ihl = 5;
+	iph_to->version = 4;
+	iph_to->tos = 0x2;
+	iph_to->tot_len = htons(ISO_FEEDBACK_HEADER_SIZE);
+	iph_to->id = 0;
+	iph_to->frag_off = 0;
+	iph_to->ttl = ISO_FEEDBACK_PACKET_TTL;
+	iph_to->protocol = (u8)cfg->feedback_packet_ipproto;
+	iph_to->saddr = iph_from->daddr;
+	iph_to->daddr = iph_from->saddr;
+	ip_send_check(iph_to);
+
+	t->saddr = iph_to->saddr;
+	t->daddr = iph_to->daddr;
+	t->valid = 1;
+}
+
+static inline struct iso_feedback_template
+*iso_feedback_template_get(struct iso_feedback_cpu *fbc, struct sk_buff *pkt,
+			   const struct iso_config *cfg) {
+	struct ethhdr *eth_from = eth_hdr(pkt);
+	struct iphdr *iph_from = ip_hdr(pkt);
+	struct iso_feedback_template *t;
+	struct ethhdr *eth;
+	u32 hash;
+
+	hash = jhash_2words(iph_from->daddr, iph_from->saddr, 0xfeedbacc);
+	t = &fbc->templates[hash & (ISO_FEEDBACK_CACHE_SIZE - 1)];
+	eth = (struct ethhdr *)t->hdr;
+
+	/* The peer may have moved, or the protocol number changed */
+	if(likely(t->valid && t->saddr == iph_from->daddr && t->daddr == iph_from->saddr &&
+		  !compare_ether_addr(eth->h_dest, eth_from->h_source) &&
+		  !compare_ether_addr(eth->h_source, eth_from->h_dest) &&
+		  t->hdr[ETH_HLEN + offsetof(struct iphdr, protocol)] == (u8)cfg->feedback_packet_ipproto))
+		return t;
+
+	iso_feedback_template_build(t, pkt, cfg);
+	return t;
+}
+
+static int __iso_generate_feedback(struct iso_rx_context *rxctx, struct iso_feedback_msg *msg,
+				   struct sk_buff *pkt, const struct iso_config *cfg) {
+	struct sk_buff *skb;
+	struct ethhdr *eth_from;
+	struct iphdr *iph;
+	struct iso_feedback_cpu *fbc;
+	struct iso_feedback_template *t;
+	u16 bit;
+
+	eth_from = eth_hdr(pkt);
+	if(unlikely(eth_from->h_proto != __constant_htons(ETH_P_IP)))
+		return 0;
+
+	fbc = per_cpu_ptr(rxctx->fbcache, smp_processor_id());
+	t = iso_feedback_template_get(fbc, pkt, cfg);
+
+	skb = skb_dequeue(&fbc->pool);
+	if(unlikely(skb_queue_len(&fbc->pool) < ISO_FEEDBACK_POOL_SIZE / 2))
+		schedule_work(&rxctx->fb_refill);
+
+	if(unlikely(skb == NULL)) {
+		skb = netdev_alloc_skb(pkt->dev, ISO_FEEDBACK_PACKET_SIZE);
+		if(skb == NULL)
+			return 0;
+	}
+
+	skb->dev = pkt->dev;
+	skb_set_queue_mapping(skb, iso_feedback_txq(pkt->dev, smp_processor_id()));
+	skb->len = ISO_FEEDBACK_PACKET_SIZE;
+	skb->protocol = __constant_htons(ETH_P_IP);
+	skb->pkt_type = PACKET_OUTGOING;
+
+	skb_reset_mac_header(skb);
+	skb_set_tail_pointer(skb, ISO_FEEDBACK_PACKET_SIZE);
+	memcpy(skb->data, t->hdr, ISO_FEEDBACK_TEMPLATE_LEN);
+	memcpy(skb->data + ISO_FEEDBACK_TEMPLATE_LEN, msg, sizeof(*msg));
+
+	skb_pull(skb, ETH_HLEN);
+	skb_reset_network_header(skb);
+	iph = ip_hdr(skb);
+
+	/* Patch the fields that change, and fix up the checksum */
+	bit = msg->count ? min_t(u32, ntohl(msg->entries[0].rate), 0xffff) : 0;
+	if(bit) {
+		__be16 old = *(__be16 *)iph;
+
+		iph->tos |= ISO_ECN_REFLECT_MASK;
+		csum_replace2(&iph->check, old, *(__be16 *)iph);
+		iph->id = bit;
+		csum_replace2(&iph->check, 0, iph->id);
+	}
+
+#if defined(QDISC) || defined(DIRECT)
+	skb_push(skb, ETH_HLEN);
+#endif
+	trace_perfiso_feedback_generate(pkt->dev, msg, ip_hdr(pkt)->saddr);
+
+	if(cfg->feedback_batch > 1) {
+		/* Flushed when full, or at the end of this softirq run */
+		__skb_queue_tail(&fbc->batch, skb);
+		if(skb_queue_len(&fbc->batch) >= cfg->feedback_batch)
+			skb_xmit_list(&fbc->batch);
+		else
+			tasklet_schedule(&fbc->flush);
+		return 1;
+	}
+
+	/* Driver owns the buffer now; we don't need to free it */
+	skb_xmit(skb);
+	return 1;
+}
+
+/* Create a feebdack packet carrying @msg and prepare for transmission.
+ * Returns 1 if successful. */
+int iso_generate_feedback(struct iso_rx_context *rxctx, struct iso_feedback_msg *msg,
+			  struct sk_buff *pkt) {
+	const struct iso_config *cfg = iso_config();
+	cycles_t start = iso_cost_start(cfg);
+	int ret;
+
+	ret = __iso_generate_feedback(rxctx, msg, pkt, cfg);
+	iso_cost_end(cfg, ISO_COST_FEEDBACK, start, ret, ret ? ISO_FEEDBACK_PACKET_SIZE : 0);
+	return ret;
+}
+
+/*
+ * Find sender @ip and lock its set; NULL if another cpu holds the
+ * lock, or @ip isn't there and !@create.  With @create, a new sender
+ * takes the least recently seen slot of its set.  The slot keeps
+ * last_sent, so senders that keep evicting each other still get at
+ * most one feedback per interval between them.
+ */
+struct iso_feedback_peer *iso_feedback_peer_get(struct iso_rx_context *rxctx, __be32 ip, int create,
+						 ktime_t now) {
+	struct iso_feedback_peer_set *set = iso_feedback_set(rxctx, ip);
+	struct iso_feedback_peer *peer, *lru = NULL;
+	int i;
+
+	if(!spin_trylock(&set->lock)) {
+		if(create)
+			iso_reason_inc(rxctx->reasons, ISO_REASON_FB_PEER_BUSY);
+		return NULL;
+	}
+
+	for(i = 0; i < ISO_FEEDBACK_PEER_WAYS; i++) {
+		peer = &set->peers[i];
+		if(peer->ip == ip)
+			goto found;
+		if(lru == NULL || ktime_to_ns(ktime_sub(peer->last_seen, lru->last_seen)) < 0)
+			lru = peer;
+	}
+
+	if(!create) {
+		spin_unlock(&set->lock);
+		return NULL;
+	}
+
+	peer = lru;
+	if(peer->ip != 0)
+		iso_reason_inc(rxctx->reasons, ISO_REASON_FB_PEER_EVICT);
+	peer->ip = ip;
+	peer->count = 0;
+	peer->owd_valid = 0;
+
+ found:
+	if(create)
+		peer->last_seen = now;
+	return peer;
+}
+
+void iso_feedback_peer_put(struct iso_rx_context *rxctx, struct iso_feedback_peer *peer) {
+	spin_unlock(&iso_feedback_set(rxctx, peer->ip)->lock);
+}
+
+/*
+ * Called for data packets from a sender to one of our VQs.  Remember
+ * that the sender is talking to @vq, and if the sender hasn't had
+ * feedback for ISO_FEEDBACK_INTERVAL_US, send it the current rates
+ * of every VQ it has been talking to, in one packet.
+ */
+void iso_feedback_note(struct iso_rx_context *rxctx, struct iso_vq *vq, struct sk_buff *skb,
+		       ktime_t now) {
+	struct iso_feedback_peer *peer;
+	struct iso_feedback_msg msg;
+	const struct iso_config *cfg = iso_config();
+	struct iphdr *iph;
+	struct iso_vq *v;
+	int i, n;
+
+	if(unlikely(eth_hdr(skb)->h_proto != __constant_htons(ETH_P_IP)))
+		return;
+
+	iph = ip_hdr(skb);
+
+	/* NULL if someone else on another cpu is already taking care
+	 * of it */
+	peer = iso_feedback_peer_get(rxctx, iph->saddr, 1, now);
+	if(peer == NULL)
+		return;
+
+	for(i = 0; i < peer->count; i++) {
+		if(peer->local[i] == iph->daddr)
+			break;
+	}
+
+	if(i == peer->count && i < ISO_FEEDBACK_MAX_ENTRIES) {
+		peer->local[i] = iph->daddr;
+		peer->klass[i] = vq->klass;
+		peer->count++;
+	}
+
+	if(ktime_us_delta(now, peer->last_sent) < cfg->feedback_interval_us)
+		goto unlock;
+
+	/* The VQ's rate already reflects what every cpu has seen */
+	n = 0;
+	for(i = 0; i < peer->count; i++) {
+		v = iso_vq_find(peer->klass[i], rxctx);
+		if(v == NULL)
+			continue;
+		msg.entries[n].ip = peer->local[i];
+		msg.entries[n].klass = htonl(iso_class_hash(v->klass));
+		msg.entries[n].rate = htonl((u32)iso_vq_over_limits(v));
+		msg.entries[n].alpha = htons(v->alpha);
+		msg.entries[n].congestion = htons(iso_vq_congestion(v, cfg));
+		n++;
+	}
+
+	msg.version = ISO_FEEDBACK_VERSION;
+	msg.count = n;
+	msg.epoch = rxctx->fb_epoch;
+	msg.reserved = 0;
+	msg.seq = htonl(atomic_inc_return(&rxctx->fb_seq));
+	msg.tstamp = htonl((u32)ktime_to_us(now));
+	peer->count = 0;
+	peer->last_sent = now;
+
+	if(n)
+		iso_generate_feedback(rxctx, &msg, skb);
+
+ unlock:
+	iso_feedback_peer_put(rxctx, peer);
+}
+
+/* Apply one rate from a receiver to our limiter towards it */
+static inline void iso_feedback_apply(struct iso_tx_class *txc, struct iso_per_dest_state *state,
+				      struct iso_dev_params *p, u32 rate, ktime_t now) {
+	struct iso_rc_state *rc = &state->tx_rc;
+	u64 dt;
+
+	/* XXX: for now */
+	if((p->drain_rate > p->max_tx_rate) || (rate == 0))
+		return;
+
+	dt = ktime_us_delta(now, rc->last_rfair_change_time);
+	if(dt < ISO_RFAIR_DECREASE_INTERVAL_US)
+		return;
+
+	if(spin_trylock(&rc->spinlock)) {
+		dt = ktime_us_delta(now, rc->last_rfair_change_time);
+		if(dt >= ISO_RFAIR_DECREASE_INTERVAL_US) {
+			ACCESS_ONCE(state->rl->rate) = rate;
+			state->rl->last_rate_update_time = now;
+			rc->last_rfair_change_time = now;
+		}
+		spin_unlock(&rc->spinlock);
+	} else {
+		iso_reason_inc(txc->reasons, ISO_REASON_RC_LOCK_BUSY);
+	}
+}
+
+/*
+ * Sender AIMD: run the rate controller on the receiver's congestion
+ * signal.  The limiter only ever reads rate, so publish it without
+ * taking the limiter's lock.
+ */
+static inline void iso_feedback_aimd(struct iso_tx_class *txc, struct iso_per_dest_state *state,
+				     struct iso_dev_params *p, u32 congestion, ktime_t now) {
+	struct iso_rc_state *rc = &state->tx_rc;
+	int changed = iso_rc_rx(rc, congestion, p->max_tx_rate, now);
+
+	if(changed > 0) {
+		ACCESS_ONCE(state->rl->rate) = ACCESS_ONCE(rc->rfair);
+		state->rl->last_rate_update_time = now;
+	} else if(changed < 0) {
+		iso_reason_inc(txc->reasons, ISO_REASON_RC_LOCK_BUSY);
+	}
+}
+
+/*
+ * Returns 1 if @msg is older than, or the same as, the last feedback
+ * applied to @rc from the same receiver epoch.  Sequence numbers
+ * wrap, so compare them as serial numbers.
+ */
+static inline int iso_feedback_stale(struct iso_rc_state *rc, u8 epoch, u32 seq, u32 tstamp,
+				     ktime_t now) {
+	if(rc->feedback_seen && epoch == rc->last_feedback_epoch &&
+	   ktime_us_delta(now, rc->last_feedback_time) < ISO_FEEDBACK_SEQ_TIMEOUT_US &&
+	   (s32)(seq - ACCESS_ONCE(rc->last_feedback_seq)) <= 0) {
+		rc->num_stale_feedback++;
+		return 1;
+	}
+
+	ACCESS_ONCE(rc->last_feedback_seq) = seq;
+	rc->last_feedback_epoch = epoch;
+	rc->last_feedback_tstamp = tstamp;
+	rc->last_feedback_time = now;
+	rc->feedback_seen = 1;
+	return 0;
+}
+
+/* Sender side: a feedback packet for class @txc arrived */
+void iso_feedback_rx(struct iso_tx_class *txc, struct sk_buff *skb, ktime_t now) {
+	struct iso_per_dest_state *state;
+	struct iso_feedback_entry *e;
+	struct iso_feedback_msg *msg;
+	struct iso_dev_params *p = iso_txctx_params(txc->txctx);
+	int rc_mode = iso_config()->rc_mode;
+	struct iphdr *iph = ip_hdr(skb);
+	int hlen = iph->ihl << 2;
+	int len = ntohs(iph->tot_len) - hlen;
+	u32 rate;
+	int i, count;
+
+	if(len < (int)ISO_FEEDBACK_MSG_HLEN || !pskb_may_pull(skb, hlen + ISO_FEEDBACK_MSG_HLEN))
+		goto legacy;
+
+	msg = (struct iso_feedback_msg *)(skb_network_header(skb) + hlen);
+	if(msg->version != ISO_FEEDBACK_VERSION)
+		goto legacy;
+
+	count = min_t(int, msg->count, ISO_FEEDBACK_MAX_ENTRIES);
+	count = min_t(int, count, (len - ISO_FEEDBACK_MSG_HLEN) / sizeof(*e));
+	if(!pskb_may_pull(skb, hlen + ISO_FEEDBACK_MSG_HLEN + count * sizeof(*e)))
+		return;
+
+	/* pskb_may_pull may have moved the data */
+	msg = (struct iso_feedback_msg *)(skb_network_header(skb) + hlen);
+
+	for(i = 0; i < count; i++) {
+		e = &msg->entries[i];
+		rate = ntohl(e->rate);
+		state = iso_state_get_ip(txc, ntohl(e->ip),
+					 rate ? ISO_CREATE_RL : ISO_DONT_CREATE_RL);
+		if(state == NULL ||
+		   iso_feedback_stale(&state->tx_rc, msg->epoch, ntohl(msg->seq),
+				      ntohl(msg->tstamp), now))
+			continue;
+
+		if(rc_mode == ISO_RC_MODE_AIMD)
+			iso_feedback_aimd(txc, state, p, ntohs(e->congestion), now);
+		else
+			iso_feedback_apply(txc, state, p, rate, now);
+		trace_perfiso_feedback_rx(txc, state, ntohl(e->ip), rate, ntohs(e->congestion));
+	}
+	return;
+
+ legacy:
+	/* Older receivers only send the rate in iph->id */
+	state = iso_state_get(txc, skb, 1, ISO_CREATE_RL && iso_is_feedback_marked(skb));
+	if(state != NULL) {
+		rate = skb_has_feedback(skb);
+		iso_feedback_apply(txc, state, p, rate, now);
+		trace_perfiso_feedback_rx(txc, state, ntohl(iph->saddr), rate, 0);
+	}
+}
+
+/*
+ * IP options we add to packets.  Options go right after the IP header
+ * and must be a multiple of 4 bytes long.  The Ethernet and IP headers
+ * move, and the transport header stays where it is, so checksum
+ * offload state is unaffected.
+ */
+
+/* Can we add @len bytes of options to @skb on its way out @out?  TCP
+ * GSO packets make room by cutting the segment size; every segment
+ * gets a copy of the options. */
+int iso_ip_opt_room(struct sk_buff *skb, const struct net_device *out, int len) {
+	struct iphdr *iph = ip_hdr(skb);
+
+	/* Never GSO: it would change the MSS the sender chose */
+	if(iph->ihl + (len >> 2) > 15 || skb_mac_header(skb) != skb->data || skb_is_gso(skb))
+		return 0;
+
+	return skb->len - skb_network_offset(skb) + len <= out->mtu;
+}
+
+/* Append @opt to the IP header of an outgoing packet.  The caller has
+ * checked iso_ip_opt_room. */
+int iso_ip_opt_insert(struct sk_buff *skb, const void *opt, int len) {
+	struct iphdr *iph;
+	int hdr_end;
+
+	if(skb_cow_head(skb, len))
+		return -ENOMEM;
+
+	iph = ip_hdr(skb);
+	hdr_end = skb_network_offset(skb) + (iph->ihl << 2);
+	skb_push(skb, len);
+	memmove(skb->data, skb->data + len, hdr_end);
+	skb->mac_header -= len;
+	skb->network_header -= len;
+	memcpy(skb->data + hdr_end, opt, len);
+
+	iph = ip_hdr(skb);
+	iph->ihl += len >> 2;
+	iph->tot_len = htons(ntohs(iph->tot_len) + len);
+	ip_send_check(iph);
+	return 0;
+}
+
+/* Returns the offset of option @type in the IP header of a received
+ * packet, or -1.  The caller has pulled the whole IP header. */
+int iso_ip_opt_find(struct sk_buff *skb, u8 type, u8 len) {
+	struct iphdr *iph = ip_hdr(skb);
+	u8 *p = (u8 *)(iph + 1);
+	u8 *end = (u8 *)iph + (iph->ihl << 2);
+
+	while(p < end) {
+		if(*p == IPOPT_END)
+			return -1;
+		if(*p == IPOPT_NOOP) {
+			p++;
+			continue;
+		}
+		if(p + 1 >= end || p[1] < 2 || p + p[1] > end)
+			return -1;
+		if(*p == type && p[1] == len)
+			return p - (u8 *)iph;
+		p += p[1];
+	}
+
+	return -1;
+}
+
+/* Remove the @len byte option at @off from a received packet by moving
+ * everything before it up over it.  The IP header checksum stays valid
+ * and @len is a multiple of 4, so a CHECKSUM_COMPLETE sum is
+ * unchanged. */
+int iso_ip_opt_strip(struct sk_buff *skb, int off, int len) {
+	struct iphdr *iph;
+	u8 *mac;
+	int start;
+
+	if(skb_cloned(skb) && pskb_expand_head(skb, 0, 0, GFP_ATOMIC))
+		return -ENOMEM;
+
+	mac = skb_mac_header(skb);
+	start = skb_network_offset(skb) + off;
+	if(mac < skb->data) {
+		/* Keep the Ethernet header in front of the IP header */
+		memmove(mac + len, mac, skb->data - mac + start);
+	} else {
+		memmove(skb->data + len, skb->data, start);
+	}
+
+	skb_pull(skb, len);
+	skb->mac_header += len;
+	skb->network_header += len;
+
+	iph = ip_hdr(skb);
+	iph->ihl -= len >> 2;
+	iph->tot_len = htons(ntohs(iph->tot_len) - len);
+	ip_send_check(iph);
+	return 0;
+}
+
+/*
+ * Called on transmit with an IP packet to @skb's destination.  If that
+ * host is owed feedback for just the VQ this packet is from, put it in
+ * an IP option here instead of sending a feedback packet.  Returns 1
+ * if it did.
+ */
+int iso_feedback_piggyback(struct iso_rx_context *rxctx, struct sk_buff *skb,
+			   const struct net_device *out, ktime_t now) {
+	struct iso_feedback_peer_set *set;
+	struct iso_feedback_peer *peer;
+	struct iso_feedback_opt opt;
+	const struct iso_config *cfg = iso_config();
+	struct iphdr *iph = ip_hdr(skb);
+	struct iso_vq *vq = NULL;
+	int i, ret = 0;
+
+	/* Cheap checks before we go for the lock */
+	set = iso_feedback_set(rxctx, iph->daddr);
+	for(i = 0; i < ISO_FEEDBACK_PEER_WAYS; i++) {
+		peer = &set->peers[i];
+		if(ACCESS_ONCE(peer->ip) == iph->daddr && ACCESS_ONCE(peer->count) == 1)
+			break;
+	}
+	if(i == ISO_FEEDBACK_PEER_WAYS)
+		return 0;
+
+	if(ktime_us_delta(now, peer->last_sent) < cfg->feedback_interval_us)
+		return 0;
+
+	if(!iso_ip_opt_room(skb, out, ISO_FEEDBACK_OPT_LEN))
+		return 0;
+
+	peer = iso_feedback_peer_get(rxctx, iph->daddr, 0, now);
+	if(peer == NULL)
+		return 0;
+
+	if(peer->count != 1 || peer->local[0] != iph->saddr)
+		goto unlock;
+
+	if(ktime_us_delta(now, peer->last_sent) < cfg->feedback_interval_us)
+		goto unlock;
+
+	vq = iso_vq_find(peer->klass[0], rxctx);
+	if(vq == NULL)
+		goto unlock;
+
+	opt.type = ISO_FEEDBACK_OPT_TYPE;
+	opt.len = ISO_FEEDBACK_OPT_LEN;
+	opt.version = ISO_FEEDBACK_VERSION;
+	opt.epoch = rxctx->fb_epoch;
+	opt.seq = htonl(atomic_inc_return(&rxctx->fb_seq));
+	opt.rate = htonl((u32)iso_vq_over_limits(vq));
+	opt.alpha = htons(vq->alpha);
+	opt.congestion = htons(iso_vq_congestion(vq, cfg));
+
+	if(iso_ip_opt_insert(skb, &opt, ISO_FEEDBACK_OPT_LEN))
+		goto unlock;
+
+	peer->count = 0;
+	peer->last_sent = now;
+	ret = 1;
+
+ unlock:
+	iso_feedback_peer_put(rxctx, peer);
+	return ret;
+}
+
+/*
+ * Receive side of iso_feedback_piggyback: apply the option at @off in
+ * the IP header.  The caller strips it.
+ */
+void iso_feedback_opt_rx(struct iso_tx_context *txctx, iso_class_t klass,
+			 struct sk_buff *skb, int off, ktime_t now) {
+	struct iso_feedback_opt *opt;
+	struct iso_per_dest_state *state;
+	struct iso_tx_class *txc;
+	struct iphdr *iph = ip_hdr(skb);
+	u32 rate;
+
+	opt = (struct iso_feedback_opt *)((u8 *)iph + off);
+	if(opt->version != ISO_FEEDBACK_VERSION)
+		return;
+
+	txc = iso_txc_find(klass, txctx);
+	if(txc == NULL)
+		return;
+
+	rate = ntohl(opt->rate);
+	state = iso_state_get_ip(txc, ntohl(iph->saddr),
+				 rate ? ISO_CREATE_RL : ISO_DONT_CREATE_RL);
+	if(state == NULL || iso_feedback_stale(&state->tx_rc, opt->epoch, ntohl(opt->seq), 0, now))
+		return;
+
+	if(iso_config()->rc_mode == ISO_RC_MODE_AIMD)
+		iso_feedback_aimd(txc, state, iso_txctx_params(txctx), ntohs(opt->congestion), now);
+	else
+		iso_feedback_apply(txc, state, iso_txctx_params(txctx), rate, now);
+}
+
+/* Tasklet: send whatever feedback is batched up on this cpu */
+void iso_feedback_flush(unsigned long _fbc) {
+	struct iso_feedback_cpu *fbc = (struct iso_feedback_cpu *)_fbc;
+
+	if(!skb_queue_empty(&fbc->batch))
+		skb_xmit_list(&fbc->batch);
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
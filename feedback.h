@@ -0,0 +1,182 @@
+#ifndef __FEEDBACK_H__
+#define __FEEDBACK_H__
+
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/workqueue.h>
+#include <linux/interrupt.h>
+#include <linux/netdevice.h>
+#include "class.h"
+#include "delay.h"
+
+/* These MUST be a power of 2 */
+#define ISO_FEEDBACK_CACHE_SIZE (64)
+#define ISO_FEEDBACK_POOL_SIZE (64)
+
+#define ISO_FEEDBACK_TEMPLATE_LEN (ETH_HLEN + sizeof(struct iphdr))
+
+/* Rates for this many of our VQs fit in one feedback packet */
+#define ISO_FEEDBACK_MAX_ENTRIES (8)
+/* Senders we aggregate feedback for, in sets of
+ * ISO_FEEDBACK_PEER_WAYS; both MUST be powers of 2 */
+#define ISO_FEEDBACK_MAX_PEERS (1024)
+#define ISO_FEEDBACK_PEER_WAYS (4)
+#define ISO_FEEDBACK_PEER_SETS (ISO_FEEDBACK_MAX_PEERS / ISO_FEEDBACK_PEER_WAYS)
+
+/*
+ * The feedback payload follows the IP header.  Each entry carries the
+ * state of one of our VQs, for one of our addresses the sender is
+ * talking to, which is what the sender keys its per-dest state on.
+ * For older senders, the first entry's rate is also put in iph->id.
+ * With ISO_RC_MODE_AIMD, senders ignore the rate and run their own
+ * AIMD off the congestion signal instead.
+ *
+ * Senders ignore the payload of versions they don't know, and any
+ * message whose sequence number isn't newer than the last one they
+ * applied for that address.  Sequence numbers are per receiving
+ * device, which picks a random epoch when it starts: a message from
+ * another epoch, or the first in ISO_FEEDBACK_SEQ_TIMEOUT_US, is
+ * always accepted and starts the comparison over.  So a receiver
+ * that restarted, or that sends from several devices, is never shut
+ * out.
+ */
+#define ISO_FEEDBACK_VERSION (1)
+#define ISO_FEEDBACK_SEQ_TIMEOUT_US (100 * 1000)
+
+struct iso_feedback_entry {
+	__be32 ip;
+	/* iso_class_hash() of the VQ's class */
+	__be32 klass;
+	/* Advertised rate, Mb/s */
+	__be32 rate;
+	/* Smoothed fraction of ECN marks at the VQ, out of 1024 */
+	__be16 alpha;
+	/* Congestion at the VQ, out of 1024; drives sender AIMD */
+	__be16 congestion;
+} __attribute__((packed));
+
+struct iso_feedback_msg {
+	u8 version;
+	u8 count;
+	/* Receiving device's epoch; seq only compares within one */
+	u8 epoch;
+	u8 reserved;
+	/* Per receiving device, one more for every message */
+	__be32 seq;
+	/* Receiver's clock when the message was built, us */
+	__be32 tstamp;
+	struct iso_feedback_entry entries[ISO_FEEDBACK_MAX_ENTRIES];
+} __attribute__((packed));
+
+#define ISO_FEEDBACK_MSG_HLEN (offsetof(struct iso_feedback_msg, entries))
+
+/*
+ * Feedback for a single VQ can instead ride in an IP option on a
+ * packet we send to the sender anyway.  The sender keys it on the
+ * packet's source address and strips it before the stack sees it.
+ * The option number is the RFC 4727 experimental one.
+ */
+#define ISO_FEEDBACK_OPT_TYPE (0x5e)
+
+struct iso_feedback_opt {
+	u8 type;
+	u8 len;
+	u8 version;
+	u8 epoch;
+	__be32 seq;
+	__be32 rate;
+	__be16 alpha;
+	__be16 congestion;
+} __attribute__((packed));
+
+#define ISO_FEEDBACK_OPT_LEN (sizeof(struct iso_feedback_opt))
+
+/*
+ * Feedback owed to one sender.  Data from the sender to any of our
+ * VQs, on any cpu, is noted here, and at most one feedback packet per
+ * ISO_FEEDBACK_INTERVAL_US carries the current rates of all of them.
+ */
+struct iso_feedback_peer {
+	__be32 ip;
+	/* Last data from this sender; the set evicts the oldest */
+	ktime_t last_seen;
+	ktime_t last_sent;
+	int count;
+	__be32 local[ISO_FEEDBACK_MAX_ENTRIES];
+	iso_class_t klass[ISO_FEEDBACK_MAX_ENTRIES];
+
+	/* Smallest one-way delay seen from this sender in each recent
+	 * sub-window, in the sender's clock minus ours; see delay.c */
+	u32 owd_min[ISO_DELAY_OWD_WINDOWS];
+	ktime_t owd_window_start;
+	u8 owd_window;
+	u8 owd_valid;
+};
+
+/* The senders that hash to the same place, under one lock */
+struct iso_feedback_peer_set {
+	spinlock_t lock;
+	struct iso_feedback_peer peers[ISO_FEEDBACK_PEER_WAYS];
+};
+
+/*
+ * A preformatted Ethernet + IP header for feedback to one peer.  The
+ * checksum is computed with id = 0 and without the reflect bit, so
+ * only those two fields need to be patched for every packet.
+ */
+struct iso_feedback_template {
+	__be32 saddr;
+	__be32 daddr;
+	u8 valid;
+	u8 hdr[ISO_FEEDBACK_TEMPLATE_LEN];
+};
+
+/* Per-cpu feedback state */
+struct iso_feedback_cpu {
+	/* Direct mapped on (saddr, daddr) of the feedback packet */
+	struct iso_feedback_template templates[ISO_FEEDBACK_CACHE_SIZE];
+	/* Preallocated skbs, topped up from process context */
+	struct sk_buff_head pool;
+	/* Feedback waiting to go out on this cpu's tx queue */
+	struct sk_buff_head batch;
+	struct tasklet_struct flush;
+};
+
+struct iso_rx_context;
+struct iso_tx_context;
+struct iso_tx_class;
+struct iso_vq;
+
+int iso_feedback_init(struct iso_rx_context *);
+void iso_feedback_exit(struct iso_rx_context *);
+void iso_feedback_refill(struct work_struct *);
+int iso_generate_feedback(struct iso_rx_context *, struct iso_feedback_msg *, struct sk_buff *pkt);
+void iso_feedback_flush(unsigned long);
+struct iso_feedback_peer *iso_feedback_peer_get(struct iso_rx_context *, __be32 ip, int create,
+						 ktime_t now);
+void iso_feedback_peer_put(struct iso_rx_context *, struct iso_feedback_peer *);
+void iso_feedback_note(struct iso_rx_context *, struct iso_vq *, struct sk_buff *, ktime_t now);
+void iso_feedback_rx(struct iso_tx_class *, struct sk_buff *, ktime_t now);
+int iso_feedback_piggyback(struct iso_rx_context *, struct sk_buff *, const struct net_device *, ktime_t now);
+void iso_feedback_opt_rx(struct iso_tx_context *, iso_class_t, struct sk_buff *, int off, ktime_t now);
+
+int iso_ip_opt_room(struct sk_buff *, const struct net_device *, int len);
+int iso_ip_opt_insert(struct sk_buff *, const void *opt, int len);
+int iso_ip_opt_find(struct sk_buff *, u8 type, u8 len);
+int iso_ip_opt_strip(struct sk_buff *, int off, int len);
+
+/*
+ * Send feedback on the tx queue that belongs to this cpu, the same
+ * one-to-one mapping drivers set up for XPS, so receive cpus don't
+ * all fight over queue 0's lock.
+ */
+static inline u16 iso_feedback_txq(struct net_device *dev, int cpu) {
+	return cpu % dev->real_num_tx_queues;
+}
+
+#endif /* __FEEDBACK_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
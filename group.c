@@ -0,0 +1,341 @@
+#include "group.h"
+#include "tx.h"
+#include "rx.h"
+#include "vq.h"
+
+static struct iso_group iso_groups[ISO_MAX_GROUPS];
+
+void iso_groups_init() {
+	int i;
+
+	for(i = 0; i < ISO_MAX_GROUPS; i++) {
+		struct iso_group *g = &iso_groups[i];
+		g->id = i;
+		spin_lock_init(&g->lock);
+		INIT_LIST_HEAD(&g->txctx_list);
+		INIT_LIST_HEAD(&g->rxctx_list);
+		g->num_tx = g->num_rx = 0;
+		g->last_update_time = ktime_get();
+	}
+}
+
+struct iso_group *iso_group_get(int id) {
+	if(id <= 0 || id >= ISO_MAX_GROUPS)
+		return NULL;
+	return &iso_groups[id];
+}
+
+/* Called with the config lock */
+int iso_group_join(struct iso_group *g, struct iso_tx_context *txctx, struct iso_rx_context *rxctx) {
+	unsigned long flags;
+
+	if(txctx->group || rxctx->group)
+		return -EBUSY;
+
+	spin_lock_irqsave(&g->lock, flags);
+	list_add_tail(&txctx->group_list, &g->txctx_list);
+	list_add_tail(&rxctx->group_list, &g->rxctx_list);
+	txctx->group = g;
+	rxctx->group = g;
+	g->num_tx++;
+	g->num_rx++;
+	spin_unlock_irqrestore(&g->lock, flags);
+	return 0;
+}
+
+void iso_group_leave_tx(struct iso_tx_context *txctx) {
+	struct iso_group *g = txctx->group;
+	struct iso_tx_class *txc;
+	unsigned long flags;
+
+	if(g == NULL)
+		return;
+
+	spin_lock_irqsave(&g->lock, flags);
+	list_del_init(&txctx->group_list);
+	txctx->group = NULL;
+	g->num_tx--;
+	spin_unlock_irqrestore(&g->lock, flags);
+
+	/* Back to guarantees computed from this device alone */
+	rcu_read_lock();
+	for_each_txc_rcu(txc, txctx) {
+		txc->group_min_rate = 0;
+	}
+	rcu_read_unlock();
+	iso_txc_recompute_rates(txctx);
+}
+
+void iso_group_leave_rx(struct iso_rx_context *rxctx) {
+	struct iso_group *g = rxctx->group;
+	struct iso_vq *vq;
+	unsigned long flags;
+
+	if(g == NULL)
+		return;
+
+	spin_lock_irqsave(&g->lock, flags);
+	list_del_init(&rxctx->group_list);
+	rxctx->group = NULL;
+	g->num_rx--;
+	spin_unlock_irqrestore(&g->lock, flags);
+
+	rcu_read_lock();
+	for_each_vq_rcu(vq, rxctx) {
+		vq->group_min_rate = 0;
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Everything below runs under rcu_read_lock and the group lock.  The
+ * group lock only covers the member lists; each member's classes and
+ * VQs are walked as rcu lists, as create and delete change them under
+ * the config lock with the _rcu list ops.
+ */
+
+/* Is @txc the first class with its klass among the group's members? */
+static int iso_group_first_txc(struct iso_group *g, struct iso_tx_context *owner,
+			       struct iso_tx_class *txc) {
+	struct iso_tx_context *m;
+
+	list_for_each_entry(m, &g->txctx_list, group_list) {
+		if(m == owner)
+			return 1;
+		if(iso_txc_find(txc->klass, m) != NULL)
+			return 0;
+	}
+	return 1;
+}
+
+static int iso_group_first_vq(struct iso_group *g, struct iso_rx_context *owner,
+			      struct iso_vq *vq) {
+	struct iso_rx_context *m;
+
+	list_for_each_entry(m, &g->rxctx_list, group_list) {
+		if(m == owner)
+			return 1;
+		if(iso_vq_find(vq->klass, m) != NULL)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Guarantees asked of member @m may add up to more than its link,
+ * e.g. when every tenant's traffic is on the same member.  Water-fill
+ * them by weight: find the level L such that giving each class
+ * min(ask, L * weight) adds up to the member's capacity.  Each pass
+ * only adds classes to the satisfied set, so this takes at most one
+ * pass per class.
+ */
+static void iso_group_tx_waterfill(struct iso_tx_context *m) {
+	struct iso_tx_class *txc;
+	u64 cap = iso_txctx_params(m)->max_tx_rate;
+	u64 sum = 0, left, level, weight = 0, last_weight;
+
+	for_each_txc_rcu(txc, m) {
+		if(txc->parent != NULL || txc->group_min_rate == 0)
+			continue;
+		sum += txc->group_min_rate;
+		weight += txc->weight;
+	}
+
+	if(sum <= cap || weight == 0)
+		return;
+
+	level = div64_u64(cap, weight);
+	do {
+		last_weight = weight;
+		left = cap;
+		weight = 0;
+		for_each_txc_rcu(txc, m) {
+			if(txc->parent != NULL || txc->group_min_rate == 0)
+				continue;
+			if(txc->group_min_rate <= level * txc->weight)
+				left -= txc->group_min_rate;
+			else
+				weight += txc->weight;
+		}
+		if(weight == 0)
+			return;
+		level = div64_u64(left, weight);
+	} while(weight != last_weight);
+
+	for_each_txc_rcu(txc, m) {
+		if(txc->parent == NULL)
+			txc->group_min_rate = min_t(u64, txc->group_min_rate, level * txc->weight);
+	}
+}
+
+/*
+ * A top-level class's guarantee is its weighted share of the whole
+ * group's capacity.  Each member provides a part of it proportional
+ * to the class's recent tx rate on that member (+1 so idle classes
+ * split evenly), water-filled so no member promises more than its
+ * own capacity.
+ */
+static void iso_group_tx_update(struct iso_group *g) {
+	struct iso_tx_context *m, *m2;
+	struct iso_tx_class *txc, *t;
+	u64 capacity = 0, total_weight = 0, guarantee, demand;
+
+	list_for_each_entry(m, &g->txctx_list, group_list) {
+		capacity += iso_txctx_params(m)->max_tx_rate;
+	}
+
+	list_for_each_entry(m, &g->txctx_list, group_list) {
+		for_each_txc_rcu(txc, m) {
+			if(txc->parent == NULL && iso_group_first_txc(g, m, txc))
+				total_weight += txc->weight;
+		}
+	}
+
+	if(total_weight == 0)
+		return;
+
+	list_for_each_entry(m, &g->txctx_list, group_list) {
+		for_each_txc_rcu(txc, m) {
+			if(txc->parent != NULL || !iso_group_first_txc(g, m, txc))
+				continue;
+
+			guarantee = capacity * txc->weight / total_weight;
+			demand = 0;
+			list_for_each_entry(m2, &g->txctx_list, group_list) {
+				t = iso_txc_find(txc->klass, m2);
+				if(t && t->parent == NULL)
+					demand += t->tx_rate_smooth + 1;
+			}
+
+			list_for_each_entry(m2, &g->txctx_list, group_list) {
+				t = iso_txc_find(txc->klass, m2);
+				if(t == NULL || t->parent != NULL)
+					continue;
+				t->group_min_rate = min_t(u64, iso_txctx_params(m2)->max_tx_rate,
+							  guarantee * (t->tx_rate_smooth + 1) / demand);
+			}
+		}
+	}
+
+	list_for_each_entry(m, &g->txctx_list, group_list) {
+		iso_group_tx_waterfill(m);
+		iso_txc_update_guarantees(m);
+	}
+}
+
+/* Same as iso_group_tx_waterfill, for VQs on an rx member */
+static void iso_group_rx_waterfill(struct iso_rx_context *m) {
+	struct iso_vq *vq;
+	u64 cap = iso_rxctx_params(m)->drain_rate;
+	u64 sum = 0, left, level, weight = 0, last_weight;
+
+	for_each_vq_rcu(vq, m) {
+		if(vq->group_min_rate == 0)
+			continue;
+		sum += vq->group_min_rate;
+		weight += vq->weight;
+	}
+
+	if(sum <= cap || weight == 0)
+		return;
+
+	level = div64_u64(cap, weight);
+	do {
+		last_weight = weight;
+		left = cap;
+		weight = 0;
+		for_each_vq_rcu(vq, m) {
+			if(vq->group_min_rate == 0)
+				continue;
+			if(vq->group_min_rate <= level * vq->weight)
+				left -= vq->group_min_rate;
+			else
+				weight += vq->weight;
+		}
+		if(weight == 0)
+			return;
+		level = div64_u64(left, weight);
+	} while(weight != last_weight);
+
+	for_each_vq_rcu(vq, m) {
+		vq->group_min_rate = min_t(u64, vq->group_min_rate, level * vq->weight);
+	}
+}
+
+/* Same as above, for VQs and their receive rates */
+static void iso_group_rx_update(struct iso_group *g) {
+	struct iso_rx_context *m, *m2;
+	struct iso_vq *vq, *v;
+	u64 capacity = 0, total_weight = 0, guarantee, demand;
+
+	list_for_each_entry(m, &g->rxctx_list, group_list) {
+		capacity += iso_rxctx_params(m)->drain_rate;
+	}
+
+	list_for_each_entry(m, &g->rxctx_list, group_list) {
+		for_each_vq_rcu(vq, m) {
+			if(iso_group_first_vq(g, m, vq))
+				total_weight += vq->weight;
+		}
+	}
+
+	if(total_weight == 0)
+		return;
+
+	list_for_each_entry(m, &g->rxctx_list, group_list) {
+		for_each_vq_rcu(vq, m) {
+			if(!iso_group_first_vq(g, m, vq))
+				continue;
+
+			guarantee = capacity * vq->weight / total_weight;
+			demand = 0;
+			list_for_each_entry(m2, &g->rxctx_list, group_list) {
+				v = iso_vq_find(vq->klass, m2);
+				if(v)
+					demand += v->rx_rate + 1;
+			}
+
+			list_for_each_entry(m2, &g->rxctx_list, group_list) {
+				v = iso_vq_find(vq->klass, m2);
+				if(v == NULL)
+					continue;
+				v->group_min_rate = min_t(u64, iso_rxctx_params(m2)->drain_rate,
+							  guarantee * (v->rx_rate + 1) / demand);
+			}
+		}
+	}
+
+	list_for_each_entry(m, &g->rxctx_list, group_list) {
+		iso_group_rx_waterfill(m);
+	}
+}
+
+/* Called from the members' control loops; the first one to notice
+ * that the interval has passed does the work for everyone. */
+void iso_group_tick(struct iso_group *g, ktime_t now) {
+	unsigned long flags;
+	int interval = iso_config()->group_update_interval_us;
+
+	if(ktime_us_delta(now, g->last_update_time) < interval)
+		return;
+
+	if(!spin_trylock_irqsave(&g->lock, flags))
+		return;
+
+	if(ktime_us_delta(now, g->last_update_time) < interval)
+		goto unlock;
+
+	g->last_update_time = now;
+
+	rcu_read_lock();
+	iso_group_tx_update(g);
+	iso_group_rx_update(g);
+	rcu_read_unlock();
+
+ unlock:
+	spin_unlock_irqrestore(&g->lock, flags);
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,42 @@
+#ifndef __GROUP_H__
+#define __GROUP_H__
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+
+/*
+ * A host-wide group of devices (e.g., bond slaves, or several NICs)
+ * that share one set of tenant guarantees.  Each member keeps its own
+ * tx/rx context, so rate limiters and VQs stay local to the device;
+ * the group only decides how much of a tenant's guarantee each member
+ * should provide, in proportion to where the tenant's traffic is.
+ */
+struct iso_group {
+	int id;
+	spinlock_t lock;
+	struct list_head txctx_list;
+	struct list_head rxctx_list;
+	int num_tx;
+	int num_rx;
+	ktime_t last_update_time;
+};
+
+/* Group 0 means "not in a group" */
+#define ISO_MAX_GROUPS (8)
+
+struct iso_tx_context;
+struct iso_rx_context;
+
+void iso_groups_init(void);
+struct iso_group *iso_group_get(int id);
+int iso_group_join(struct iso_group *, struct iso_tx_context *, struct iso_rx_context *);
+void iso_group_leave_tx(struct iso_tx_context *);
+void iso_group_leave_rx(struct iso_rx_context *);
+void iso_group_tick(struct iso_group *, ktime_t now);
+
+#endif /* __GROUP_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,99 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/cpumask.h>
+#include "hist.h"
+
+/* Smallest value, in ns, that falls in the bucket after @b */
+static u64 iso_hist_bucket_end(int b) {
+	int group = b >> ISO_HIST_SUB_BITS;
+	u64 sub = b & (ISO_HIST_SUB - 1);
+
+	if(group == 0)
+		return (sub + 1) << ISO_HIST_UNIT_SHIFT;
+
+	return ((ISO_HIST_SUB + sub + 1) << (group - 1)) << ISO_HIST_UNIT_SHIFT;
+}
+
+void iso_hist_snap_init(struct iso_hist_snap *snap) {
+	spin_lock_init(&snap->lock);
+	memset(&snap->last, 0, sizeof(snap->last));
+}
+
+/* Sums every cpu's buckets into snap->sum; counts may move while we
+ * read, that's fine.  Called with snap->lock. */
+static void iso_hist_sum(struct iso_hist __percpu *h, struct iso_hist_snap *snap) {
+	struct iso_hist *c;
+	int cpu, b;
+
+	memset(&snap->sum, 0, sizeof(snap->sum));
+	for_each_possible_cpu(cpu) {
+		c = per_cpu_ptr(h, cpu);
+		for(b = 0; b < ISO_HIST_BUCKETS; b++)
+			snap->sum.count[b] += c->count[b];
+	}
+}
+
+static void iso_hist_pct_of(struct iso_hist *h, struct iso_hist_pct *pct) {
+	u64 need50, need99, need999, seen = 0, n;
+	int b;
+
+	memset(pct, 0, sizeof(*pct));
+	for(b = 0; b < ISO_HIST_BUCKETS; b++)
+		pct->samples += h->count[b];
+
+	if(pct->samples == 0)
+		return;
+
+	need50 = DIV_ROUND_UP(pct->samples * 500, 1000);
+	need99 = DIV_ROUND_UP(pct->samples * 990, 1000);
+	need999 = DIV_ROUND_UP(pct->samples * 999, 1000);
+
+	for(b = 0; b < ISO_HIST_BUCKETS && seen < need999; b++) {
+		n = h->count[b];
+		if(n == 0)
+			continue;
+
+		seen += n;
+		if(pct->p50 == 0 && seen >= need50)
+			pct->p50 = iso_hist_bucket_end(b);
+		if(pct->p99 == 0 && seen >= need99)
+			pct->p99 = iso_hist_bucket_end(b);
+		if(seen >= need999)
+			pct->p999 = iso_hist_bucket_end(b);
+	}
+}
+
+/* Percentiles of everything since the histogram was allocated.  For
+ * stats readers, not the datapath. */
+void iso_hist_percentiles(struct iso_hist __percpu *h, struct iso_hist_snap *snap,
+			  struct iso_hist_pct *pct) {
+	spin_lock(&snap->lock);
+	iso_hist_sum(h, snap);
+	iso_hist_pct_of(&snap->sum, pct);
+	spin_unlock(&snap->lock);
+}
+
+/* Percentiles of what was added since the last call; the first call
+ * covers everything.  Every caller shares one interval, so two
+ * readers polling the same histogram each see part of it. */
+void iso_hist_interval(struct iso_hist __percpu *h, struct iso_hist_snap *snap,
+		       struct iso_hist_pct *pct) {
+	u64 total;
+	int b;
+
+	spin_lock(&snap->lock);
+	iso_hist_sum(h, snap);
+	for(b = 0; b < ISO_HIST_BUCKETS; b++) {
+		total = snap->sum.count[b];
+		/* A cpu's bucket can be read mid-update; never go back */
+		snap->sum.count[b] = total > snap->last.count[b] ?
+			total - snap->last.count[b] : 0;
+		snap->last.count[b] = max(total, snap->last.count[b]);
+	}
+	iso_hist_pct_of(&snap->sum, pct);
+	spin_unlock(&snap->lock);
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
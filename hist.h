@@ -0,0 +1,75 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+
+/*
+ * Log-linear latency histogram.  Values are in units of
+ * 2^ISO_HIST_UNIT_SHIFT ns.  Each power of two is split into
+ * ISO_HIST_SUB linear buckets, so a bucket is at most 1/8 of its
+ * value wide.  Anything from 2^ISO_HIST_MAX_BITS units (about 2s) up
+ * goes in the last bucket.  Keep one per cpu and add without locks;
+ * readers sum over cpus.  Buckets are u64: at 10G a u32 wraps within
+ * hours.
+ */
+#define ISO_HIST_UNIT_SHIFT (6)
+#define ISO_HIST_SUB_BITS (3)
+#define ISO_HIST_SUB (1 << ISO_HIST_SUB_BITS)
+#define ISO_HIST_MAX_BITS (25)
+#define ISO_HIST_BUCKETS ((ISO_HIST_MAX_BITS - ISO_HIST_SUB_BITS + 1) * ISO_HIST_SUB)
+
+struct iso_hist {
+	u64 count[ISO_HIST_BUCKETS];
+};
+
+/* What a reader needs to report percentiles of one histogram: the
+ * totals at its last interval read, and room to sum the cpus into
+ * (both too big for the stack) */
+struct iso_hist_snap {
+	spinlock_t lock;
+	struct iso_hist last;
+	struct iso_hist sum;
+};
+
+static inline int iso_hist_bucket(u64 ns) {
+	u64 v = ns >> ISO_HIST_UNIT_SHIFT;
+	int msb;
+
+	if(v < ISO_HIST_SUB)
+		return v;
+
+	msb = fls64(v) - 1;
+	if(msb >= ISO_HIST_MAX_BITS)
+		return ISO_HIST_BUCKETS - 1;
+
+	return ((msb - ISO_HIST_SUB_BITS + 1) << ISO_HIST_SUB_BITS) |
+		((v >> (msb - ISO_HIST_SUB_BITS)) & (ISO_HIST_SUB - 1));
+}
+
+static inline void iso_hist_add(struct iso_hist *h, u64 ns) {
+	h->count[iso_hist_bucket(ns)]++;
+}
+
+/* Latency percentiles, in ns: upper bounds of the buckets they fall
+ * in, or 0 if the histogram is empty */
+struct iso_hist_pct {
+	u64 samples;
+	u64 p50;
+	u64 p99;
+	u64 p999;
+};
+
+void iso_hist_snap_init(struct iso_hist_snap *snap);
+void iso_hist_percentiles(struct iso_hist __percpu *h, struct iso_hist_snap *snap,
+			  struct iso_hist_pct *pct);
+void iso_hist_interval(struct iso_hist __percpu *h, struct iso_hist_snap *snap,
+		       struct iso_hist_pct *pct);
+
+#endif /* __HIST_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -4,6 +4,11 @@
 #include "rx.h"
 #include "tx.h"
 #include "stats.h"
+#include "group.h"
+#include "netlink.h"
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
 
 #ifdef QDISC
 int eyeq_qdisc_register(void);
@@ -60,6 +65,7 @@ static int iso_init() {
 
 	INIT_LIST_HEAD(&rxctx_list);
 	INIT_LIST_HEAD(&txctx_list);
+	iso_groups_init();
 
 	if(iso_params_init())
 		goto out;
@@ -67,9 +73,15 @@ static int iso_init() {
 	if(iso_stats_init())
 		goto out_1;
 
+	if(iso_dev_params_init())
+		goto out_2;
+
+	if(iso_netlink_init())
+		goto out_3;
+
 #ifdef QDISC
 	if (eyeq_qdisc_register())
-		goto out_2;
+		goto out_nl;
 #else
 	rcu_read_lock();
 	iso_netdev = dev_get_by_name(&init_net, iso_param_dev);
@@ -77,7 +89,7 @@ static int iso_init() {
 
 	if(iso_netdev == NULL) {
 		printk(KERN_INFO "perfiso: device %s not found", iso_param_dev);
-		goto out_3;
+		goto out_nl;
 	}
 
 	global_rxcontext.netdev = iso_netdev;
@@ -106,11 +118,14 @@ out_5:
 	iso_rx_exit(&global_rxcontext);
 out_4:
 	dev_put(iso_netdev);
-out_3:
 #else
 	eyeq_qdisc_unregister();
-out_2:
 #endif
+out_nl:
+	iso_netlink_exit();
+out_3:
+	iso_dev_params_exit();
+out_2:
 	iso_stats_exit();
 out_1:
 	iso_params_exit();
@@ -122,8 +137,9 @@ static void iso_exit() {
 	iso_exiting = 1;
 	mb();
 
+	iso_netlink_exit();
+	iso_dev_params_exit();
 	iso_stats_exit();
-	iso_params_exit();
 #ifdef QDISC
 	eyeq_qdisc_unregister();
 #else
@@ -135,6 +151,8 @@ static void iso_exit() {
 	netif_set_gso_max_size(iso_netdev, __prev__ISO_GSO_MAX_SIZE);
 	dev_put(iso_netdev);
 #endif
+	/* Last: the datapath reads the config until it's gone */
+	iso_params_exit();
 	printk(KERN_INFO "perfiso: goodbye.\n");
 }
 
@@ -0,0 +1,685 @@
+#include <linux/slab.h>
+#include <linux/capability.h>
+#include <net/genetlink.h>
+#include "netlink.h"
+#include "perfiso_nl.h"
+#include "params.h"
+#include "tx.h"
+#include "rx.h"
+#include "vq.h"
+#include "cost.h"
+#include "reason.h"
+
+/* One op of a batch, parsed and checked before anything is applied */
+struct iso_nl_op {
+	u32 type;
+	struct net_device *dev;
+	char *klass;
+	char *vq;
+	iso_class_t kc;
+	iso_class_t vc;
+	u32 weight;
+	/* What the op replaced, so a failed batch can put it back */
+	u32 old_weight;
+	struct iso_vq *old_vq;
+};
+
+static struct genl_family iso_nl_family = {
+	.id = GENL_ID_GENERATE,
+	.name = PERFISO_GENL_NAME,
+	.version = PERFISO_GENL_VERSION,
+	.maxattr = PERFISO_ATTR_MAX,
+};
+
+static const struct nla_policy iso_nl_policy[PERFISO_ATTR_MAX + 1] = {
+	[PERFISO_ATTR_OPS] = { .type = NLA_NESTED },
+	[PERFISO_ATTR_STATS_FLAGS] = { .type = NLA_U32 },
+};
+
+static const struct nla_policy iso_nl_op_policy[PERFISO_OP_ATTR_MAX + 1] = {
+	[PERFISO_OP_ATTR_TYPE] = { .type = NLA_U32 },
+	[PERFISO_OP_ATTR_DEV] = { .type = NLA_NUL_STRING, .len = IFNAMSIZ - 1 },
+	[PERFISO_OP_ATTR_CLASS] = { .type = NLA_NUL_STRING, .len = 127 },
+	[PERFISO_OP_ATTR_VQ] = { .type = NLA_NUL_STRING, .len = 127 },
+	[PERFISO_OP_ATTR_WEIGHT] = { .type = NLA_U32 },
+};
+
+/* Called with config_mutex held */
+static int iso_nl_parse_op(struct nlattr *nla, struct iso_nl_op *op) {
+	struct nlattr *tb[PERFISO_OP_ATTR_MAX + 1];
+	int ret;
+
+	ret = nla_parse_nested(tb, PERFISO_OP_ATTR_MAX, nla, iso_nl_op_policy);
+	if(ret)
+		return ret;
+
+	if(!tb[PERFISO_OP_ATTR_TYPE] || !tb[PERFISO_OP_ATTR_DEV] ||
+	   !tb[PERFISO_OP_ATTR_CLASS])
+		return -EINVAL;
+
+	op->type = nla_get_u32(tb[PERFISO_OP_ATTR_TYPE]);
+	op->klass = nla_data(tb[PERFISO_OP_ATTR_CLASS]);
+	op->dev = iso_search_netdev(nla_data(tb[PERFISO_OP_ATTR_DEV]));
+	if(op->dev == NULL || !iso_enabled(op->dev))
+		return -ENODEV;
+
+	switch(op->type) {
+	case PERFISO_OP_CREATE_TXC:
+	case PERFISO_OP_CREATE_VQ:
+		break;
+
+	case PERFISO_OP_ASSOC_TXC_VQ:
+		if(!tb[PERFISO_OP_ATTR_VQ])
+			return -EINVAL;
+		op->vq = nla_data(tb[PERFISO_OP_ATTR_VQ]);
+		break;
+
+	case PERFISO_OP_SET_TXC_WEIGHT:
+	case PERFISO_OP_SET_VQ_WEIGHT:
+		if(!tb[PERFISO_OP_ATTR_WEIGHT])
+			return -EINVAL;
+		op->weight = nla_get_u32(tb[PERFISO_OP_ATTR_WEIGHT]);
+		if(op->weight < 1 || op->weight > PERFISO_MAX_WEIGHT)
+			return -ERANGE;
+		break;
+
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+/* Does an op before @n create @klass of this @type on @dev? */
+static int iso_nl_created(struct iso_nl_op *ops, int n, u32 type,
+			  struct net_device *dev, iso_class_t klass) {
+	int i;
+
+	for(i = 0; i < n; i++) {
+		if(ops[i].type == type && ops[i].dev == dev &&
+		   iso_class_cmp(ops[i].kc, klass) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Called with rcu_read_lock */
+static int iso_nl_txc_exists(struct iso_nl_op *ops, int n,
+			     struct net_device *dev, iso_class_t klass) {
+	return iso_txc_find(klass, iso_txctx_dev(dev)) != NULL ||
+		iso_nl_created(ops, n, PERFISO_OP_CREATE_TXC, dev, klass);
+}
+
+/* Called with rcu_read_lock */
+static int iso_nl_vq_exists(struct iso_nl_op *ops, int n,
+			    struct net_device *dev, iso_class_t klass) {
+	return iso_vq_find(klass, iso_rxctx_dev(dev)) != NULL ||
+		iso_nl_created(ops, n, PERFISO_OP_CREATE_VQ, dev, klass);
+}
+
+/* Check op @n against the tree as it will be once ops 0..n-1 are
+ * applied.  Called with config_mutex and rcu_read_lock held. */
+static int iso_nl_check_op(struct iso_nl_op *ops, int n) {
+	struct iso_nl_op *op = &ops[n];
+
+	op->kc = iso_class_parse(op->klass);
+
+	switch(op->type) {
+	case PERFISO_OP_CREATE_TXC:
+		if(iso_nl_txc_exists(ops, n, op->dev, op->kc))
+			return -EEXIST;
+		break;
+
+	case PERFISO_OP_CREATE_VQ:
+		if(iso_nl_vq_exists(ops, n, op->dev, op->kc))
+			return -EEXIST;
+		break;
+
+	case PERFISO_OP_ASSOC_TXC_VQ:
+		op->vc = iso_class_parse(op->vq);
+		if(!iso_nl_txc_exists(ops, n, op->dev, op->kc) ||
+		   !iso_nl_vq_exists(ops, n, op->dev, op->vc))
+			return -ENOENT;
+		break;
+
+	case PERFISO_OP_SET_TXC_WEIGHT:
+		if(!iso_nl_txc_exists(ops, n, op->dev, op->kc))
+			return -ENOENT;
+		break;
+
+	case PERFISO_OP_SET_VQ_WEIGHT:
+		if(!iso_nl_vq_exists(ops, n, op->dev, op->kc))
+			return -ENOENT;
+		break;
+	}
+
+	return 0;
+}
+
+/* Called with config_mutex held */
+static int iso_nl_apply_op(struct iso_nl_op *op) {
+	struct iso_tx_context *txctx = iso_txctx_dev(op->dev);
+	struct iso_rx_context *rxctx = iso_rxctx_dev(op->dev);
+	struct iso_tx_class *txc;
+	struct iso_vq *vq;
+	int ret = 0;
+
+	/* The install functions take rcu_read_lock themselves, and
+	 * the tx one may sleep */
+	if(op->type == PERFISO_OP_CREATE_TXC)
+		return iso_txc_install(op->klass, txctx) ? -ENOMEM : 0;
+
+	if(op->type == PERFISO_OP_CREATE_VQ)
+		return iso_vq_install(op->klass, rxctx) ? -ENOMEM : 0;
+
+	rcu_read_lock();
+	switch(op->type) {
+	case PERFISO_OP_ASSOC_TXC_VQ:
+		txc = iso_txc_find(op->kc, txctx);
+		vq = iso_vq_find(op->vc, rxctx);
+		if(txc == NULL || vq == NULL) {
+			ret = -ENOENT;
+		} else {
+			op->old_vq = txc->vq;
+			iso_txc_set_vq(txc, vq);
+		}
+		break;
+
+	case PERFISO_OP_SET_TXC_WEIGHT:
+		txc = iso_txc_find(op->kc, txctx);
+		if(txc == NULL) {
+			ret = -ENOENT;
+		} else {
+			op->old_weight = txc->weight;
+			iso_txc_set_weight(txc, op->weight);
+		}
+		break;
+
+	case PERFISO_OP_SET_VQ_WEIGHT:
+		vq = iso_vq_find(op->kc, rxctx);
+		if(vq == NULL) {
+			ret = -ENOENT;
+		} else {
+			op->old_weight = vq->weight;
+			iso_vq_set_weight(vq, op->weight);
+		}
+		break;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/* Take back an op iso_nl_apply_op applied.  Undone in reverse order,
+ * so nothing a later op did still refers to what this one made.  Only
+ * frees, so it can't fail.  Called with config_mutex held. */
+static void iso_nl_undo_op(struct iso_nl_op *op) {
+	struct iso_tx_context *txctx = iso_txctx_dev(op->dev);
+	struct iso_rx_context *rxctx = iso_rxctx_dev(op->dev);
+	struct iso_tx_class *txc = NULL;
+	struct iso_vq *vq = NULL;
+
+	rcu_read_lock();
+	switch(op->type) {
+	case PERFISO_OP_CREATE_TXC:
+	case PERFISO_OP_ASSOC_TXC_VQ:
+	case PERFISO_OP_SET_TXC_WEIGHT:
+		txc = iso_txc_find(op->kc, txctx);
+		break;
+	case PERFISO_OP_CREATE_VQ:
+	case PERFISO_OP_SET_VQ_WEIGHT:
+		vq = iso_vq_find(op->kc, rxctx);
+		break;
+	}
+	rcu_read_unlock();
+
+	if(txc == NULL && vq == NULL)
+		return;
+
+	switch(op->type) {
+	case PERFISO_OP_CREATE_TXC:
+		/* New classes have no children yet */
+		iso_txc_unlink(txc);
+		iso_txc_free(txc);
+		break;
+
+	case PERFISO_OP_CREATE_VQ:
+		iso_vq_free(vq);
+		break;
+
+	case PERFISO_OP_ASSOC_TXC_VQ:
+		if(op->old_vq) {
+			iso_txc_set_vq(txc, op->old_vq);
+		} else if(txc->vq) {
+			atomic_dec(&txc->vq->refcnt);
+			txc->vq = NULL;
+		}
+		break;
+
+	case PERFISO_OP_SET_TXC_WEIGHT:
+		iso_txc_set_weight(txc, op->old_weight);
+		break;
+
+	case PERFISO_OP_SET_VQ_WEIGHT:
+		iso_vq_set_weight(vq, op->old_weight);
+		break;
+	}
+}
+
+/* Hold off rate recomputation on every device the batch touches */
+static void iso_nl_batch_begin(struct iso_nl_op *ops, int n) {
+	int i;
+
+	for(i = 0; i < n; i++) {
+		iso_txctx_dev(ops[i].dev)->config_batch = 1;
+		iso_rxctx_dev(ops[i].dev)->config_batch = 1;
+	}
+}
+
+/* ... and do it once per device now that the batch is in */
+static void iso_nl_batch_end(struct iso_nl_op *ops, int n) {
+	struct iso_tx_context *txctx;
+	struct iso_rx_context *rxctx;
+	unsigned long flags;
+	int i;
+
+	for(i = 0; i < n; i++) {
+		txctx = iso_txctx_dev(ops[i].dev);
+		rxctx = iso_rxctx_dev(ops[i].dev);
+
+		if(txctx->config_batch) {
+			txctx->config_batch = 0;
+			if(txctx->recompute_pending) {
+				txctx->recompute_pending = 0;
+				iso_txc_recompute_rates(txctx);
+			}
+		}
+
+		if(rxctx->config_batch) {
+			rxctx->config_batch = 0;
+			if(rxctx->recompute_pending) {
+				rxctx->recompute_pending = 0;
+				spin_lock_irqsave(&rxctx->vq_spinlock, flags);
+				iso_vq_calculate_rates(rxctx);
+				spin_unlock_irqrestore(&rxctx->vq_spinlock, flags);
+			}
+		}
+	}
+}
+
+static int iso_nl_batch(struct sk_buff *skb, struct genl_info *info) {
+	struct nlattr *ops_attr = info->attrs[PERFISO_ATTR_OPS];
+	struct iso_nl_op *ops;
+	struct nlattr *nla;
+	int rem, n = 0, i = 0, ret = 0;
+
+	if(ops_attr == NULL)
+		return -EINVAL;
+
+	nla_for_each_nested(nla, ops_attr, rem) {
+		if(nla_type(nla) != PERFISO_ATTR_OP)
+			return -EINVAL;
+		n++;
+	}
+
+	if(n == 0)
+		return 0;
+
+	if(n > PERFISO_BATCH_MAX_OPS)
+		return -E2BIG;
+
+	ops = kcalloc(n, sizeof(*ops), GFP_KERNEL);
+	if(ops == NULL)
+		return -ENOMEM;
+
+	if(down_interruptible(&config_mutex)) {
+		ret = -EINTR;
+		goto out_free;
+	}
+
+	nla_for_each_nested(nla, ops_attr, rem) {
+		ret = iso_nl_parse_op(nla, &ops[i]);
+		if(ret)
+			goto invalid;
+		i++;
+	}
+
+	rcu_read_lock();
+	for(i = 0; i < n; i++) {
+		ret = iso_nl_check_op(ops, i);
+		if(ret)
+			break;
+	}
+	rcu_read_unlock();
+
+	if(ret)
+		goto invalid;
+
+	iso_nl_batch_begin(ops, n);
+	for(i = 0; i < n; i++) {
+		ret = iso_nl_apply_op(&ops[i]);
+		if(ret)
+			break;
+	}
+
+	/* All or nothing: only allocation can fail here, as the batch
+	 * was checked above, so take back what went in before it */
+	if(ret) {
+		printk(KERN_INFO "perfiso: netlink batch failed at op %d (%d); "
+		       "rolling back\n", i, ret);
+		while(--i >= 0)
+			iso_nl_undo_op(&ops[i]);
+	}
+	iso_nl_batch_end(ops, n);
+	goto out_unlock;
+
+ invalid:
+	printk(KERN_INFO "perfiso: netlink batch rejected at op %d (%d); "
+	       "nothing applied\n", i, ret);
+ out_unlock:
+	up(&config_mutex);
+ out_free:
+	kfree(ops);
+	return ret;
+}
+
+/*
+ * Stats dump.  cb->args: [0] phase, [1] device (or cost path) within the phase,
+ * [2] class within the device (0 is the device's own record), [3]
+ * record within the class (0 is the class's own record), [4] the
+ * request's PERFISO_STATS_F_* flags, [5] set once [4] is parsed.
+ * A resumed dump skips by position.
+ */
+enum {
+	ISO_NL_DUMP_TX,
+	ISO_NL_DUMP_RX,
+	ISO_NL_DUMP_COST,
+	ISO_NL_DUMP_DONE,
+};
+
+/* Reserve a zeroed record, or NULL if the message is full.  @dev
+ * is NULL for records that aren't about a device. */
+static struct perfiso_stats_rec *iso_nl_rec(struct sk_buff *skb, u32 type,
+					    struct net_device *dev, u64 now_ns) {
+	struct perfiso_stats_rec *rec;
+	struct nlattr *nla;
+
+	nla = nla_reserve(skb, PERFISO_ATTR_STATS_REC, sizeof(*rec));
+	if(nla == NULL)
+		return NULL;
+
+	rec = nla_data(nla);
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	rec->ifindex = dev ? dev->ifindex : 0;
+	rec->tstamp_ns = now_ns;
+	return rec;
+}
+
+static void iso_nl_rec_class(struct perfiso_stats_rec *rec, iso_class_t klass) {
+	char buff[128];
+
+	iso_class_show(klass, buff);
+	strlcpy(rec->klass, buff, sizeof(rec->klass));
+}
+
+/* Fill in @rec's reasons if the request asked for them */
+static void iso_nl_rec_reasons(struct perfiso_stats_rec *rec, struct netlink_callback *cb,
+			       struct iso_reasons __percpu *r) {
+	struct iso_reasons sum;
+	int i;
+
+	BUILD_BUG_ON(ISO_REASON_MAX != PERFISO_REASON_MAX);
+	if(!(cb->args[4] & PERFISO_STATS_F_REASONS))
+		return;
+
+	iso_reason_read(r, &sum);
+	for(i = 0; i < ISO_REASON_MAX; i++)
+		rec->reasons[i] = sum.count[i];
+}
+
+/* Called with rcu_read_lock */
+static int iso_nl_dump_txc(struct sk_buff *skb, struct netlink_callback *cb,
+			   struct iso_tx_class *txc, u64 now_ns) {
+	struct perfiso_stats_rec *rec;
+	struct iso_hist_pct pct;
+	struct hlist_node *node;
+	struct iso_rl *rl;
+	long idx = 0;
+	int i;
+
+	if(cb->args[3] == 0) {
+		rec = iso_nl_rec(skb, PERFISO_REC_TXC, txc->txctx->netdev, now_ns);
+		if(rec == NULL)
+			return -EMSGSIZE;
+		iso_nl_rec_class(rec, txc->klass);
+		rec->weight = txc->weight;
+		rec->bytes = iso_counter_read(&txc->rl.xmit);
+		rec->rate = txc->rl.rate;
+		rec->measured_rate = txc->tx_rate;
+		rec->min_rate = txc->min_rate;
+		if(cb->args[4] & PERFISO_STATS_F_QDELAY) {
+			iso_hist_interval(txc->qdelay, txc->qdelay_snap, &pct);
+			rec->qdelay_p50_ns = pct.p50;
+			rec->qdelay_p99_ns = pct.p99;
+			rec->qdelay_p999_ns = pct.p999;
+		}
+		iso_nl_rec_reasons(rec, cb, txc->reasons);
+		cb->args[3] = 1;
+	}
+
+	if(!(cb->args[4] & PERFISO_STATS_F_DEST))
+		return 0;
+
+	for(i = 0; i < ISO_MAX_RL_BUCKETS; i++) {
+		hlist_for_each_entry_rcu(rl, node, &txc->rl_bucket[i], hash_node) {
+			if(++idx < cb->args[3])
+				continue;
+			rec = iso_nl_rec(skb, PERFISO_REC_RL, txc->txctx->netdev, now_ns);
+			if(rec == NULL)
+				return -EMSGSIZE;
+			iso_nl_rec_class(rec, txc->klass);
+			rec->dst = rl->ip;
+			rec->bytes = iso_counter_read(&rl->xmit);
+			rec->rate = rl->rate;
+			cb->args[3]++;
+		}
+	}
+
+	return 0;
+}
+
+/* Called with rcu_read_lock */
+static int iso_nl_dump_txctx(struct sk_buff *skb, struct netlink_callback *cb,
+			     struct iso_tx_context *txctx, u64 now_ns) {
+	struct iso_tx_class *txc, *txc_next;
+	struct perfiso_stats_rec *rec;
+	long idx = 0;
+
+	if(cb->args[2] == 0) {
+		rec = iso_nl_rec(skb, PERFISO_REC_TXDEV, txctx->netdev, now_ns);
+		if(rec == NULL)
+			return -EMSGSIZE;
+		rec->bytes = iso_counter_read(&txctx->tx_counter);
+		rec->rate = txctx->rate;
+		rec->measured_rate = txctx->tx_rate;
+		iso_nl_rec_reasons(rec, cb, txctx->reasons);
+		cb->args[2] = 1;
+	}
+
+	for_each_txc(txc, txctx) {
+		if(++idx < cb->args[2])
+			continue;
+		if(iso_nl_dump_txc(skb, cb, txc, now_ns))
+			return -EMSGSIZE;
+		cb->args[2]++;
+		cb->args[3] = 0;
+	}
+
+	return 0;
+}
+
+/* Called with rcu_read_lock */
+static int iso_nl_dump_rxctx(struct sk_buff *skb, struct netlink_callback *cb,
+			     struct iso_rx_context *rxctx, u64 now_ns) {
+	struct iso_vq *vq, *vq_next;
+	struct perfiso_stats_rec *rec;
+	long idx = 0;
+
+	if(cb->args[2] == 0) {
+		rec = iso_nl_rec(skb, PERFISO_REC_RXDEV, rxctx->netdev, now_ns);
+		if(rec == NULL)
+			return -EMSGSIZE;
+		rec->bytes = iso_counter_read(&rxctx->rx_bytes);
+		rec->packets = iso_counter_read(&rxctx->rx_packets);
+		rec->rate = rxctx->rcp_rate;
+		rec->measured_rate = rxctx->rx_rate;
+		iso_nl_rec_reasons(rec, cb, rxctx->reasons);
+		cb->args[2] = 1;
+	}
+
+	for_each_vq(vq, rxctx) {
+		if(++idx < cb->args[2])
+			continue;
+		rec = iso_nl_rec(skb, PERFISO_REC_VQ, rxctx->netdev, now_ns);
+		if(rec == NULL)
+			return -EMSGSIZE;
+		iso_nl_rec_class(rec, vq->klass);
+		rec->weight = vq->weight;
+		rec->delay_us = vq->delay_us;
+		rec->alpha = vq->alpha;
+		rec->bytes = iso_counter_read(&vq->rx_bytes);
+		rec->packets = iso_counter_read(&vq->rx_packets);
+		rec->marked = iso_counter_read(&vq->rx_marked);
+		rec->queued = vq->total_bytes_queued;
+		rec->rate = vq->rate;
+		rec->measured_rate = vq->rx_rate;
+		rec->feedback_rate = vq->feedback_rate;
+		cb->args[2]++;
+	}
+
+	return 0;
+}
+
+static int iso_nl_dump_cost(struct sk_buff *skb, enum iso_cost_path path, u64 now_ns) {
+	struct perfiso_stats_rec *rec;
+	struct iso_cost cost;
+
+	rec = iso_nl_rec(skb, PERFISO_REC_COST, NULL, now_ns);
+	if(rec == NULL)
+		return -EMSGSIZE;
+
+	iso_cost_read(path, &cost);
+	strlcpy(rec->klass, iso_cost_names[path], sizeof(rec->klass));
+	rec->calls = cost.calls;
+	rec->packets = cost.packets;
+	rec->bytes = cost.bytes;
+	rec->cycles = cost.cycles;
+	return 0;
+}
+
+static int iso_nl_stats_dump(struct sk_buff *skb, struct netlink_callback *cb) {
+	struct iso_tx_context *txctx, *txctx_next;
+	struct iso_rx_context *rxctx, *rxctx_next;
+	struct nlattr *tb[PERFISO_ATTR_MAX + 1];
+	u64 now_ns = ktime_to_ns(ktime_get());
+	long dev = 0;
+	void *hdr;
+
+	if(cb->args[0] == ISO_NL_DUMP_DONE)
+		return 0;
+
+	if(!cb->args[5]) {
+		if(nlmsg_parse(cb->nlh, GENL_HDRLEN, tb, PERFISO_ATTR_MAX, iso_nl_policy) == 0 &&
+		   tb[PERFISO_ATTR_STATS_FLAGS])
+			cb->args[4] = nla_get_u32(tb[PERFISO_ATTR_STATS_FLAGS]);
+		cb->args[5] = 1;
+
+		/* Reading qdelay starts everyone's next interval (see
+		 * iso_hist_interval), so it's for the admin's monitor
+		 * only.  The first call runs in the requester's context. */
+		if((cb->args[4] & PERFISO_STATS_F_QDELAY) && !capable(CAP_NET_ADMIN)) {
+			cb->args[0] = ISO_NL_DUMP_DONE;
+			return -EPERM;
+		}
+	}
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			  &iso_nl_family, NLM_F_MULTI, PERFISO_CMD_GET_STATS);
+	if(hdr == NULL)
+		return -EMSGSIZE;
+
+	rcu_read_lock();
+	if(cb->args[0] == ISO_NL_DUMP_TX) {
+		for_each_tx_context(txctx) {
+			if(dev++ < cb->args[1])
+				continue;
+			if(iso_nl_dump_txctx(skb, cb, txctx, now_ns))
+				goto full;
+			cb->args[1]++;
+			cb->args[2] = cb->args[3] = 0;
+		}
+		cb->args[0] = ISO_NL_DUMP_RX;
+		cb->args[1] = 0;
+		dev = 0;
+	}
+
+	if(cb->args[0] == ISO_NL_DUMP_RX) {
+		for_each_rx_context(rxctx) {
+			if(dev++ < cb->args[1])
+				continue;
+			if(iso_nl_dump_rxctx(skb, cb, rxctx, now_ns))
+				goto full;
+			cb->args[1]++;
+			cb->args[2] = 0;
+		}
+		cb->args[0] = ISO_NL_DUMP_COST;
+		cb->args[1] = 0;
+	}
+
+	if(cb->args[4] & PERFISO_STATS_F_COST) {
+		for(; cb->args[1] < ISO_COST_MAX; cb->args[1]++) {
+			if(iso_nl_dump_cost(skb, cb->args[1], now_ns))
+				goto full;
+		}
+	}
+	cb->args[0] = ISO_NL_DUMP_DONE;
+
+ full:
+	rcu_read_unlock();
+	genlmsg_end(skb, hdr);
+	return skb->len;
+}
+
+static struct genl_ops iso_nl_ops[] = {
+	{
+		.cmd = PERFISO_CMD_BATCH,
+		.flags = GENL_ADMIN_PERM,
+		.policy = iso_nl_policy,
+		.doit = iso_nl_batch,
+	},
+	{
+		.cmd = PERFISO_CMD_GET_STATS,
+		.policy = iso_nl_policy,
+		.dumpit = iso_nl_stats_dump,
+	},
+};
+
+int iso_netlink_init() {
+	int ret;
+
+	ret = genl_register_family_with_ops(&iso_nl_family, iso_nl_ops,
+					    ARRAY_SIZE(iso_nl_ops));
+	if(ret)
+		printk(KERN_INFO "perfiso: could not register netlink family (%d)\n", ret);
+	return ret;
+}
+
+void iso_netlink_exit() {
+	genl_unregister_family(&iso_nl_family);
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -0,0 +1,15 @@
+#ifndef __NETLINK_H__
+#define __NETLINK_H__
+
+/*
+ * Generic netlink control and stats interface; see perfiso_nl.h for the
+ * messages.  The sysfs files in params.c stay for one-off changes.
+ */
+int iso_netlink_init(void);
+void iso_netlink_exit(void);
+
+#endif /* __NETLINK_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -3,6 +3,8 @@
 #include <linux/moduleparam.h>
 #include <linux/stat.h>
 #include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
 #include <linux/netdevice.h>
 #include <linux/if.h>
 
@@ -10,6 +12,7 @@
 #include "tx.h"
 #include "rx.h"
 #include "vq.h"
+#include "delay.h"
 
 // params
 int ISO_FALPHA = 8;
@@ -35,12 +38,20 @@ int ISO_RFAIR_FEEDBACK_TIMEOUT_DEFAULT_RATE = 10;
 int IsoGlobalEnabled = 1;
 int IsoAutoGenerateFeedback = 1;
 int ISO_FEEDBACK_INTERVAL_US = 100;
+/* Unused: feedback is now sent at most once per interval per sender */
 int ISO_FEEDBACK_INTERVAL_BYTES = 10000;
+/* Feedback packets sent per tx queue lock; 1 disables batching */
+int ISO_FEEDBACK_BATCH = 1;
+/* Carry feedback in an IP option on packets to the sender when we can */
+int ISO_FEEDBACK_PIGGYBACK = 0;
+/* Timestamp packets for the receiver's delay signal: 0 off, 1 all
+ * but GSO packets */
+int ISO_DELAY_SIGNAL = 0;
 
 // TODO: We are assuming that we don't need to do any VLAN tag
 // ourselves
-const int ISO_FEEDBACK_PACKET_SIZE = 64;
-const u16 ISO_FEEDBACK_HEADER_SIZE = 20;
+const u16 ISO_FEEDBACK_HEADER_SIZE = sizeof(struct iphdr) + sizeof(struct iso_feedback_msg);
+const int ISO_FEEDBACK_PACKET_SIZE = ETH_HLEN + sizeof(struct iphdr) + sizeof(struct iso_feedback_msg);
 const u8 ISO_FEEDBACK_PACKET_TTL = 64;
 int ISO_FEEDBACK_PACKET_IPPROTO = 143; // should be some unused protocol
 
@@ -49,6 +60,8 @@ int ISO_RL_UPDATE_INTERVAL_US = 20;
 int ISO_BURST_FACTOR = 8;
 int ISO_VQ_UPDATE_INTERVAL_US = 200;
 int ISO_TXC_UPDATE_INTERVAL_US = 200;
+/* How often a cpu publishes its share of a shared counter */
+int ISO_COUNTER_PUBLISH_US = 50;
 int ISO_VQ_REFRESH_INTERVAL_US = 500;
 int ISO_MAX_QUEUE_LEN_BYTES = 128 * 1024;
 int ISO_TX_MARK_THRESH = 100 * 1024;
@@ -56,45 +69,165 @@ int ISO_GSO_THRESH_RATE = 1000;
 int ISO_GSO_MIN_SPLIT_BYTES = 10000;
 int ISO_ECN_MARK_THRESH_BYTES = 30 * 1500;
 int ISO_VQ_HRCP_US = 1000;
+int ISO_GROUP_UPDATE_INTERVAL_US = 1000;
+/* See enum iso_rc_mode */
+int ISO_RC_MODE = ISO_RC_MODE_RECEIVER;
+/* Target queueing delay for the delay and pi VQ algorithms */
+int ISO_VQ_CC_DELAY_TARGET_US = 50;
+/* PI gains, in 1/65536ths of a Mb/s per byte */
+int ISO_VQ_CC_PI_A = 20;
+int ISO_VQ_CC_PI_B = 18;
+/* Count cycles spent in each datapath path; see cost.h */
+int ISO_CPU_ACCOUNTING = 0;
+
+#define ISO_CONFIG(field) offsetof(struct iso_config, field)
 
 struct iso_param iso_params[64] = {
-  {"ISO_MAX_TX_RATE", &ISO_MAX_TX_RATE },
-  {"ISO_VQ_DRAIN_RATE_MBPS", &ISO_VQ_DRAIN_RATE_MBPS },
-  {"ISO_MAX_BURST_TIME_US", &ISO_MAX_BURST_TIME_US },
-  {"ISO_MIN_BURST_BYTES", &ISO_MIN_BURST_BYTES },
-  {"ISO_RATEMEASURE_INTERVAL_US", &ISO_RATEMEASURE_INTERVAL_US },
-  {"ISO_TOKENBUCKET_TIMEOUT_NS", &ISO_TOKENBUCKET_TIMEOUT_NS },
-  {"ISO_TOKENBUCKET_MARK_THRESH_BYTES", &ISO_TOKENBUCKET_MARK_THRESH_BYTES },
-  {"ISO_TOKENBUCKET_DROP_THRESH_BYTES", &ISO_TOKENBUCKET_DROP_THRESH_BYTES },
-  {"ISO_VQ_MARK_THRESH_BYTES", &ISO_VQ_MARK_THRESH_BYTES },
-  {"ISO_VQ_MAX_BYTES", &ISO_VQ_MAX_BYTES },
-  {"ISO_RFAIR_INITIAL", &ISO_RFAIR_INITIAL },
-  {"ISO_MIN_RFAIR", &ISO_MIN_RFAIR },
-  {"ISO_RFAIR_FEEDBACK_TIMEOUT", &ISO_RFAIR_FEEDBACK_TIMEOUT_US },
-  {"ISO_RFAIR_FEEDBACK_TIMEOUT_DEFAULT_RATE", &ISO_RFAIR_FEEDBACK_TIMEOUT_DEFAULT_RATE },
-  {"IsoGlobalEnabled", &IsoGlobalEnabled },
-  {"IsoAutoGenerateFeedback", &IsoAutoGenerateFeedback },
-  {"ISO_FEEDBACK_PACKET_IPPROTO", &ISO_FEEDBACK_PACKET_IPPROTO },
-  {"ISO_FEEDBACK_INTERVAL_US", &ISO_FEEDBACK_INTERVAL_US },
-  {"ISO_FEEDBACK_INTERVAL_BYTES", &ISO_FEEDBACK_INTERVAL_BYTES },
-  {"ISO_RL_UPDATE_INTERVAL_US", &ISO_RL_UPDATE_INTERVAL_US },
-  {"ISO_VQ_UPDATE_INTERVAL_US", &ISO_VQ_UPDATE_INTERVAL_US },
-  {"ISO_TXC_UPDATE_INTERVAL_US", &ISO_TXC_UPDATE_INTERVAL_US },
-  {"ISO_VQ_REFRESH_INTERVAL_US", &ISO_VQ_REFRESH_INTERVAL_US },
-  {"ISO_MAX_QUEUE_LEN_BYTES", &ISO_MAX_QUEUE_LEN_BYTES },
-  {"ISO_TX_MARK_THRESH", &ISO_TX_MARK_THRESH },
-  {"ISO_ECN_MARK_THRESH_BYTES", &ISO_ECN_MARK_THRESH_BYTES },
-  {"ISO_VQ_HRCP_US", &ISO_VQ_HRCP_US },
+  {"ISO_MAX_TX_RATE", &ISO_MAX_TX_RATE, ISO_CONFIG(max_tx_rate), 1, INT_MAX },
+  {"ISO_VQ_DRAIN_RATE_MBPS", &ISO_VQ_DRAIN_RATE_MBPS, ISO_CONFIG(vq_drain_rate_mbps), 1, INT_MAX },
+  {"ISO_MAX_BURST_TIME_US", &ISO_MAX_BURST_TIME_US, ISO_CONFIG(max_burst_time_us), 1, INT_MAX },
+  {"ISO_MIN_BURST_BYTES", &ISO_MIN_BURST_BYTES, ISO_CONFIG(min_burst_bytes), 1, INT_MAX },
+  {"ISO_RATEMEASURE_INTERVAL_US", &ISO_RATEMEASURE_INTERVAL_US, ISO_CONFIG(ratemeasure_interval_us), 0, INT_MAX },
+  {"ISO_TOKENBUCKET_TIMEOUT_NS", &ISO_TOKENBUCKET_TIMEOUT_NS, ISO_CONFIG(tokenbucket_timeout_ns), 1, INT_MAX },
+  {"ISO_TOKENBUCKET_MARK_THRESH_BYTES", &ISO_TOKENBUCKET_MARK_THRESH_BYTES, ISO_CONFIG(tokenbucket_mark_thresh_bytes), 0, INT_MAX },
+  {"ISO_TOKENBUCKET_DROP_THRESH_BYTES", &ISO_TOKENBUCKET_DROP_THRESH_BYTES, ISO_CONFIG(tokenbucket_drop_thresh_bytes), 0, INT_MAX },
+  {"ISO_VQ_MARK_THRESH_BYTES", &ISO_VQ_MARK_THRESH_BYTES, ISO_CONFIG(vq_mark_thresh_bytes), 0, INT_MAX },
+  {"ISO_VQ_MAX_BYTES", &ISO_VQ_MAX_BYTES, ISO_CONFIG(vq_max_bytes), 1, INT_MAX },
+  {"ISO_RFAIR_INITIAL", &ISO_RFAIR_INITIAL, ISO_CONFIG(rfair_initial), 1, INT_MAX },
+  {"ISO_MIN_RFAIR", &ISO_MIN_RFAIR, ISO_CONFIG(min_rfair), 1, INT_MAX },
+  {"ISO_RFAIR_FEEDBACK_TIMEOUT", &ISO_RFAIR_FEEDBACK_TIMEOUT_US, ISO_CONFIG(rfair_feedback_timeout_us), 0, INT_MAX },
+  {"ISO_RFAIR_FEEDBACK_TIMEOUT_DEFAULT_RATE", &ISO_RFAIR_FEEDBACK_TIMEOUT_DEFAULT_RATE, ISO_CONFIG(rfair_feedback_timeout_default_rate), 0, INT_MAX },
+  {"IsoGlobalEnabled", &IsoGlobalEnabled, ISO_CONFIG(global_enabled), 0, 1 },
+  {"IsoAutoGenerateFeedback", &IsoAutoGenerateFeedback, ISO_CONFIG(auto_generate_feedback), 0, 1 },
+  {"ISO_FEEDBACK_PACKET_IPPROTO", &ISO_FEEDBACK_PACKET_IPPROTO, ISO_CONFIG(feedback_packet_ipproto), 0, 255 },
+  {"ISO_FEEDBACK_INTERVAL_US", &ISO_FEEDBACK_INTERVAL_US, ISO_CONFIG(feedback_interval_us), 0, INT_MAX },
+  {"ISO_FEEDBACK_INTERVAL_BYTES", &ISO_FEEDBACK_INTERVAL_BYTES, ISO_CONFIG(feedback_interval_bytes), 0, INT_MAX },
+  {"ISO_FEEDBACK_BATCH", &ISO_FEEDBACK_BATCH, ISO_CONFIG(feedback_batch), 1, INT_MAX },
+  {"ISO_FEEDBACK_PIGGYBACK", &ISO_FEEDBACK_PIGGYBACK, ISO_CONFIG(feedback_piggyback), 0, 1 },
+  {"ISO_DELAY_SIGNAL", &ISO_DELAY_SIGNAL, ISO_CONFIG(delay_signal), ISO_DELAY_SIGNAL_OFF, ISO_DELAY_SIGNAL_NOGSO },
+  {"ISO_RL_UPDATE_INTERVAL_US", &ISO_RL_UPDATE_INTERVAL_US, ISO_CONFIG(rl_update_interval_us), 0, INT_MAX },
+  {"ISO_VQ_UPDATE_INTERVAL_US", &ISO_VQ_UPDATE_INTERVAL_US, ISO_CONFIG(vq_update_interval_us), 1, INT_MAX },
+  {"ISO_TXC_UPDATE_INTERVAL_US", &ISO_TXC_UPDATE_INTERVAL_US, ISO_CONFIG(txc_update_interval_us), 0, INT_MAX },
+  {"ISO_COUNTER_PUBLISH_US", &ISO_COUNTER_PUBLISH_US, ISO_CONFIG(counter_publish_us), 0, INT_MAX },
+  {"ISO_VQ_REFRESH_INTERVAL_US", &ISO_VQ_REFRESH_INTERVAL_US, ISO_CONFIG(vq_refresh_interval_us), 0, INT_MAX },
+  {"ISO_MAX_QUEUE_LEN_BYTES", &ISO_MAX_QUEUE_LEN_BYTES, ISO_CONFIG(max_queue_len_bytes), 1, INT_MAX },
+  {"ISO_TX_MARK_THRESH", &ISO_TX_MARK_THRESH, ISO_CONFIG(tx_mark_thresh), 0, INT_MAX },
+  {"ISO_ECN_MARK_THRESH_BYTES", &ISO_ECN_MARK_THRESH_BYTES, ISO_CONFIG(ecn_mark_thresh_bytes), 0, INT_MAX },
+  {"ISO_VQ_HRCP_US", &ISO_VQ_HRCP_US, ISO_CONFIG(vq_hrcp_us), 0, INT_MAX },
+  {"ISO_GROUP_UPDATE_INTERVAL_US", &ISO_GROUP_UPDATE_INTERVAL_US, ISO_CONFIG(group_update_interval_us), 0, INT_MAX },
+  {"ISO_RC_MODE", &ISO_RC_MODE, ISO_CONFIG(rc_mode), ISO_RC_MODE_RECEIVER, ISO_RC_MODE_AIMD },
+  {"ISO_VQ_CC_DELAY_TARGET_US", &ISO_VQ_CC_DELAY_TARGET_US, ISO_CONFIG(vq_cc_delay_target_us), 0, INT_MAX },
+  {"ISO_VQ_CC_PI_A", &ISO_VQ_CC_PI_A, ISO_CONFIG(vq_cc_pi_a), INT_MIN, INT_MAX },
+  {"ISO_VQ_CC_PI_B", &ISO_VQ_CC_PI_B, ISO_CONFIG(vq_cc_pi_b), INT_MIN, INT_MAX },
+  {"ISO_CPU_ACCOUNTING", &ISO_CPU_ACCOUNTING, ISO_CONFIG(cpu_accounting), 0, 1 },
+  {"ISO_FALPHA", &ISO_FALPHA, ISO_CONFIG(falpha), 1, INT_MAX / 2048 },
+  {"ISO_BURST_FACTOR", &ISO_BURST_FACTOR, ISO_CONFIG(burst_factor), 1, INT_MAX },
   {"", NULL},
 };
 
-struct ctl_table iso_params_table[32];
+struct ctl_table iso_params_table[64];
 struct ctl_path iso_params_path[] = {
 	{ .procname = "perfiso" },
 	{ },
 };
 struct ctl_table_header *iso_sysctl;
 
+struct iso_config __rcu *iso_live_config;
+static DEFINE_MUTEX(iso_config_mutex);
+
+#define ISO_CONFIG_INT(c, i) (*(int *)((char *)(c) + iso_params[i].offset))
+
+/* Checks that need more than one parameter */
+static int iso_config_validate(struct iso_config *c) {
+	if(c->min_rfair > c->rfair_initial) {
+		printk(KERN_INFO "perfiso: ISO_MIN_RFAIR %d is above ISO_RFAIR_INITIAL %d\n",
+		       c->min_rfair, c->rfair_initial);
+		return -EINVAL;
+	}
+
+	if(c->vq_mark_thresh_bytes > c->vq_max_bytes) {
+		printk(KERN_INFO "perfiso: ISO_VQ_MARK_THRESH_BYTES %d is above ISO_VQ_MAX_BYTES %d\n",
+		       c->vq_mark_thresh_bytes, c->vq_max_bytes);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Put the sysctl values back to what the datapath runs with */
+static void iso_config_revert(struct iso_config *live) {
+	int i;
+
+	for(i = 0; i < 63 && iso_params[i].ptr != NULL; i++)
+		*iso_params[i].ptr = ISO_CONFIG_INT(live, i);
+}
+
+/*
+ * Validate the sysctl values as a whole and publish them as the new
+ * config.  If any is out of range, nothing changes and the sysctls go
+ * back to the live values.  Called with iso_config_mutex, in process
+ * context.
+ */
+static int __iso_config_commit(void) {
+	struct iso_config *c, *old;
+	int i, v;
+
+	old = rcu_dereference_protected(iso_live_config, lockdep_is_held(&iso_config_mutex));
+
+	c = kmalloc(sizeof(*c), GFP_KERNEL);
+	if(c == NULL)
+		return -ENOMEM;
+
+	for(i = 0; i < 63 && iso_params[i].ptr != NULL; i++) {
+		v = *iso_params[i].ptr;
+		if(v < iso_params[i].min || v > iso_params[i].max) {
+			printk(KERN_INFO "perfiso: %s must lie in [%d, %d]\n",
+			       iso_params[i].name, iso_params[i].min, iso_params[i].max);
+			goto invalid;
+		}
+		ISO_CONFIG_INT(c, i) = v;
+	}
+
+	if(iso_config_validate(c))
+		goto invalid;
+
+	rcu_assign_pointer(iso_live_config, c);
+	if(old) {
+		/* Some readers only have preemption off */
+		synchronize_rcu();
+		synchronize_sched();
+		kfree(old);
+	}
+	return 0;
+
+ invalid:
+	kfree(c);
+	if(old)
+		iso_config_revert(old);
+	return -EINVAL;
+}
+
+int iso_config_commit() {
+	int ret;
+
+	mutex_lock(&iso_config_mutex);
+	ret = __iso_config_commit();
+	mutex_unlock(&iso_config_mutex);
+	return ret;
+}
+
+static int iso_params_sysctl(struct ctl_table *table, int write,
+			     void __user *buffer, size_t *lenp, loff_t *ppos) {
+	int ret;
+
+	mutex_lock(&iso_config_mutex);
+	ret = proc_dointvec(table, write, buffer, lenp, ppos);
+	if(ret == 0 && write)
+		ret = __iso_config_commit();
+	mutex_unlock(&iso_config_mutex);
+	return ret;
+}
+
 #ifdef QDISC
 struct net_device *iso_search_netdev(char *name) {
 	struct net *net;
@@ -118,7 +251,11 @@ int iso_params_init() {
 
 	memset(iso_params_table, 0, sizeof(iso_params_table));
 
-	for(i = 0; i < 32; i++) {
+	RCU_INIT_POINTER(iso_live_config, NULL);
+	if(iso_config_commit())
+		goto err;
+
+	for(i = 0; i < 63; i++) {
 		struct ctl_table *entry = &iso_params_table[i];
 		if(iso_params[i].ptr == NULL)
 			break;
@@ -127,21 +264,26 @@ int iso_params_init() {
 		entry->data = iso_params[i].ptr;
 		entry->maxlen = sizeof(int);
 		entry->mode = 0644;
-		entry->proc_handler = proc_dointvec;
+		entry->proc_handler = iso_params_sysctl;
 	}
 
 	iso_sysctl = register_sysctl_paths(iso_params_path, iso_params_table);
 	if(iso_sysctl == NULL)
-		goto err;
+		goto err_free;
 
 	return 0;
 
+ err_free:
+	kfree(rcu_dereference_protected(iso_live_config, 1));
  err:
 	return -1;
 }
 
+/* The datapath is gone by the time we get here */
 void iso_params_exit() {
 	unregister_sysctl_table(iso_sysctl);
+	kfree(rcu_dereference_protected(iso_live_config, 1));
+	RCU_INIT_POINTER(iso_live_config, NULL);
 }
 
 /*
@@ -152,7 +294,7 @@ void iso_params_exit() {
  * If compiled with CLASS_ETHER_SRC
  * echo -n dev eth0 00:00:00:00:01:01 > /sys/module/perfiso/parameters/create_txc
  */
-static DEFINE_SEMAPHORE(config_mutex);
+DEFINE_SEMAPHORE(config_mutex);
 static int iso_sys_create_txc(const char *val, struct kernel_param *kp) {
 	char buff[128];
 	char klass[128];
@@ -286,13 +428,7 @@ static int iso_sys_assoc_txc_vq(const char *val, struct kernel_param *kp) {
 		goto out;
 	}
 
-	/* XXX: locks?  synchronisation? */
-	if(txc->vq) {
-		atomic_dec(&txc->vq->refcnt);
-	}
-
-	txc->vq = vq;
-	atomic_inc(&vq->refcnt);
+	iso_txc_set_vq(txc, vq);
 
 	printk(KERN_INFO "perfiso: Associated txc %s with vq %s on %s\n",
 	       _txc, _vqc, _devname);
@@ -314,7 +450,6 @@ static int iso_sys_set_txc_weight(const char *val, struct kernel_param *kp) {
 	char _txc[128], _devname[128];
 	iso_class_t klass;
 	struct iso_tx_class *txc;
-	unsigned long flags;
 	int n, ret = 0, weight;
 	struct net_device *dev = NULL;
 	struct iso_tx_context *txctx;
@@ -350,13 +485,7 @@ static int iso_sys_set_txc_weight(const char *val, struct kernel_param *kp) {
 		goto out;
 	}
 
-	spin_lock_irqsave(&txc->writelock, flags);
-	txctx->txc_total_weight -= txc->weight;
-	txc->weight = (u32)weight;
-	txctx->txc_total_weight += txc->weight;
-	spin_unlock_irqrestore(&txc->writelock, flags);
-
-	iso_txc_recompute_rates(txctx);
+	iso_txc_set_weight(txc, weight);
 
 	printk(KERN_INFO "perfiso: Set weight %d for txc %s on dev %s\n",
 	       weight, _txc, _devname);
@@ -383,6 +512,7 @@ static int iso_sys_set_txc_rate(const char *val, struct kernel_param *kp) {
 	int n, ret = 0, rate;
 	struct net_device *dev = NULL;
 	struct iso_tx_context *txctx;
+	u64 max_rate;
 
 	if(down_interruptible(&config_mutex))
 		return -EINVAL;
@@ -409,9 +539,10 @@ static int iso_sys_set_txc_rate(const char *val, struct kernel_param *kp) {
 		goto out;
 	}
 
-	if(rate < 0 || rate > 1024) {
-		printk(KERN_INFO "perfiso: Invalid rate.  Rate must lie in [1, %d]\n",
-		       ISO_MAX_TX_RATE);
+	max_rate = iso_txctx_params(txctx)->max_tx_rate;
+	if(rate < 0 || rate > max_rate) {
+		printk(KERN_INFO "perfiso: Invalid rate.  Rate must lie in [1, %llu]\n",
+		       max_rate);
 		ret = -EINVAL;
 		goto out;
 	}
@@ -419,7 +550,7 @@ static int iso_sys_set_txc_rate(const char *val, struct kernel_param *kp) {
 	spin_lock_irqsave(&txc->writelock, flags);
 	if (rate == 0) {
 		txc->is_static = 0;
-		txc->max_rate = ISO_MAX_TX_RATE;
+		txc->max_rate = max_rate;
 	} else {
 		txc->is_static = 1;
 		txc->max_rate = rate;
@@ -439,6 +570,122 @@ static int iso_sys_set_txc_rate(const char *val, struct kernel_param *kp) {
 
 module_param_call(set_txc_rate, iso_sys_set_txc_rate, iso_sys_noget, NULL, S_IWUSR);
 
+/*
+ * Nest a TXC under another TXC, or move it back to the top level.
+ * The child's weight is then relative to its siblings, and its
+ * guarantee is a share of the parent's.
+ * echo -n dev eth0 11.0.1.1 parent 11.0.0.1
+ * echo -n dev eth0 11.0.1.1 parent none
+ * > /sys/module/perfiso/parameters/set_txc_parent
+ */
+static int iso_sys_set_txc_parent(const char *val, struct kernel_param *kp) {
+	char _txc[128], _parent[128], _devname[128];
+	struct iso_tx_class *txc, *parent = NULL;
+	int n, ret = 0;
+	struct net_device *dev = NULL;
+	struct iso_tx_context *txctx;
+
+	if(down_interruptible(&config_mutex))
+		return -EINVAL;
+
+	rcu_read_lock();
+	n = sscanf(val, "dev %s %s parent %s", _devname, _txc, _parent);
+	if(n != 3) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dev = iso_search_netdev(_devname);
+	if ((dev == NULL) || !iso_enabled(dev)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	txctx = iso_txctx_dev(dev);
+	txc = iso_txc_find(iso_class_parse(_txc), txctx);
+	if(txc == NULL) {
+		printk(KERN_INFO "perfiso: Could not find txc %s\n", _txc);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if(strcmp(_parent, "none") != 0) {
+		parent = iso_txc_find(iso_class_parse(_parent), txctx);
+		if(parent == NULL) {
+			printk(KERN_INFO "perfiso: Could not find txc %s\n", _parent);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	ret = iso_txc_set_parent(txc, parent);
+	if(ret) {
+		printk(KERN_INFO "perfiso: Cannot make %s the parent of txc %s "
+		       "(cycle, too deep, or txc has children)\n", _parent, _txc);
+		goto out;
+	}
+
+	printk(KERN_INFO "perfiso: Set parent %s for txc %s on dev %s\n",
+	       _parent, _txc, _devname);
+ out:
+
+	rcu_read_unlock();
+	up(&config_mutex);
+	return ret;
+}
+
+module_param_call(set_txc_parent, iso_sys_set_txc_parent, iso_sys_noget, NULL, S_IWUSR);
+
+/*
+ * Mark a TXC as low latency: while it is within its guarantee, its
+ * packets are sent inline instead of waiting in the rate limiters.
+ * echo -n dev eth0 11.0.1.1 lowlat 1
+ * > /sys/module/perfiso/parameters/set_txc_lowlat
+ */
+static int iso_sys_set_txc_lowlat(const char *val, struct kernel_param *kp) {
+	char _txc[128], _devname[128];
+	struct iso_tx_class *txc;
+	int n, ret = 0, lowlat;
+	struct net_device *dev = NULL;
+	struct iso_tx_context *txctx;
+
+	if(down_interruptible(&config_mutex))
+		return -EINVAL;
+
+	rcu_read_lock();
+	n = sscanf(val, "dev %s %s lowlat %d", _devname, _txc, &lowlat);
+	if(n != 3) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dev = iso_search_netdev(_devname);
+	if ((dev == NULL) || !iso_enabled(dev)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	txctx = iso_txctx_dev(dev);
+	txc = iso_txc_find(iso_class_parse(_txc), txctx);
+	if(txc == NULL) {
+		printk(KERN_INFO "perfiso: Could not find txc %s\n", _txc);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	iso_txc_set_lowlat(txc, lowlat);
+
+	printk(KERN_INFO "perfiso: Set lowlat %d for txc %s on dev %s\n",
+	       lowlat, _txc, _devname);
+ out:
+
+	rcu_read_unlock();
+	up(&config_mutex);
+	return ret;
+}
+
+module_param_call(set_txc_lowlat, iso_sys_set_txc_lowlat, iso_sys_noget, NULL, S_IWUSR);
+
 
 
 /*
@@ -451,7 +698,6 @@ static int iso_sys_set_vq_weight(const char *val, struct kernel_param *kp) {
 	char _vqc[128], _devname[128];
 	iso_class_t vqclass;
 	struct iso_vq *vq;
-	unsigned long flags;
 	int n, ret = 0, weight;
 	struct iso_rx_context *rxctx;
 	struct net_device *dev = NULL;
@@ -487,10 +733,7 @@ static int iso_sys_set_vq_weight(const char *val, struct kernel_param *kp) {
 		goto out;
 	}
 
-	spin_lock_irqsave(&rxctx->vq_spinlock, flags);
-	vq->weight = (u64)weight;
-	iso_vq_calculate_rates(rxctx);
-	spin_unlock_irqrestore(&rxctx->vq_spinlock, flags);
+	iso_vq_set_weight(vq, weight);
 
 	printk(KERN_INFO "perfiso: Set weight %d for vq %s on dev %s\n",
 	       weight, _vqc, _devname);
@@ -544,9 +787,9 @@ static int iso_sys_set_vq_rate(const char *val, struct kernel_param *kp) {
 		goto out;
 	}
 
-	if(rate < 0 || rate > ISO_VQ_DRAIN_RATE_MBPS) {
-		printk(KERN_INFO "perfiso: Invalid rate.  Rate must lie in [0, %d]\n",
-		       ISO_VQ_DRAIN_RATE_MBPS);
+	if(rate < 0 || rate > iso_rxctx_params(rxctx)->drain_rate) {
+		printk(KERN_INFO "perfiso: Invalid rate.  Rate must lie in [0, %llu]\n",
+		       iso_rxctx_params(rxctx)->drain_rate);
 		ret = -EINVAL;
 		goto out;
 	}
@@ -572,6 +815,124 @@ static int iso_sys_set_vq_rate(const char *val, struct kernel_param *kp) {
 
 module_param_call(set_vq_rate, iso_sys_set_vq_rate, iso_sys_noget, NULL, S_IWUSR);
 
+/*
+ * Set the congestion control algorithm a VQ uses to compute the rate
+ * it advertises: rcp, dctcp, delay or pi.
+ * echo -n dev %s 00:00:00:00:01:01 cc dctcp
+ * > /sys/module/perfiso/parameters/set_vq_cc
+ */
+static int iso_sys_set_vq_cc(const char *val, struct kernel_param *kp) {
+	char _vqc[128], _devname[128], _cc[32];
+	iso_class_t vqclass;
+	struct iso_vq *vq;
+	struct iso_vq_cc_ops *cc;
+	unsigned long flags;
+	int n, ret = 0;
+	struct iso_rx_context *rxctx;
+	struct net_device *dev = NULL;
+
+	if(down_interruptible(&config_mutex))
+		return -EINVAL;
+
+	rcu_read_lock();
+	n = sscanf(val, "dev %s %s cc %31s", _devname, _vqc, _cc);
+	if(n != 3) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dev = iso_search_netdev(_devname);
+	if ((dev == NULL) || !iso_enabled(dev)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	rxctx = iso_rxctx_dev(dev);
+	vqclass = iso_class_parse(_vqc);
+	vq = iso_vq_find(vqclass, rxctx);
+	if(vq == NULL) {
+		printk(KERN_INFO "perfiso: Could not find vq %s\n", _vqc);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	cc = iso_vq_cc_find(_cc);
+	if(cc == NULL) {
+		printk(KERN_INFO "perfiso: Unknown cc %s\n", _cc);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	spin_lock_irqsave(&rxctx->vq_spinlock, flags);
+	iso_vq_set_cc(vq, cc);
+	spin_unlock_irqrestore(&rxctx->vq_spinlock, flags);
+
+	printk(KERN_INFO "perfiso: Set cc %s for vq %s on dev %s\n",
+	       cc->name, _vqc, _devname);
+ out:
+
+	rcu_read_unlock();
+	up(&config_mutex);
+	return ret;
+}
+
+module_param_call(set_vq_cc, iso_sys_set_vq_cc, iso_sys_noget, NULL, S_IWUSR);
+
+/*
+ * Police a VQ's arrivals to its rate, marking and then dropping
+ * packets from senders that do not back off.  0 turns it off.
+ * echo -n dev %s 00:00:00:00:01:01 police 1
+ * > /sys/module/perfiso/parameters/set_vq_police
+ */
+static int iso_sys_set_vq_police(const char *val, struct kernel_param *kp) {
+	char _vqc[128], _devname[128];
+	iso_class_t vqclass;
+	struct iso_vq *vq;
+	unsigned long flags;
+	int n, ret = 0, police;
+	struct iso_rx_context *rxctx;
+	struct net_device *dev = NULL;
+
+	if(down_interruptible(&config_mutex))
+		return -EINVAL;
+
+	rcu_read_lock();
+	n = sscanf(val, "dev %s %s police %d", _devname, _vqc, &police);
+	if(n != 3) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dev = iso_search_netdev(_devname);
+	if ((dev == NULL) || !iso_enabled(dev)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	rxctx = iso_rxctx_dev(dev);
+	vqclass = iso_class_parse(_vqc);
+	vq = iso_vq_find(vqclass, rxctx);
+	if(vq == NULL) {
+		printk(KERN_INFO "perfiso: Could not find vq %s\n", _vqc);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	spin_lock_irqsave(&rxctx->vq_spinlock, flags);
+	iso_vq_set_police(vq, police);
+	spin_unlock_irqrestore(&rxctx->vq_spinlock, flags);
+
+	printk(KERN_INFO "perfiso: Set police %d for vq %s on dev %s\n",
+	       vq->police, _vqc, _devname);
+ out:
+
+	rcu_read_unlock();
+	up(&config_mutex);
+	return ret;
+}
+
+module_param_call(set_vq_police, iso_sys_set_vq_police, iso_sys_noget, NULL, S_IWUSR);
+
 
 /*
  * Delete a txc.
@@ -610,10 +971,16 @@ static int iso_sys_delete_txc(const char *val, struct kernel_param *kp) {
 		goto out;
 	}
 
-	/* Remove the txc from the hash table. */
-	hlist_del(&txc->hash_node);
-	txctx->txc_total_weight -= txc->weight;
-	iso_txc_recompute_rates(txctx);
+	if (txc->num_children) {
+		ret = -EBUSY;
+		printk(KERN_INFO "perfiso: txc %s has children.  Delete them first.\n",
+		       _txc);
+		goto out;
+	}
+
+	/* Off the hash table and the class list; iso_txc_free waits
+	 * for rcu readers of both before freeing. */
+	iso_txc_unlink(txc);
 	iso_txc_free(txc);
 
 	printk(KERN_INFO "perfiso: Delete txc %s on dev %s\n",
@@ -703,8 +1070,6 @@ static int iso_sys_recompute_dev(const char *val, struct kernel_param *kp) {
 	char buff[128];
 	char devname[128];
 	int len, ret, n;
-	struct iso_tx_context *txctx;
-	struct iso_rx_context *rxctx;
 	struct net_device *dev = NULL;
 
 	len = min(127, (int)strlen(val));
@@ -724,11 +1089,10 @@ static int iso_sys_recompute_dev(const char *val, struct kernel_param *kp) {
 
 	dev = iso_search_netdev(devname);
 	if (dev && iso_enabled(dev)) {
-		txctx = iso_txctx_dev(dev);
-		rxctx = iso_rxctx_dev(dev);
-
-		iso_txc_recompute_rates(txctx);
-		iso_vq_calculate_rates(rxctx);
+		/* Picks up new ISO_MAX_TX_RATE/ISO_VQ_DRAIN_RATE_MBPS too */
+		rtnl_lock();
+		iso_dev_refresh(dev);
+		rtnl_unlock();
 	} else {
 		ret = -EINVAL;
 	}
@@ -744,6 +1108,82 @@ out:
 
 module_param_call(recompute_dev, iso_sys_recompute_dev, iso_sys_noget, NULL, S_IWUSR);
 
+/*
+ * Put a device in a host-wide group (1..ISO_MAX_GROUPS-1), so tenants
+ * get their guarantees from all the group's devices as a whole.
+ * Group 0 takes the device out of its group.  Create the same txcs
+ * and vqs on every member.
+ * echo -n dev eth0 group 1 > /sys/module/perfiso/parameters/join_group
+ */
+static int iso_sys_join_group(const char *val, struct kernel_param *kp) {
+	char devname[128];
+	int n, ret = 0, id;
+	struct iso_tx_context *txctx;
+	struct iso_rx_context *rxctx;
+	struct iso_group *group;
+	struct net_device *dev = NULL;
+
+	if(down_interruptible(&config_mutex))
+		return -EINVAL;
+
+	rcu_read_lock();
+	n = sscanf(val, "dev %s group %d", devname, &id);
+	if (n != 2) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dev = iso_search_netdev(devname);
+	if ((dev == NULL) || !iso_enabled(dev)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	txctx = iso_txctx_dev(dev);
+	rxctx = iso_rxctx_dev(dev);
+	iso_group_leave_tx(txctx);
+	iso_group_leave_rx(rxctx);
+
+	if (id != 0) {
+		group = iso_group_get(id);
+		if (group == NULL) {
+			printk(KERN_INFO "perfiso: Invalid group %d.  Group must lie in [0, %d]\n",
+			       id, ISO_MAX_GROUPS - 1);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		ret = iso_group_join(group, txctx, rxctx);
+		if (ret)
+			goto out;
+	}
+
+	printk(KERN_INFO "perfiso: dev %s joined group %d\n", devname, id);
+ out:
+	rcu_read_unlock();
+	up(&config_mutex);
+	return ret;
+}
+
+module_param_call(join_group, iso_sys_join_group, iso_sys_noget, NULL, S_IWUSR);
+
+/*
+ * Time the datapath's clock reads on this cpu; results go to the
+ * kernel log.
+ * echo -n 1000000 > /sys/module/perfiso/parameters/bench_clock
+ */
+static int iso_sys_bench_clock(const char *val, struct kernel_param *kp) {
+	int iters;
+
+	if(sscanf(val, "%d", &iters) != 1 || iters <= 0 || iters > 100000000)
+		return -EINVAL;
+
+	iso_clock_bench(iters);
+	return 0;
+}
+
+module_param_call(bench_clock, iso_sys_bench_clock, iso_sys_noget, NULL, S_IWUSR);
+
 /* Local Variables: */
 /* indent-tabs-mode:t */
 /* End: */
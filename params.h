@@ -3,6 +3,8 @@
 
 
 #include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/semaphore.h>
 #include <net/pkt_sched.h>
 
 #ifdef QDISC
@@ -37,6 +39,9 @@ extern int IsoGlobalEnabled;
 extern int IsoAutoGenerateFeedback;
 extern int ISO_FEEDBACK_INTERVAL_US;
 extern int ISO_FEEDBACK_INTERVAL_BYTES;
+extern int ISO_FEEDBACK_BATCH;
+extern int ISO_FEEDBACK_PIGGYBACK;
+extern int ISO_DELAY_SIGNAL;
 
 // TODO: We are assuming that we don't need to do any VLAN tag
 // ourselves
@@ -50,6 +55,7 @@ extern int ISO_RL_UPDATE_INTERVAL_US;
 extern int ISO_BURST_FACTOR;
 extern int ISO_VQ_UPDATE_INTERVAL_US;
 extern int ISO_TXC_UPDATE_INTERVAL_US;
+extern int ISO_COUNTER_PUBLISH_US;
 extern int ISO_VQ_REFRESH_INTERVAL_US;
 extern int ISO_MAX_QUEUE_LEN_BYTES;
 extern int ISO_TX_MARK_THRESH;
@@ -57,6 +63,12 @@ extern int ISO_GSO_THRESH_RATE;
 extern int ISO_GSO_MIN_SPLIT_BYTES;
 extern int ISO_ECN_MARK_THRESH_BYTES;
 extern int ISO_VQ_HRCP_US;
+extern int ISO_GROUP_UPDATE_INTERVAL_US;
+extern int ISO_RC_MODE;
+extern int ISO_VQ_CC_DELAY_TARGET_US;
+extern int ISO_VQ_CC_PI_A;
+extern int ISO_VQ_CC_PI_B;
+extern int ISO_CPU_ACCOUNTING;
 
 // MUST be 1 less than a power of 2
 #define ISO_MAX_QUEUE_LEN_PKT (127)
@@ -71,9 +83,72 @@ extern int ISO_VQ_HRCP_US;
 #define ISO_IDLE_RATE (2500)
 #define ISO_GSO_MAX_SIZE (32767)
 
+/*
+ * The values the datapath runs with.  The ints above are only what
+ * /proc/sys/perfiso shows and writes; each write is validated and
+ * published as a new, read-only iso_config, so readers always see one
+ * consistent set.  Read it once per packet or tick with iso_config().
+ */
+struct iso_config {
+	int max_tx_rate;
+	int vq_drain_rate_mbps;
+	int max_burst_time_us;
+	int min_burst_bytes;
+	int ratemeasure_interval_us;
+	int tokenbucket_timeout_ns;
+	int tokenbucket_mark_thresh_bytes;
+	int tokenbucket_drop_thresh_bytes;
+	int vq_mark_thresh_bytes;
+	int vq_max_bytes;
+	int rfair_initial;
+	int min_rfair;
+	int rfair_feedback_timeout_us;
+	int rfair_feedback_timeout_default_rate;
+	int global_enabled;
+	int auto_generate_feedback;
+	int feedback_packet_ipproto;
+	int feedback_interval_us;
+	int feedback_interval_bytes;
+	int feedback_batch;
+	int feedback_piggyback;
+	int delay_signal;
+	int rl_update_interval_us;
+	int vq_update_interval_us;
+	int txc_update_interval_us;
+	int counter_publish_us;
+	int vq_refresh_interval_us;
+	int max_queue_len_bytes;
+	int tx_mark_thresh;
+	int ecn_mark_thresh_bytes;
+	int vq_hrcp_us;
+	int group_update_interval_us;
+	int rc_mode;
+	int vq_cc_delay_target_us;
+	int vq_cc_pi_a;
+	int vq_cc_pi_b;
+	int cpu_accounting;
+	int falpha;
+	int burst_factor;
+};
+
+extern struct iso_config __rcu *iso_live_config;
+
+/*
+ * Readers hold rcu_read_lock or run with preemption off (softirq,
+ * timers, under a spinlock); updates wait for both before freeing
+ * the old config.
+ */
+static inline const struct iso_config *iso_config(void) {
+	return rcu_dereference_check(iso_live_config,
+				     rcu_read_lock_held() || rcu_read_lock_sched_held());
+}
+
 struct iso_param {
 	char name[64];
 	int *ptr;
+	/* Where it goes in struct iso_config, and its valid range */
+	size_t offset;
+	int min, max;
 };
 
 extern struct iso_param iso_params[64];
@@ -81,8 +156,14 @@ extern int iso_num_params;
 
 int iso_params_init(void);
 void iso_params_exit(void);
+int iso_config_commit(void);
+
+/* Serialises everything that changes classes and VQs: the sysfs
+ * handlers and netlink batches */
+extern struct semaphore config_mutex;
 
 int iso_enabled(struct net_device *dev);
+struct net_device *iso_search_netdev(char *name);
 
 #endif /* __PARAMS_H__ */
 
@@ -0,0 +1,157 @@
+#ifndef __PERFISO_NL_H__
+#define __PERFISO_NL_H__
+
+#include <linux/types.h>
+
+/*
+ * Generic netlink interface to perfiso.  This header is shared with
+ * userspace (tools/), so keep it free of kernel types.
+ *
+ * PERFISO_CMD_BATCH carries one PERFISO_ATTR_OPS nest holding up to
+ * PERFISO_BATCH_MAX_OPS PERFISO_ATTR_OP nests, applied in order.  The
+ * whole batch is checked before anything changes: an op may refer to
+ * a class created earlier in the same batch.  If an op still fails
+ * (out of memory), the ops before it are undone, so a batch goes in
+ * whole or not at all.  Rates are recomputed once per device at the
+ * end.  Errors come back in the netlink ack.
+ *
+ * PERFISO_CMD_GET_STATS is a dump.  Each reply message carries as
+ * many PERFISO_ATTR_STATS_REC attributes as fit, each one fixed-size
+ * struct perfiso_stats_rec.  Records come in the order: tx device,
+ * its classes (each followed by its per-destination limiters, if
+ * PERFISO_STATS_F_DEST is set in PERFISO_ATTR_STATS_FLAGS), then rx
+ * device and its VQs, then the PERFISO_REC_COST records if
+ * PERFISO_STATS_F_COST is set.  If classes come or go during a dump,
+ * a record may be skipped or repeated.
+ */
+#define PERFISO_GENL_NAME "perfiso"
+#define PERFISO_GENL_VERSION (1)
+
+#define PERFISO_BATCH_MAX_OPS (1024)
+
+enum perfiso_cmd {
+	PERFISO_CMD_UNSPEC,
+	PERFISO_CMD_BATCH,
+	PERFISO_CMD_GET_STATS,
+	__PERFISO_CMD_MAX,
+};
+#define PERFISO_CMD_MAX (__PERFISO_CMD_MAX - 1)
+
+enum perfiso_attr {
+	PERFISO_ATTR_UNSPEC,
+	PERFISO_ATTR_OPS,		/* nested: PERFISO_ATTR_OP... */
+	PERFISO_ATTR_OP,		/* nested: PERFISO_OP_ATTR_* */
+	PERFISO_ATTR_STATS_FLAGS,	/* u32: PERFISO_STATS_F_* */
+	PERFISO_ATTR_STATS_REC,		/* struct perfiso_stats_rec */
+	__PERFISO_ATTR_MAX,
+};
+#define PERFISO_ATTR_MAX (__PERFISO_ATTR_MAX - 1)
+
+enum perfiso_op_attr {
+	PERFISO_OP_ATTR_UNSPEC,
+	PERFISO_OP_ATTR_TYPE,		/* u32: enum perfiso_op */
+	PERFISO_OP_ATTR_DEV,		/* string: device name */
+	PERFISO_OP_ATTR_CLASS,		/* string: txc or vq class */
+	PERFISO_OP_ATTR_VQ,		/* string: vq class, for ASSOC_TXC_VQ */
+	PERFISO_OP_ATTR_WEIGHT,		/* u32: 1..PERFISO_MAX_WEIGHT */
+	__PERFISO_OP_ATTR_MAX,
+};
+#define PERFISO_OP_ATTR_MAX (__PERFISO_OP_ATTR_MAX - 1)
+
+enum perfiso_op {
+	PERFISO_OP_UNSPEC,
+	PERFISO_OP_CREATE_TXC,		/* DEV, CLASS */
+	PERFISO_OP_CREATE_VQ,		/* DEV, CLASS */
+	PERFISO_OP_ASSOC_TXC_VQ,	/* DEV, CLASS, VQ */
+	PERFISO_OP_SET_TXC_WEIGHT,	/* DEV, CLASS, WEIGHT */
+	PERFISO_OP_SET_VQ_WEIGHT,	/* DEV, CLASS, WEIGHT */
+	__PERFISO_OP_MAX,
+};
+
+#define PERFISO_MAX_WEIGHT (1024)
+
+/* Also dump the per-destination rate limiters of each class */
+#define PERFISO_STATS_F_DEST (1 << 0)
+/* Fill in the qdelay percentiles of TXC records, over what was queued
+ * since the previous dump that asked for them; this sums each class's
+ * histogram over all cpus, so it costs more than the rest.  Needs
+ * CAP_NET_ADMIN, as it moves that interval on for every reader;
+ * others get -EPERM at the end of the dump. */
+#define PERFISO_STATS_F_QDELAY (1 << 1)
+/* Also dump a PERFISO_REC_COST record for each datapath path; the
+ * counters only move while ISO_CPU_ACCOUNTING is set */
+#define PERFISO_STATS_F_COST (1 << 2)
+/* Fill in the reasons of TXDEV, TXC and RXDEV records */
+#define PERFISO_STATS_F_REASONS (1 << 3)
+
+enum perfiso_rec {
+	PERFISO_REC_UNSPEC,
+	PERFISO_REC_TXDEV,
+	PERFISO_REC_TXC,
+	PERFISO_REC_RL,
+	PERFISO_REC_RXDEV,
+	PERFISO_REC_VQ,
+	PERFISO_REC_COST,		/* klass is the path: tx, rx, ... */
+};
+
+#define PERFISO_CLASS_LEN (32)
+
+/* Why packets were dropped or cut, or control updates skipped for
+ * lock contention; indexes perfiso_stats_rec.reasons.  Same order as
+ * enum iso_reason in reason.h. */
+enum perfiso_reason {
+	PERFISO_REASON_RL_QUEUE_FULL,	/* TXC */
+	PERFISO_REASON_RL_TRIMMED,	/* TXC */
+	PERFISO_REASON_RL_GSO_ERROR,	/* TXC */
+	PERFISO_REASON_RL_SEGMENT,	/* TXC */
+	PERFISO_REASON_RL_BORROW_BUSY,	/* TXC */
+	PERFISO_REASON_TXQ_STOPPED,	/* TXDEV */
+	PERFISO_REASON_TX_DROP,		/* TXDEV */
+	PERFISO_REASON_TXC_TICK_BUSY,	/* TXDEV */
+	PERFISO_REASON_VQ_POLICED,	/* RXDEV */
+	PERFISO_REASON_FB_PEER_BUSY,	/* RXDEV */
+	PERFISO_REASON_FB_PEER_EVICT,	/* RXDEV */
+	PERFISO_REASON_RC_LOCK_BUSY,	/* TXC */
+	PERFISO_REASON_MAX,
+};
+
+/*
+ * Counters are totals since the class was created; take differences
+ * for rates.  They are as of each cpu's last publish, so samples
+ * closer together than ISO_COUNTER_PUBLISH_US see steps.  Rates are
+ * in Mb/s.  Fields a record type doesn't have are zero.
+ */
+struct perfiso_stats_rec {
+	__u32 type;			/* enum perfiso_rec */
+	__u32 ifindex;
+	char klass[PERFISO_CLASS_LEN];	/* txc or vq class, as in sysfs */
+	__u32 dst;			/* RL: destination, network order */
+	__u32 weight;
+	__u32 delay_us;			/* VQ: queueing delay senders saw */
+	__u32 alpha;			/* VQ: fraction marked, in 1024ths */
+	__u64 tstamp_ns;		/* ktime when the record was read */
+	__u64 bytes;
+	__u64 packets;
+	__u64 marked;
+	__u64 queued;			/* VQ: backlog in bytes */
+	__u64 rate;			/* what it may send or receive at */
+	__u64 measured_rate;		/* what it did, last control interval */
+	__u64 min_rate;			/* TXC: guarantee */
+	__u64 feedback_rate;		/* VQ */
+	/* TXC, with PERFISO_STATS_F_QDELAY: time packets waited in
+	 * the class's rate limiters since the previous such dump, in ns */
+	__u64 qdelay_p50_ns;
+	__u64 qdelay_p99_ns;
+	__u64 qdelay_p999_ns;
+	/* COST: totals over all cpus; see cost.h */
+	__u64 calls;
+	__u64 cycles;
+	/* TXDEV, TXC and RXDEV, with PERFISO_STATS_F_REASONS */
+	__u64 reasons[PERFISO_REASON_MAX];
+};
+
+#endif /* __PERFISO_NL_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
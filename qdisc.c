@@ -354,6 +354,7 @@ inline void skb_xmit(struct sk_buff *skb) {
 		if(!netif_tx_queue_stopped(txq)) {
 			txctx->xmit(skb, out);
 		} else {
+			iso_reason_inc(txctx->reasons, ISO_REASON_TXQ_STOPPED);
 			kfree_skb(skb);
 		}
 
@@ -363,6 +364,51 @@ inline void skb_xmit(struct sk_buff *skb) {
 	}
 }
 
+/*
+ * Called with bh disabled.  All skbs on @list must be for the same
+ * device and tx queue, so we take the queue's lock once for all of
+ * them.
+ */
+void skb_xmit_list(struct sk_buff_head *list) {
+	struct netdev_queue *txq;
+	struct sk_buff *skb = skb_peek(list);
+	struct net_device *out;
+	struct iso_tx_context *txctx;
+	int cpu;
+	int locked = 0;
+
+	if(skb == NULL)
+		return;
+
+	out = skb->dev;
+	txctx = iso_txctx_dev(out);
+	if(unlikely(txctx->xmit == NULL)) {
+		__skb_queue_purge(list);
+		return;
+	}
+
+	cpu = smp_processor_id();
+	txq = netdev_get_tx_queue(out, skb_get_queue_mapping(skb));
+
+	if(txq->xmit_lock_owner != cpu) {
+		HARD_TX_LOCK(out, txq, cpu);
+		locked = 1;
+	}
+
+	while((skb = __skb_dequeue(list)) != NULL) {
+		if(!netif_tx_queue_stopped(txq)) {
+			txctx->xmit(skb, out);
+		} else {
+			iso_reason_inc(txctx->reasons, ISO_REASON_TXQ_STOPPED);
+			kfree_skb(skb);
+		}
+	}
+
+	if(locked) {
+		HARD_TX_UNLOCK(out, txq);
+	}
+}
+
 int iso_tx_hook_init(struct iso_tx_context *context) {
 	struct net_device_ops *ops;
 	struct net_device *netdev = context->netdev;
@@ -419,7 +465,7 @@ static int iso_enqueue(struct sk_buff *skb, struct Qdisc *sch) {
 	struct mq_sched *priv = qdisc_priv(root);
 	int ret = NET_XMIT_SUCCESS;
 
-	if (unlikely(!IsoGlobalEnabled)) {
+	if (unlikely(!iso_config()->global_enabled)) {
 		verdict = ISO_VERDICT_PASS;
 	} else {
 		skb_reset_mac_header(skb);
@@ -429,6 +475,7 @@ static int iso_enqueue(struct sk_buff *skb, struct Qdisc *sch) {
 	switch(verdict) {
 	case ISO_VERDICT_DROP:
 		ret = NET_XMIT_DROP;
+		iso_reason_inc(priv->txc->reasons, ISO_REASON_TX_DROP);
 		kfree_skb(skb);
 		break;
 
@@ -454,7 +501,7 @@ rx_handler_result_t iso_rx_handler(struct sk_buff **pskb) {
 	if(unlikely(skb->pkt_type == PACKET_LOOPBACK))
 		return RX_HANDLER_PASS;
 
-	if (unlikely(!iso_enabled(in) || !IsoGlobalEnabled))
+	if (unlikely(!iso_enabled(in) || !iso_config()->global_enabled))
 		return RX_HANDLER_PASS;
 
 	rxctx = iso_rxctx_dev(in);
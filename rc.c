@@ -8,8 +8,10 @@ const char iso_rc_state_str[][32] = {
 
 void iso_rc_init(struct iso_rc_state *rc) {
 	int i;
-	rc->rfair = ISO_RFAIR_INITIAL;
-	rc->rfair_target = ISO_RFAIR_INITIAL;
+	rcu_read_lock();
+	rc->rfair = iso_config()->rfair_initial;
+	rcu_read_unlock();
+	rc->rfair_target = rc->rfair;
 	rc->alpha = 0;
 	rc->count = 0;
 	rc->state = RC_AI;
@@ -17,10 +19,15 @@ void iso_rc_init(struct iso_rc_state *rc) {
 	rc->last_rfair_change_time = ktime_get();
 	rc->last_rfair_decrease_time = ktime_get();
 	rc->last_feedback_time = ktime_get();
+	rc->last_feedback_seq = 0;
+	rc->last_feedback_epoch = 0;
+	rc->last_feedback_tstamp = 0;
+	rc->feedback_seen = 0;
+	rc->num_stale_feedback = 0;
 
 	for_each_possible_cpu(i) {
 		struct iso_rc_stats *stats = per_cpu_ptr(rc->stats, i);
-		stats->num_marked = 0;
+		stats->congestion = 0;
 		stats->num_rx = 0;
 	}
 
@@ -32,9 +39,16 @@ inline int iso_rc_tx(struct iso_rc_state *rc, struct sk_buff *skb) {
 	return 0;
 }
 
-inline int iso_rc_rx(struct iso_rc_state *rc, struct sk_buff *skb) {
-	int marked = skb_has_feedback(skb);
-	ktime_t now = ktime_get();
+/*
+ * Feedback arrived for this destination.  @congestion is how congested
+ * the receiver's VQ is, out of 1024; any of it triggers a decrease,
+ * and its average since the last decrease sets how deep (see
+ * iso_rc_do_alpha).  rfair never grows past @max_rate.  Returns 1 if
+ * rc->rfair changed, or -1 if another cpu held the lock so this
+ * update was skipped.
+ */
+inline int iso_rc_rx(struct iso_rc_state *rc, u32 congestion, u64 max_rate, ktime_t now) {
+	int marked = (congestion != 0);
 	int changed = 0;
 	u64 dt, target;
 	int idle;
@@ -43,16 +57,18 @@ inline int iso_rc_rx(struct iso_rc_state *rc, struct sk_buff *skb) {
 	stats->num_rx++;
 
 	if(marked) {
-		dt = ktime_us_delta(now, rc->last_rfair_decrease_time);
-		stats->num_marked++;
+		dt = iso_clock_us_since(now, rc->last_rfair_decrease_time);
+		stats->congestion += min_t(u32, congestion, 1024);
 
 		/* Reduce lock contention by being optimistic */
 		if(dt > ISO_RFAIR_DECREASE_INTERVAL_US) {
-			if(!spin_trylock(&rc->spinlock))
+			if(!spin_trylock(&rc->spinlock)) {
+				changed = -1;
 				goto end;
+			}
 
 			/* Check again: it is required, but is it very likely? */
-			dt = ktime_us_delta(now, rc->last_rfair_decrease_time);
+			dt = iso_clock_us_since(now, rc->last_rfair_decrease_time);
 			if(unlikely(dt < ISO_RFAIR_DECREASE_INTERVAL_US))
 				goto done_decrease;
 
@@ -63,12 +79,9 @@ inline int iso_rc_rx(struct iso_rc_state *rc, struct sk_buff *skb) {
 
 			target = rc->rfair;
 			rc->count = 0;
-			/* Compute alpha */
-			//iso_rc_do_alpha(rc);
-			rc->alpha = marked;
-			//iso_rc_do_md(rc);
-			rc->rfair = (rc->rfair * (512 - marked)) / 512;
-			rc->rfair = max((u64)ISO_MIN_RFAIR, rc->rfair);
+			/* Congestion since the last decrease, across all cpus */
+			iso_rc_do_alpha(rc);
+			iso_rc_do_md(rc);
 
 			rc->last_rfair_decrease_time = now;
 			rc->state = RC_FAST_RECOVERY;
@@ -81,12 +94,14 @@ inline int iso_rc_rx(struct iso_rc_state *rc, struct sk_buff *skb) {
 
 		goto end;
 	} else {
-		dt = ktime_us_delta(now, rc->last_rfair_change_time);
+		dt = iso_clock_us_since(now, rc->last_rfair_change_time);
 		if(dt > ISO_RFAIR_INCREASE_INTERVAL_US) {
-			if(!spin_trylock(&rc->spinlock))
+			if(!spin_trylock(&rc->spinlock)) {
+				changed = -1;
 				goto end;
+			}
 
-			dt = ktime_us_delta(now, rc->last_rfair_change_time);
+			dt = iso_clock_us_since(now, rc->last_rfair_change_time);
 			if(unlikely(dt < ISO_RFAIR_INCREASE_INTERVAL_US))
 				goto done_increase;
 
@@ -102,7 +117,7 @@ inline int iso_rc_rx(struct iso_rc_state *rc, struct sk_buff *skb) {
 			} else {
 				rc->state = RC_AI;
 				rc->count = 0;
-				iso_rc_do_ai(rc);
+				iso_rc_do_ai(rc, max_rate);
 				rc->rfair_target = rc->rfair;
 			}
 		done_increase:
@@ -121,31 +136,35 @@ inline int iso_rc_rx(struct iso_rc_state *rc, struct sk_buff *skb) {
 	return changed;
 }
 
-inline void iso_rc_do_ai(struct iso_rc_state *rc) {
-	rc->rfair = min((u64)ISO_MAX_TX_RATE, rc->rfair + ISO_RFAIR_INCREMENT);
+inline void iso_rc_do_ai(struct iso_rc_state *rc, u64 max_rate) {
+	rc->rfair = min(max_rate, rc->rfair + ISO_RFAIR_INCREMENT);
 }
 
 inline void iso_rc_do_md(struct iso_rc_state *rc) {
-	rc->rfair = rc->rfair * (2048 * ISO_FALPHA - rc->alpha) / (2048 * ISO_FALPHA);
-	rc->rfair = max((u64)ISO_MIN_RFAIR, rc->rfair);
+	const struct iso_config *cfg = iso_config();
+	rc->rfair = rc->rfair * (2048 * cfg->falpha - rc->alpha) / (2048 * cfg->falpha);
+	rc->rfair = max((u64)cfg->min_rfair, rc->rfair);
 }
 
 inline void iso_rc_do_alpha(struct iso_rc_state *rc) {
 	struct iso_rc_stats *stats;
-	u64 num_marked = 0, num_rx = 0;
+	u64 congestion = 0, num_rx = 0;
 	u64 frac = 0;
 	int i;
 
-	for_each_online_cpu(i) {
+	for_each_possible_cpu(i) {
 		stats = per_cpu_ptr(rc->stats, i);
-		num_marked += stats->num_marked;
+		congestion += stats->congestion;
 		num_rx += stats->num_rx;
 
-		stats->num_marked = stats->num_rx = 0;
+		stats->congestion = stats->num_rx = 0;
 	}
 
+	/* Mean congestion per feedback, unmarked ones counting as 0,
+	 * so a saturated receiver cuts deeper than a barely congested
+	 * one */
 	if(likely(num_rx))
-		frac = 1024 * num_marked / num_rx;
+		frac = div64_u64(congestion, num_rx);
 
 #define MUL31(x) (((x) << 5) - (x))
 #define DIV32(x) ((x) >> 5)
@@ -156,10 +175,11 @@ inline void iso_rc_do_alpha(struct iso_rc_state *rc) {
 
 void iso_rc_show(struct iso_rc_state *rc, struct seq_file *s) {
 	seq_printf(s, "\trfair %llu (%llu)   alpha %llu   state %s   "
-			   "last_change %llx   last_decrease %llx   last_feedback %llx\n",
+			   "last_change %llx   last_decrease %llx   last_feedback %llx   "
+			   "seq %u   stale %u\n",
 			   rc->rfair, rc->rfair_target, rc->alpha, iso_rc_state_str[rc->state],
 			   *(u64*)&rc->last_rfair_change_time, *(u64*)&rc->last_rfair_decrease_time,
-			   *(u64*)&rc->last_feedback_time);
+			   *(u64*)&rc->last_feedback_time, rc->last_feedback_seq, rc->num_stale_feedback);
 
 	seq_printf(s, "\n");
 }
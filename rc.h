@@ -7,7 +7,8 @@
 #include "rl.h"
 
 struct iso_rc_stats {
-	u64 num_marked;
+	/* Sum of the congestion in feedback received, in 1024ths */
+	u64 congestion;
 	u64 num_rx;
 };
 
@@ -16,6 +17,14 @@ enum iso_rc {
 	RC_AI,
 };
 
+/* ISO_RC_MODE: who computes the rate of a per-dest limiter */
+enum iso_rc_mode {
+	/* Use the rate the receiver's VQ advertises */
+	ISO_RC_MODE_RECEIVER = 0,
+	/* AIMD on the sender, driven by the receiver's congestion signal */
+	ISO_RC_MODE_AIMD = 1,
+};
+
 /* Rate controller specific state */
 struct iso_rc_state {
 	u64 rfair;
@@ -30,15 +39,23 @@ struct iso_rc_state {
 	ktime_t last_rfair_decrease_time;
 	ktime_t last_feedback_time;
 	spinlock_t spinlock;
+
+	/* Newest feedback applied so far, and how many older or
+	 * duplicate messages we ignored */
+	u32 last_feedback_seq;
+	u8 last_feedback_epoch;
+	u32 last_feedback_tstamp;
+	u8 feedback_seen;
+	u32 num_stale_feedback;
 };
 
 
 void iso_rc_init(struct iso_rc_state *);
 inline int iso_rc_tx(struct iso_rc_state *, struct sk_buff *);
-inline int iso_rc_rx(struct iso_rc_state *, struct sk_buff *);
+inline int iso_rc_rx(struct iso_rc_state *, u32 congestion, u64 max_rate, ktime_t now);
 
 /* We might have to be more "generic" as ai/md are specific */
-inline void iso_rc_do_ai(struct iso_rc_state *);
+inline void iso_rc_do_ai(struct iso_rc_state *, u64 max_rate);
 inline void iso_rc_do_md(struct iso_rc_state *);
 inline void iso_rc_do_alpha(struct iso_rc_state *);
 
@@ -0,0 +1,48 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/seq_file.h>
+#include "reason.h"
+
+const char *iso_reason_names[ISO_REASON_MAX] = {
+	[ISO_REASON_RL_QUEUE_FULL] = "queue_full",
+	[ISO_REASON_RL_TRIMMED] = "trimmed",
+	[ISO_REASON_RL_GSO_ERROR] = "gso_error",
+	[ISO_REASON_RL_SEGMENT] = "segment",
+	[ISO_REASON_RL_BORROW_BUSY] = "borrow_busy",
+	[ISO_REASON_TXQ_STOPPED] = "txq_stopped",
+	[ISO_REASON_TX_DROP] = "tx_drop",
+	[ISO_REASON_TXC_TICK_BUSY] = "tick_busy",
+	[ISO_REASON_VQ_POLICED] = "policed",
+	[ISO_REASON_FB_PEER_BUSY] = "peer_busy",
+	[ISO_REASON_FB_PEER_EVICT] = "peer_evict",
+	[ISO_REASON_RC_LOCK_BUSY] = "rc_busy",
+};
+
+void iso_reason_read(struct iso_reasons __percpu *r, struct iso_reasons *sum) {
+	struct iso_reasons *c;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		c = per_cpu_ptr(r, cpu);
+		for(i = 0; i < ISO_REASON_MAX; i++)
+			sum->count[i] += c->count[i];
+	}
+}
+
+void iso_reason_show(struct iso_reasons __percpu *r, const char *prefix, struct seq_file *s) {
+	struct iso_reasons sum;
+	int i;
+
+	iso_reason_read(r, &sum);
+	seq_printf(s, "%s", prefix);
+	for(i = 0; i < ISO_REASON_MAX; i++) {
+		if(sum.count[i])
+			seq_printf(s, "   %s %llu", iso_reason_names[i], sum.count[i]);
+	}
+	seq_printf(s, "\n");
+}
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
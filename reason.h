@@ -0,0 +1,62 @@
+#ifndef __REASON_H__
+#define __REASON_H__
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+
+struct seq_file;
+
+/*
+ * Why a packet was dropped or cut, or a control update skipped
+ * because another cpu held the lock.  Counted per cpu on each class
+ * and device, so a throughput dip can be told apart from the rate
+ * limiter doing its job.  Keep in step with enum perfiso_reason.
+ */
+enum iso_reason {
+	/* Class: rate limiter queue (see enum iso_rl_reason) */
+	ISO_REASON_RL_QUEUE_FULL,
+	ISO_REASON_RL_TRIMMED,
+	ISO_REASON_RL_GSO_ERROR,
+	ISO_REASON_RL_SEGMENT,
+	/* Class: couldn't take the limiter's lock to borrow tokens */
+	ISO_REASON_RL_BORROW_BUSY,
+	/* Tx device: freed because the tx queue was stopped */
+	ISO_REASON_TXQ_STOPPED,
+	/* Tx device: iso_enqueue returned NET_XMIT_DROP, for any of
+	 * the class reasons above */
+	ISO_REASON_TX_DROP,
+	/* Tx device: another cpu was already running iso_txc_tick */
+	ISO_REASON_TXC_TICK_BUSY,
+	/* Rx device: dropped by a VQ's policer */
+	ISO_REASON_VQ_POLICED,
+	/* Rx device: feedback or delay state of the sender was busy,
+	 * so this packet wasn't noted */
+	ISO_REASON_FB_PEER_BUSY,
+	/* Rx device: a sender pushed another out of the feedback table */
+	ISO_REASON_FB_PEER_EVICT,
+	/* Class: feedback for a destination found its rate controller
+	 * locked by another cpu, so the rate wasn't updated */
+	ISO_REASON_RC_LOCK_BUSY,
+	ISO_REASON_MAX,
+};
+
+struct iso_reasons {
+	u64 count[ISO_REASON_MAX];
+};
+
+extern const char *iso_reason_names[ISO_REASON_MAX];
+
+static inline void iso_reason_inc(struct iso_reasons __percpu *r, enum iso_reason why) {
+	this_cpu_inc(r->count[why]);
+}
+
+/* Sum of every reason over all cpus */
+void iso_reason_read(struct iso_reasons __percpu *r, struct iso_reasons *sum);
+/* One line: @prefix, then the reasons that have counted anything */
+void iso_reason_show(struct iso_reasons __percpu *r, const char *prefix, struct seq_file *s);
+
+#endif /* __REASON_H__ */
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -1,12 +1,15 @@
 
 #include "rl.h"
 #include "tx.h"
+#include "delay.h"
+#include "trace.h"
+#include "cost.h"
 
 //struct iso_rl_cb __percpu *rlcb;
 extern int iso_exiting;
 
 /* Called the first time when the module is initialised */
-int iso_rl_prep(struct iso_rl_cb __percpu **rlcb) {
+int iso_rl_prep(struct iso_rl_cb __percpu **rlcb, struct iso_counter *tx_counter) {
 	int cpu;
 
 	*rlcb = alloc_percpu(struct iso_rl_cb);
@@ -28,6 +31,9 @@ int iso_rl_prep(struct iso_rl_cb __percpu **rlcb) {
 		cb->avg_us = 0;
 		cb->cpu = cpu;
 		cb->tx_bytes = 0;
+		cb->published_tx = 0;
+		cb->last_publish = cb->last;
+		cb->tx_counter = tx_counter;
 	}
 
 	return 0;
@@ -48,49 +54,63 @@ void iso_rl_exit(struct iso_rl_cb __percpu *rlcb) {
 void iso_rl_xmit_tasklet(unsigned long _cb) {
 	struct iso_rl_cb *cb = (struct iso_rl_cb *)_cb;
 	struct iso_rl_queue *q, *qtmp, *first;
+	const struct iso_config *cfg = iso_config();
 	ktime_t last;
 	ktime_t dt;
 	int count = 0;
 	u32 sent = 0;
+	cycles_t start;
+	u64 pkts;
 
 #define budget 500
 
 	if(iso_exiting)
 		return;
 
+	start = iso_cost_start(cfg);
+	pkts = iso_cost_packets(ISO_COST_RL_DEQUEUE);
+
 	/* This block is not needed, but just for debugging purposes */
 	last = cb->last;
-	cb->last = ktime_get();
+	cb->last = iso_clock_now();
 	cb->avg_us = ktime_us_delta(cb->last, last);
 
 	first = list_entry(cb->active_list.next, struct iso_rl_queue, active_list);
 
 	list_for_each_entry_safe(q, qtmp, &cb->active_list, active_list) {
 		count++;
-		if(qtmp == first || count++ > budget || sent > 2 * ISO_MIN_BURST_BYTES) {
+		if(qtmp == first || count++ > budget || sent > 2 * cfg->min_burst_bytes) {
 			/* Break out of looping */
 			break;
 		}
 
 		list_del_init(&q->active_list);
-		iso_rl_clock(q->rl);
+		iso_rl_clock(q->rl, cfg, cb->last);
 		sent += iso_rl_dequeue((unsigned long)q);
 	}
 
+	iso_cost_end(cfg, ISO_COST_RL_TASKLET, start,
+		     iso_cost_packets(ISO_COST_RL_DEQUEUE) - pkts, sent);
+
 	if(!list_empty(&cb->active_list) && !iso_exiting) {
-		dt = iso_rl_gettimeout();
+		dt = iso_rl_gettimeout(cfg);
 		hrtimer_start(&cb->timer, dt, HRTIMER_MODE_REL_PINNED);
 	}
 }
 
 void iso_rl_init(struct iso_rl *rl, struct iso_rl_cb __percpu *rlcb) {
 	int i;
-	rl->rate = ISO_RFAIR_INITIAL;
+	rcu_read_lock();
+	rl->rate = iso_config()->rfair_initial;
+	rcu_read_unlock();
 	rl->total_tokens = 15000;
 	rl->last_update_time = ktime_get();
 	rl->last_rate_update_time = ktime_get();
 	rl->queue = alloc_percpu(struct iso_rl_queue);
+	iso_counter_init(&rl->xmit);
 	rl->accum_xmit = 0;
+	iso_counter_init(&rl->arrived);
+	rl->accum_arrived = 0;
 	rl->accum_enqueued = 0;
 	rl->rlcb = rlcb;
 	spin_lock_init(&rl->spinlock);
@@ -103,9 +123,14 @@ void iso_rl_init(struct iso_rl *rl, struct iso_rl_cb __percpu *rlcb) {
 		q->first_pkt_size = 0;
 		q->bytes_enqueued = 0;
 		q->bytes_xmit = 0;
+		q->published_xmit = 0;
+		q->bytes_arrived = 0;
+		q->published_arrived = 0;
+		q->last_publish = rl->last_update_time;
 
 		q->feedback_backlog = 0;
 		q->tokens = 0;
+		q->debt = 0;
 
 		spin_lock_init(&q->spinlock);
 
@@ -118,6 +143,7 @@ void iso_rl_init(struct iso_rl *rl, struct iso_rl_cb __percpu *rlcb) {
 
 	INIT_LIST_HEAD(&rl->prealloc_list);
 	rl->txc = NULL;
+	rl->parent = NULL;
 }
 
 void iso_rl_free(struct iso_rl *rl) {
@@ -130,7 +156,7 @@ void iso_rl_show(struct iso_rl *rl, struct seq_file *s) {
 	struct iso_rl_queue *q;
 	int i, first = 1;
 
-	seq_printf(s, "ip %x   rate %u   total_tokens %llu   last %llx   %p\n",
+	seq_printf(s, "ip %x   rate %llu   total_tokens %llu   last %llx   %p\n",
 			   rl->ip, rl->rate, rl->total_tokens, *(u64 *)&rl->last_update_time, rl);
 
 	for_each_online_cpu(i) {
@@ -151,59 +177,73 @@ void iso_rl_show(struct iso_rl *rl, struct seq_file *s) {
 }
 
 /* This function could be called from HARDIRQ context */
-inline void iso_rl_clock(struct iso_rl *rl) {
+inline void iso_rl_clock(struct iso_rl *rl, const struct iso_config *cfg, ktime_t now) {
 	u64 cap, us, us2;
-	ktime_t now;
 
-	if(!iso_rl_should_refill(rl))
+	if(!iso_rl_should_refill(rl, cfg, now))
 		return;
 
-	now = ktime_get();
-	us = ktime_us_delta(now, rl->last_update_time);
+	us = iso_clock_us_since(now, rl->last_update_time);
 	if(us > ISO_IDLE_TIMEOUT_US && rl->rate > ISO_IDLE_RATE)
 		rl->rate = ISO_IDLE_RATE;
-	us2 = ktime_us_delta(now, rl->last_rate_update_time);
-	if(us2 > ISO_RFAIR_FEEDBACK_TIMEOUT_US) {
+	us2 = iso_clock_us_since(now, rl->last_rate_update_time);
+	if(us2 > cfg->rfair_feedback_timeout_us) {
 		rl->rate >>= 1;
-		rl->rate = max_t(int, 2, rl->rate);
+		rl->rate = max_t(u64, 2, rl->rate);
 		rl->last_rate_update_time = now;
 	}
 
 	rl->total_tokens += (rl->rate * us) >> 3;
 
 	/* This is needed if we have TSO.  MIN_BURST_BYTES will be ~64K */
-	cap = max((rl->rate * ISO_MAX_BURST_TIME_US) >> 3, (u32)ISO_MIN_BURST_BYTES);
+	cap = max_t(u64, (rl->rate * cfg->max_burst_time_us) >> 3, cfg->min_burst_bytes);
 	rl->total_tokens = min(cap, rl->total_tokens);
 
 	rl->last_update_time = now;
 }
 
+static inline void iso_rl_count(struct iso_rl *rl, enum iso_reason why) {
+	iso_reason_inc(iso_rl_txc(rl)->reasons, why);
+}
+
 enum iso_verdict iso_rl_enqueue(struct iso_rl *rl, struct sk_buff *pkt, int cpu) {
 	struct iso_rl_queue *q = per_cpu_ptr(rl->queue, cpu);
+	const struct iso_config *cfg = iso_config();
 	enum iso_verdict verdict;
-	s32 len, diff;
+	enum iso_rl_reason reason = ISO_RL_ENQUEUED;
+	s32 len, diff, qlen = cfg->max_queue_len_bytes;
+	/* Called for the packet iso_tx or the xmit tasklet is handling
+	 * on this cpu, so the cached clock is current */
+	ktime_t now = iso_clock();
 
 #define MIN_PKT_SIZE (600)
 
-	iso_rl_clock(rl);
+	iso_rl_clock(rl, cfg, now);
 	len = (s32) skb_size(pkt);
+	q->bytes_arrived += len;
 
 	if(rl->rate > ISO_GSO_THRESH_RATE || len <= ISO_GSO_MIN_SPLIT_BYTES) {
-		if(q->bytes_enqueued + len > ISO_MAX_QUEUE_LEN_BYTES) {
-			diff = (s32)q->bytes_enqueued + len - ISO_MAX_QUEUE_LEN_BYTES;
+		if(q->bytes_enqueued + len > qlen) {
+			diff = (s32)q->bytes_enqueued + len - qlen;
 			if(diff > len || diff - len < MIN_PKT_SIZE) {
+				trace_perfiso_rl_enqueue(rl, q, len, ISO_RL_DROP_QUEUE_FULL);
+				iso_rl_count(rl, ISO_REASON_RL_QUEUE_FULL);
 				verdict = ISO_VERDICT_DROP;
 				goto done;
 			} else {
 				skb_trim(pkt, diff);
+				reason = ISO_RL_TRIMMED;
+				iso_rl_count(rl, ISO_REASON_RL_TRIMMED);
 			}
 		}
 
 		/* we don't need locks */
+		iso_skb_cb(pkt)->enqueued = now;
 		__skb_queue_tail(&q->list, pkt);
 		q->bytes_enqueued += skb_size(pkt);
+		trace_perfiso_rl_enqueue(rl, q, len, reason);
 
-		if(rl->txc == NULL && q->bytes_enqueued > ISO_TX_MARK_THRESH) {
+		if(rl->txc == NULL && q->bytes_enqueued > cfg->tx_mark_thresh) {
 			struct ethhdr *eth = eth_hdr(pkt);
 			if(likely(eth->h_proto == __constant_htons(ETH_P_IP))) {
 				struct iphdr *iph = ip_hdr(pkt);
@@ -216,6 +256,8 @@ enum iso_verdict iso_rl_enqueue(struct iso_rl *rl, struct sk_buff *pkt, int cpu)
 		struct sk_buff *next = NULL;
 
 		if(IS_ERR(skb)) {
+			trace_perfiso_rl_enqueue(rl, q, len, ISO_RL_DROP_GSO_ERROR);
+			iso_rl_count(rl, ISO_REASON_RL_GSO_ERROR);
 			verdict = ISO_VERDICT_ERROR;
 			if(net_ratelimit())
 				printk(KERN_INFO "skb gso segment error len=%d\n", len);
@@ -227,10 +269,14 @@ enum iso_verdict iso_rl_enqueue(struct iso_rl *rl, struct sk_buff *pkt, int cpu)
 		do {
 			next = skb->next;
 			skb->next = NULL;
-			if(q->bytes_enqueued < ISO_MAX_QUEUE_LEN_BYTES) {
+			if(q->bytes_enqueued < qlen) {
+				iso_skb_cb(skb)->enqueued = now;
 				__skb_queue_tail(&q->list, skb);
 				q->bytes_enqueued += skb_size(skb);
+				trace_perfiso_rl_enqueue(rl, q, skb_size(skb), ISO_RL_ENQUEUED);
 			} else {
+				trace_perfiso_rl_enqueue(rl, q, skb_size(skb), ISO_RL_DROP_SEGMENT);
+				iso_rl_count(rl, ISO_REASON_RL_SEGMENT);
 				kfree_skb(skb);
 			}
 		} while((skb = next));
@@ -241,11 +287,20 @@ enum iso_verdict iso_rl_enqueue(struct iso_rl *rl, struct sk_buff *pkt, int cpu)
 	return verdict;
 }
 
-static inline bool iso_rl_has_space_for(struct iso_rl *rl, struct sk_buff *pkt, int cpu)
+static inline bool iso_rl_has_space_for(struct iso_rl *rl, struct sk_buff *pkt, int cpu,
+					const struct iso_config *cfg)
 {
 	struct iso_rl_queue *q = per_cpu_ptr(rl->queue, cpu);
 	u32 len = skb_size(pkt);
-	return q->bytes_enqueued + len < ISO_MAX_QUEUE_LEN_BYTES;
+	return q->bytes_enqueued + len < cfg->max_queue_len_bytes;
+}
+
+/* How long @pkt waited in @q, into its class's histogram */
+static inline void iso_rl_sojourn(struct iso_rl *rl, struct iso_rl_queue *q,
+				  struct sk_buff *pkt, ktime_t now) {
+	s64 ns = ktime_to_ns(ktime_sub(now, iso_skb_cb(pkt)->enqueued));
+
+	iso_hist_add(per_cpu_ptr(iso_rl_txc(rl)->qdelay, q->cpu), ns > 0 ? ns : 0);
 }
 
 /* This function MUST be executed with interrupts enabled */
@@ -258,14 +313,20 @@ u32 iso_rl_dequeue(unsigned long _q) {
 	struct iso_rl_queue *rootq;
 	struct iso_rl *rl = q->rl;
 	struct sk_buff_head *skq;
+	const struct iso_config *cfg = iso_config();
+	ktime_t now = iso_clock();
+	cycles_t start = iso_cost_start(cfg);
+	u32 pkts = 0, bytes = 0;
 
 	/* Try to borrow from the global token pool; if that fails,
 	   program the timeout for this queue */
 
 	if(unlikely(q->tokens < q->first_pkt_size)) {
-		timeout = iso_rl_borrow_tokens(rl, q);
-		if(timeout)
+		timeout = iso_rl_borrow_tokens(rl, q, cfg);
+		if(timeout) {
+			iso_cost_end(cfg, ISO_COST_RL_DEQUEUE, start, 0, 0);
 			goto timeout;
+		}
 	}
 
 	skq = &q->list;
@@ -277,27 +338,34 @@ u32 iso_rl_dequeue(unsigned long _q) {
 	q->first_pkt_size = size;
 	timeout = 1;
 
-	while(size <= q->tokens && sum <= ISO_MIN_BURST_BYTES * 2) {
-		if(rl->txc == NULL) {
+	while(size <= q->tokens && sum <= cfg->min_burst_bytes * 2) {
+		if(rl->parent == NULL) {
 			struct iso_rl_cb *cb = per_cpu_ptr(rl->rlcb, q->cpu);
 			__skb_dequeue(skq);
+			iso_rl_sojourn(rl, q, pkt, now);
+			/* Stamp after shaping, so the delay is the network's */
+			iso_delay_stamp(pkt, cfg);
 			skb_xmit(pkt);
 			q->tokens -= size;
 			q->bytes_enqueued -= size;
-			q->bytes_xmit += size;
-			cb->tx_bytes += size;
+			iso_rl_account_xmit(rl, q, cfg, size, now);
+			iso_rl_cb_account_xmit(cb, cfg, size, now);
 		} else {
-			/* Enqueue in parent tx class's rate limiter */
-			if (iso_rl_has_space_for(&rl->txc->rl, pkt, q->cpu)) {
+			/* Enqueue in the next rate limiter up the hierarchy */
+			if (iso_rl_has_space_for(rl->parent, pkt, q->cpu, cfg)) {
 				__skb_dequeue(skq);
-				iso_rl_enqueue(&rl->txc->rl, pkt, q->cpu);
+				iso_rl_sojourn(rl, q, pkt, now);
+				iso_rl_enqueue(rl->parent, pkt, q->cpu);
 				q->tokens -= size;
 				q->bytes_enqueued -= size;
-				q->bytes_xmit += size;
+				iso_rl_account_xmit(rl, q, cfg, size, now);
 			} else {
 				break;
 			}
 		}
+		trace_perfiso_rl_dequeue(rl, q, size);
+		pkts++;
+		bytes += size;
 
 		if(skb_queue_len(skq) == 0) {
 			timeout = 0;
@@ -310,10 +378,14 @@ u32 iso_rl_dequeue(unsigned long _q) {
 	}
 
 unlock:
-
-	if(rl->txc != NULL) {
-		/* Trigger the parent dequeue */
-		rootq = per_cpu_ptr(rl->txc->rl.queue, q->cpu);
+	/* Our own level only; the parent accounts for itself */
+	iso_cost_end(cfg, ISO_COST_RL_DEQUEUE, start, pkts, bytes);
+
+	if(rl->parent != NULL) {
+		/* Trigger the parent dequeue.  This recurses once per
+		 * level, so the cost grows with depth, not with the
+		 * number of siblings. */
+		rootq = per_cpu_ptr(rl->parent->queue, q->cpu);
 		iso_rl_dequeue((unsigned long)rootq);
 	}
 
@@ -327,7 +399,7 @@ timeout:
 		}
 
 		if(!hrtimer_active(&cb->timer))
-			hrtimer_start(&cb->timer, iso_rl_gettimeout(), HRTIMER_MODE_REL_PINNED);
+			hrtimer_start(&cb->timer, iso_rl_gettimeout(cfg), HRTIMER_MODE_REL_PINNED);
 	}
 
 	return sum;
@@ -341,15 +413,19 @@ enum hrtimer_restart iso_rl_timeout(struct hrtimer *timer) {
 	return HRTIMER_NORESTART;
 }
 
-inline int iso_rl_borrow_tokens(struct iso_rl *rl, struct iso_rl_queue *q) {
+inline int iso_rl_borrow_tokens(struct iso_rl *rl, struct iso_rl_queue *q,
+				const struct iso_config *cfg) {
 	unsigned long flags;
 	u64 borrow;
 	int timeout = 1;
 
-	if(!spin_trylock_irqsave(&rl->spinlock, flags))
+	if(!spin_trylock_irqsave(&rl->spinlock, flags)) {
+		trace_perfiso_rl_borrow_fail(rl, q, 1);
+		iso_rl_count(rl, ISO_REASON_RL_BORROW_BUSY);
 		return timeout;
+	}
 
-	borrow = max(iso_rl_singleq_burst(rl), (u64)q->first_pkt_size);
+	borrow = max(iso_rl_singleq_burst(rl, cfg), (u64)q->first_pkt_size);
 	borrow = rl->total_tokens;
 
 	if(rl->total_tokens >= borrow) {
@@ -358,8 +434,16 @@ inline int iso_rl_borrow_tokens(struct iso_rl *rl, struct iso_rl_queue *q) {
 		timeout = 0;
 	}
 
+	if(unlikely(q->debt)) {
+		borrow = min(q->debt, q->tokens);
+		q->debt -= borrow;
+		q->tokens -= borrow;
+	}
+
 	if(iso_exiting)
 		timeout = 0;
+	else if(timeout)
+		trace_perfiso_rl_borrow_fail(rl, q, 0);
 
 	spin_unlock_irqrestore(&rl->spinlock, flags);
 	return timeout;
@@ -19,8 +19,11 @@
 #include <linux/random.h>
 #include <asm/atomic.h>
 #include <linux/spinlock.h>
+#include <net/sch_generic.h>
 
 #include "params.h"
+#include "clock.h"
+#include "counter.h"
 
 enum iso_verdict {
 	ISO_VERDICT_SUCCESS,
@@ -29,15 +32,48 @@ enum iso_verdict {
 	ISO_VERDICT_ERROR,
 };
 
+/* What iso_rl_enqueue did with a packet, for the perfiso_rl_enqueue
+ * tracepoint */
+enum iso_rl_reason {
+	ISO_RL_ENQUEUED,
+	/* Queue was nearly full; the tail of the packet was cut */
+	ISO_RL_TRIMMED,
+	ISO_RL_DROP_QUEUE_FULL,
+	ISO_RL_DROP_GSO_ERROR,
+	/* One segment of a split GSO packet didn't fit */
+	ISO_RL_DROP_SEGMENT,
+};
+
+/* Our part of skb->cb, after the qdisc layer's */
+struct iso_skb_cb {
+	/* When the packet joined its current rate limiter queue */
+	ktime_t enqueued;
+};
+
+static inline struct iso_skb_cb *iso_skb_cb(struct sk_buff *skb) {
+	BUILD_BUG_ON(sizeof(struct qdisc_skb_cb) + sizeof(struct iso_skb_cb) >
+		     sizeof(skb->cb));
+	return (struct iso_skb_cb *)(skb->cb + sizeof(struct qdisc_skb_cb));
+}
+
 struct iso_rl_queue {
 	struct sk_buff_head list;
 	int first_pkt_size;
 
 	u64 bytes_enqueued;
 	u64 bytes_xmit;
+	/* Share of bytes_xmit published to rl->xmit */
+	u64 published_xmit;
+	/* Bytes offered to this queue, dropped ones included */
+	u64 bytes_arrived;
+	u64 published_arrived;
+	ktime_t last_publish;
 	u64 feedback_backlog;
 
 	u64 tokens;
+	/* Bytes sent past this limiter without tokens (low latency
+	 * bypass); paid back first from the next tokens we borrow */
+	u64 debt;
 	spinlock_t spinlock;
 
 	int cpu;
@@ -49,12 +85,19 @@ struct iso_rl_queue {
 struct iso_rl_cb;
 
 struct iso_rl {
-	u32 rate;
+	/* Mb/s; 64 bits so rate * us can't overflow above 40G */
+	u64 rate;
 	spinlock_t spinlock;
 
 	__le32 ip;
 	u64 total_tokens;
+	/* Bytes sent by all cpus, as of the last publish */
+	struct iso_counter xmit;
 	u64 accum_xmit;
+	/* Bytes offered by all cpus, published with xmit: the demand
+	 * on this limiter, whether or not it could send it */
+	struct iso_counter arrived;
+	u64 accum_arrived;
 	u64 accum_enqueued;
 
 	ktime_t last_update_time;
@@ -64,7 +107,11 @@ struct iso_rl {
 	struct hlist_node hash_node;
 	struct list_head prealloc_list;
 
+	/* Owner of a per-dest limiter; NULL for a class's own limiter */
 	struct iso_tx_class *txc;
+	/* Next limiter up the hierarchy, or NULL if packets leaving
+	 * this limiter go straight to the device */
+	struct iso_rl *parent;
 	struct iso_rl_cb *rlcb;
 };
 
@@ -78,9 +125,13 @@ struct iso_rl_cb {
 	u64 avg_us;
 	int cpu;
 	u64 tx_bytes;
+	/* Share of tx_bytes published to *tx_counter, the device's */
+	u64 published_tx;
+	ktime_t last_publish;
+	struct iso_counter *tx_counter;
 };
 
-int iso_rl_prep(struct iso_rl_cb __percpu **rlcb);
+int iso_rl_prep(struct iso_rl_cb __percpu **rlcb, struct iso_counter *tx_counter);
 void iso_rl_exit(struct iso_rl_cb __percpu *rlcb);
 void iso_rl_xmit_tasklet(unsigned long _cb);
 //extern struct iso_rl_cb __percpu *rlcb;
@@ -88,21 +139,56 @@ void iso_rl_xmit_tasklet(unsigned long _cb);
 void iso_rl_init(struct iso_rl *, struct iso_rl_cb *);
 void iso_rl_free(struct iso_rl *);
 void iso_rl_show(struct iso_rl *, struct seq_file *);
-static inline int iso_rl_should_refill(struct iso_rl *);
-inline void iso_rl_clock(struct iso_rl *);
+static inline int iso_rl_should_refill(struct iso_rl *, const struct iso_config *, ktime_t now);
+inline void iso_rl_clock(struct iso_rl *, const struct iso_config *, ktime_t now);
 enum iso_verdict iso_rl_enqueue(struct iso_rl *, struct sk_buff *, int cpu);
 u32 iso_rl_dequeue(unsigned long _q);
 enum hrtimer_restart iso_rl_timeout(struct hrtimer *);
-inline int iso_rl_borrow_tokens(struct iso_rl *, struct iso_rl_queue *);
-static inline ktime_t iso_rl_gettimeout(void);
-static inline u64 iso_rl_singleq_burst(struct iso_rl *);
+inline int iso_rl_borrow_tokens(struct iso_rl *, struct iso_rl_queue *, const struct iso_config *);
+static inline ktime_t iso_rl_gettimeout(const struct iso_config *);
+static inline u64 iso_rl_singleq_burst(struct iso_rl *, const struct iso_config *);
 
 inline void skb_xmit(struct sk_buff *skb);
+void skb_xmit_list(struct sk_buff_head *list);
 
 static inline int skb_size(struct sk_buff *skb) {
 	return ETH_HLEN + skb->len;
 }
 
+/* Number of packets on the wire an skb stands for; more than one
+ * after GRO/LRO on receive. */
+static inline u32 skb_segs(struct sk_buff *skb) {
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	u32 segs;
+
+	if(likely(!skb_is_gso(skb)))
+		return 1;
+
+	segs = shinfo->gso_segs;
+	if(segs == 0 && shinfo->gso_size)
+		segs = DIV_ROUND_UP(skb->len, shinfo->gso_size);
+	return max_t(u32, segs, 1);
+}
+
+/* Like skb_size, but counts the headers GRO folded away, once for
+ * every segment after the first. */
+static inline u32 skb_wire_size(struct sk_buff *skb, u32 segs) {
+	struct iphdr *iph;
+	u32 hlen;
+
+	if(likely(segs == 1) || eth_hdr(skb)->h_proto != __constant_htons(ETH_P_IP))
+		return skb_size(skb);
+
+	iph = ip_hdr(skb);
+	hlen = ETH_HLEN + (iph->ihl << 2);
+	if(iph->protocol == IPPROTO_TCP)
+		hlen += ((struct tcphdr *)((u8 *)iph + (iph->ihl << 2)))->doff << 2;
+	else if(iph->protocol == IPPROTO_UDP)
+		hlen += sizeof(struct udphdr);
+
+	return skb_size(skb) + (segs - 1) * hlen;
+}
+
 #define ISO_ECN_REFLECT_MASK (1 << 3)
 
 static inline int skb_set_feedback(struct sk_buff *skb) {
@@ -130,40 +216,73 @@ static inline int skb_has_feedback(struct sk_buff *skb) {
 
 	iph = ip_hdr(skb);
 	//return iph->tos & ISO_ECN_REFLECT_MASK;
-	if(unlikely(iph->protocol != ISO_FEEDBACK_PACKET_IPPROTO))
+	if(unlikely(iph->protocol != iso_config()->feedback_packet_ipproto))
 		return 0;
 	return iph->id;
 }
 
-static inline ktime_t iso_rl_gettimeout() {
-	return ktime_set(0, ISO_TOKENBUCKET_TIMEOUT_NS);
+static inline ktime_t iso_rl_gettimeout(const struct iso_config *cfg) {
+	return ktime_set(0, cfg->tokenbucket_timeout_ns);
 }
 
 
-static inline u64 iso_rl_singleq_burst(struct iso_rl *rl) {
-	return ((rl->rate * ISO_MAX_BURST_TIME_US) >> 3) / ISO_BURST_FACTOR;
+static inline u64 iso_rl_singleq_burst(struct iso_rl *rl, const struct iso_config *cfg) {
+	return ((rl->rate * cfg->max_burst_time_us) >> 3) / cfg->burst_factor;
 }
 
-static inline int iso_rl_should_refill(struct iso_rl *rl) {
-	ktime_t now = ktime_get();
-	if(ktime_us_delta(now, rl->last_update_time) > ISO_RL_UPDATE_INTERVAL_US)
+static inline int iso_rl_should_refill(struct iso_rl *rl, const struct iso_config *cfg, ktime_t now) {
+	if(iso_clock_us_since(now, rl->last_update_time) > cfg->rl_update_interval_us)
 		return 1;
 	return 0;
 }
 
+/* @size bytes of @rl's left this cpu's queue @q */
+static inline void iso_rl_account_xmit(struct iso_rl *rl, struct iso_rl_queue *q,
+				       const struct iso_config *cfg, u32 size, ktime_t now) {
+	q->bytes_xmit += size;
+	if(iso_counter_due(&q->last_publish, now, cfg->counter_publish_us)) {
+		iso_counter_publish(&rl->xmit, q->bytes_xmit, &q->published_xmit);
+		iso_counter_publish(&rl->arrived, q->bytes_arrived, &q->published_arrived);
+	}
+}
+
+/* @size bytes left this cpu for the device */
+static inline void iso_rl_cb_account_xmit(struct iso_rl_cb *cb, const struct iso_config *cfg,
+					  u32 size, ktime_t now) {
+	cb->tx_bytes += size;
+	if(iso_counter_due(&cb->last_publish, now, cfg->counter_publish_us))
+		iso_counter_publish(cb->tx_counter, cb->tx_bytes, &cb->published_tx);
+}
+
+/* @size bytes of @rl skipped this cpu's queue @q.  Take them out of
+ * @rl's budget as if they'd been dequeued: what @q hasn't got in
+ * tokens becomes debt. */
+static inline void iso_rl_bypass(struct iso_rl *rl, struct iso_rl_queue *q,
+				 const struct iso_config *cfg, u32 size, ktime_t now) {
+	q->bytes_arrived += size;
+	if(q->tokens >= size) {
+		q->tokens -= size;
+	} else {
+		q->debt += size - q->tokens;
+		q->tokens = 0;
+	}
+	iso_rl_account_xmit(rl, q, cfg, size, now);
+}
+
 static inline void iso_rl_accum(struct iso_rl *rl) {
-	u64 xmit, queued;
+	rl->accum_xmit = iso_counter_read(&rl->xmit);
+	rl->accum_arrived = iso_counter_read(&rl->arrived);
+}
+
+/* Bytes queued on all cpus.  This walks every cpu; it is for the
+ * stats file, not the control loops. */
+static inline void iso_rl_accum_queued(struct iso_rl *rl) {
+	u64 queued = 0;
 	int i;
-	struct iso_rl_queue *q;
 
-	xmit = queued = 0;
-	for_each_online_cpu(i) {
-		q = per_cpu_ptr(rl->queue, i);
-		xmit += q->bytes_xmit;
-		queued += q->bytes_enqueued;
-	}
+	for_each_online_cpu(i)
+		queued += per_cpu_ptr(rl->queue, i)->bytes_enqueued;
 
-	rl->accum_xmit = xmit;
 	rl->accum_enqueued = queued;
 }
 
@@ -3,6 +3,8 @@
 #include "tx.h"
 #include "rx.h"
 #include "vq.h"
+#include "delay.h"
+#include "cost.h"
 
 int iso_rx_hook_init(struct iso_rx_context *);
 void iso_rx_hook_exit(struct iso_rx_context *);
@@ -23,195 +25,275 @@ struct iso_rx_context *iso_rxctx_dev(const struct net_device *dev) {
 #endif
 
 int iso_rx_init(struct iso_rx_context *context) {
-	int i;
+	int i, ret;
 
 	printk(KERN_INFO "perfiso: Init RX path for %s\n", context->netdev->name);
 	context->stats = alloc_percpu(struct iso_rx_stats);
 	if (context->stats == NULL)
 		return -1;
+	context->reasons = alloc_percpu(struct iso_reasons);
+	if (context->reasons == NULL) {
+		free_percpu(context->stats);
+		return -1;
+	}
 	context->last_stats_update_time = ktime_get();
 	context->last_rcp_time = ktime_get();
 
-	context->rcp_rate = ISO_VQ_DRAIN_RATE_MBPS;
+#ifndef QDISC
+	rtnl_lock();
+#endif
+	RCU_INIT_POINTER(context->params, NULL);
+	ret = iso_dev_params_refresh(&context->params, context->netdev);
+#ifndef QDISC
+	rtnl_unlock();
+#endif
+	if (ret) {
+		free_percpu(context->reasons);
+		free_percpu(context->stats);
+		return -1;
+	}
+
+	context->rcp_rate = rcu_dereference_protected(context->params, 1)->drain_rate;
 	context->rx_rate = 0;
 
 	for_each_possible_cpu(i) {
 		struct iso_rx_stats *st = per_cpu_ptr(context->stats, i);
 		memset(st, 0, sizeof(struct iso_rx_stats));
+		st->last_publish = context->last_stats_update_time;
 	}
 
+	iso_counter_init(&context->rx_bytes);
+	iso_counter_init(&context->rx_packets);
+
 	memset(&context->global_stats, 0, sizeof(struct iso_rx_stats));
 	memset(&context->global_stats_last, 0, sizeof(struct iso_rx_stats));
 
+	context->group = NULL;
+	INIT_LIST_HEAD(&context->group_list);
+
+	if (iso_feedback_init(context)) {
+		iso_dev_params_free(&context->params);
+		free_percpu(context->reasons);
+		free_percpu(context->stats);
+		return -1;
+	}
+
 	iso_vqs_init(context);
 	list_add_tail(&context->list, &rxctx_list);
-	return iso_rx_hook_init(context);
+
+	tasklet_init(&context->vq_tasklet, iso_rx_control, (unsigned long)context);
+	hrtimer_init(&context->vq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	context->vq_timer.function = iso_rx_control_timeout;
+
+	ret = iso_rx_hook_init(context);
+	if (ret)
+		return ret;
+
+	rcu_read_lock();
+	hrtimer_start(&context->vq_timer, ktime_set(0, iso_config()->vq_update_interval_us * 1000),
+		      HRTIMER_MODE_REL);
+	rcu_read_unlock();
+	return 0;
 }
 
 void iso_rx_exit(struct iso_rx_context *context) {
 	printk(KERN_INFO "perfiso: Exit RX path for %s\n", context->netdev->name);
 	list_del_init(&context->list);
+	hrtimer_cancel(&context->vq_timer);
+	tasklet_kill(&context->vq_tasklet);
+	iso_group_leave_rx(context);
 	iso_vqs_exit(context);
 	iso_rx_hook_exit(context);
+	iso_feedback_exit(context);
+	free_percpu(context->reasons);
 	free_percpu(context->stats);
+	iso_dev_params_free(&context->params);
 }
 
-void iso_rx_stats_update(struct iso_rx_context *rxctx, struct sk_buff *skb)
+/* Called with rxctx->vq_spinlock */
+static void iso_rx_stats_update(struct iso_rx_context *rxctx, ktime_t now)
 {
-	int cpu = smp_processor_id();
-	struct iso_rx_stats *rxstats = per_cpu_ptr(rxctx->stats, cpu);
-	u64 dt;
-	ktime_t now;
-	int i;
-	u64 rx_bytes;
-
-	rxstats->rx_bytes += skb_size(skb);
-	rxstats->rx_packets += 1;
-
-	now = ktime_get();
-	/* There are too many test-and-test-and-set things going on.
-	 * Abstract it out as light lock? */
-	dt = ktime_us_delta(now, rxctx->last_stats_update_time);
-	if (dt < ISO_VQ_UPDATE_INTERVAL_US)
-		return;
-
-	if (!spin_trylock(&rxctx->vq_spinlock))
-		return;
+	u64 dt, rx_bytes;
 
 	dt = ktime_us_delta(now, rxctx->last_stats_update_time);
-	if (dt < ISO_VQ_UPDATE_INTERVAL_US)
-		goto unlock;
+	if (unlikely(dt == 0))
+		return;
 
 	rxctx->last_stats_update_time = now;
 	rxctx->global_stats_last = rxctx->global_stats;
-	rxctx->global_stats.rx_bytes = 0;
-	rxctx->global_stats.rx_packets = 0;
-
-	/* Quickly sum everything up */
-	for_each_online_cpu(i) {
-		struct iso_rx_stats *st = per_cpu_ptr(rxctx->stats, i);
-		rxctx->global_stats.rx_bytes += st->rx_bytes;
-		rxctx->global_stats.rx_packets = st->rx_packets;
-	}
+	rxctx->global_stats.rx_bytes = iso_counter_read(&rxctx->rx_bytes);
+	rxctx->global_stats.rx_packets = iso_counter_read(&rxctx->rx_packets);
 
 	/* bits per us = mbps */
 	rx_bytes = (rxctx->global_stats.rx_bytes - rxctx->global_stats_last.rx_bytes);
 	rxctx->rx_rate = (rx_bytes << 3) / dt;
-
-unlock:
-	spin_unlock(&rxctx->vq_spinlock);
 }
 
-void iso_rx_rcp_update(struct iso_rx_context *rxctx)
+/* Called with rxctx->vq_spinlock */
+static void iso_rx_rcp_update(struct iso_rx_context *rxctx, const struct iso_config *cfg, ktime_t now)
 {
 	/* Based on rxctx->rx_rate, determine one advertised rate
 	 * rxctx->rcp_rate. */
-	ktime_t now = ktime_get();
-	u64 dt, rate;
-	u32 cap, cap2;
+	u64 dt, rate, cap, cap2, rx_rate;
 
 	dt = ktime_us_delta(now, rxctx->last_rcp_time);
-	if (dt < ISO_VQ_HRCP_US)
-		return;
-
-	if (!spin_trylock(&rxctx->vq_spinlock))
+	if (dt < cfg->vq_hrcp_us)
 		return;
 
-	dt = ktime_us_delta(now, rxctx->last_rcp_time);
-	if (dt < ISO_VQ_HRCP_US)
-		goto unlock;
-
-	cap = ISO_VQ_DRAIN_RATE_MBPS;
-	cap2 = ISO_VQ_DRAIN_RATE_MBPS << 1;
-	rate = (u64)rxctx->rcp_rate * (cap2 + cap - rxctx->rx_rate) / cap2;
-	rate = max_t(u64, ISO_MIN_RFAIR, rate);
-	rate = min_t(u64, ISO_VQ_DRAIN_RATE_MBPS, rate);
+	cap = iso_rxctx_params(rxctx)->drain_rate;
+	cap2 = cap << 1;
+	rx_rate = min_t(u64, rxctx->rx_rate, 3 * cap);
+	rate = rxctx->rcp_rate * (cap2 + cap - rx_rate) / cap2;
+	rate = max_t(u64, cfg->min_rfair, rate);
+	rate = min_t(u64, cap, rate);
 	rxctx->rcp_rate = rate;
 	rxctx->last_rcp_time = now;
+}
 
-unlock:
+/* Tasklet: one round of the rx control loop */
+void iso_rx_control(unsigned long _rxctx)
+{
+	struct iso_rx_context *rxctx = (struct iso_rx_context *)_rxctx;
+	struct iso_vq *vq;
+	ktime_t now = iso_clock_now();
+
+	rcu_read_lock();
+	spin_lock(&rxctx->vq_spinlock);
+
+	iso_rx_stats_update(rxctx, now);
+	iso_rx_rcp_update(rxctx, iso_config(), now);
+
+	list_for_each_entry_rcu(vq, &rxctx->vq_list, list) {
+		iso_vq_drain(vq, now);
+	}
+
+	rxctx->vq_last_update_time = now;
 	spin_unlock(&rxctx->vq_spinlock);
+
+	if(rxctx->group)
+		iso_group_tick(rxctx->group, now);
+	rcu_read_unlock();
+}
+
+enum hrtimer_restart iso_rx_control_timeout(struct hrtimer *timer)
+{
+	struct iso_rx_context *rxctx = container_of(timer, struct iso_rx_context, vq_timer);
+
+	/* Do the work in softirq context */
+	tasklet_schedule(&rxctx->vq_tasklet);
+	hrtimer_forward_now(timer, ktime_set(0, iso_config()->vq_update_interval_us * 1000));
+	return HRTIMER_RESTART;
+}
+
+/* Consume the options our senders add to IP headers.  Returns 1 if
+ * there were any, i.e., the sender runs perfiso. */
+static int iso_rx_options(struct iso_rx_context *rxctx, struct iso_tx_context *txctx,
+			  iso_class_t klass, struct sk_buff *skb, ktime_t now)
+{
+	struct iso_vq *vq;
+	int off, ours = 0;
+
+	if(!pskb_may_pull(skb, ip_hdr(skb)->ihl << 2))
+		return 0;
+
+	off = iso_ip_opt_find(skb, ISO_FEEDBACK_OPT_TYPE, ISO_FEEDBACK_OPT_LEN);
+	if(off > 0) {
+		ours = 1;
+		iso_feedback_opt_rx(txctx, klass, skb, off, now);
+		if(iso_ip_opt_strip(skb, off, ISO_FEEDBACK_OPT_LEN))
+			return ours;
+	}
+
+	off = iso_ip_opt_find(skb, ISO_DELAY_OPT_TYPE, ISO_DELAY_OPT_LEN);
+	if(off > 0) {
+		ours = 1;
+		vq = iso_vq_find(klass, rxctx);
+		if(vq != NULL)
+			iso_delay_rx(rxctx, vq, skb, off, now);
+		iso_ip_opt_strip(skb, off, ISO_DELAY_OPT_LEN);
+	}
+	return ours;
+}
+
+/*
+ * Does the sender of @skb run perfiso?  It does if it sent us
+ * feedback before, since that's when we create state towards it.
+ * Only called for CE marked packets, so the lookup is off the
+ * common path.
+ */
+static int iso_rx_from_peer(struct iso_tx_context *txctx, iso_class_t klass, struct sk_buff *skb) {
+	struct iso_tx_class *txc = iso_txc_find(klass, txctx);
+
+	return txc != NULL &&
+		iso_state_get_ip(txc, ntohl(ip_hdr(skb)->saddr), ISO_DONT_CREATE_RL) != NULL;
 }
 
 enum iso_verdict iso_rx(struct sk_buff *skb, const struct net_device *in, struct iso_rx_context *rxctx)
 {
 	struct iso_tx_class *txc;
 	iso_class_t klass;
-	struct iso_per_dest_state *state;
 	struct iso_vq *vq;
-	struct iso_vq_stats *stats;
-	enum iso_verdict verdict = ISO_VERDICT_SUCCESS;
+	enum iso_verdict verdict = ISO_VERDICT_SUCCESS, police;
 	struct iso_tx_context *txctx;
+	struct iso_rx_stats *rxstats;
+	const struct iso_config *cfg;
+	ktime_t now = iso_clock_now();
+	u32 segs, len = skb_size(skb);
+	cycles_t start;
+	int peer = 0;
 
 	rcu_read_lock();
-	iso_rx_stats_update(rxctx, skb);
-	iso_rx_rcp_update(rxctx);
+	cfg = iso_config();
+	start = iso_cost_start(cfg);
+	rxstats = per_cpu_ptr(rxctx->stats, smp_processor_id());
+	segs = skb_segs(skb);
+	rxstats->rx_bytes += skb_wire_size(skb, segs);
+	rxstats->rx_packets += segs;
+	if(iso_counter_due(&rxstats->last_publish, now, cfg->counter_publish_us)) {
+		iso_counter_publish(&rxctx->rx_bytes, rxstats->rx_bytes, &rxstats->published_bytes);
+		iso_counter_publish(&rxctx->rx_packets, rxstats->rx_packets, &rxstats->published_packets);
+	}
 
 	txctx = iso_txctx_dev(in);
 	/* Pick VQ */
 	klass = iso_rx_classify(skb);
+
+	/* Feedback or a timestamp may be riding in an IP option */
+	if(unlikely(iso_has_ip_options(skb)))
+		peer = iso_rx_options(rxctx, txctx, klass, skb, now);
 	vq = iso_vq_find(klass, rxctx);
 	if(vq == NULL)
 		goto accept;
 
-	iso_vq_enqueue(vq, skb);
-
-	txc = iso_txc_find(klass, txctx);
-	if(txc == NULL)
+	police = iso_vq_enqueue(vq, skb, now);
+	if(unlikely(police == ISO_VERDICT_DROP)) {
+		iso_reason_inc(rxctx->reasons, ISO_REASON_VQ_POLICED);
+		verdict = ISO_VERDICT_DROP;
 		goto accept;
-
-	/*
-	 * Warning: Legacy code.  We can do an optimisation here.  We
-	 * seem to be doing a state lookup for every single packet.
-	 * Instead, we can do state lookup only if there is feedback.
-	 * Not very important for now, but useful to fix this in the
-	 * future.
-	 */
-	state = iso_state_get(txc, skb, 1, ISO_CREATE_RL && iso_is_feedback_marked(skb));
-
-	if(likely(state != NULL)) {
-		int rate = skb_has_feedback(skb);
-		struct iso_rc_state *rc = &state->tx_rc;
-		ktime_t now = ktime_get();
-		/* XXX: for now */
-		if((ISO_VQ_DRAIN_RATE_MBPS <= ISO_MAX_TX_RATE) && (rate != 0)) {
-			u64 dt = ktime_us_delta(now, rc->last_rfair_change_time);
-			if(dt >= ISO_RFAIR_DECREASE_INTERVAL_US) {
-				if(spin_trylock(&rc->spinlock)) {
-					dt = ktime_us_delta(now, rc->last_rfair_change_time);
-					if(dt >= ISO_RFAIR_DECREASE_INTERVAL_US) {
-						state->rl->rate = rate;
-						state->rl->last_rate_update_time = now;
-						rc->last_rfair_change_time = now;
-					}
-					spin_unlock(&rc->spinlock);
-				}
-			}
-		}
-
-		if(unlikely(iso_is_generated_feedback(skb)))
-			verdict = ISO_VERDICT_DROP;
-
-		/* Clear the ECN mark before sending to stack */
-		iso_clear_ecn(skb);
 	}
 
-	stats = per_cpu_ptr(vq->percpu_stats, smp_processor_id());
-	if(IsoAutoGenerateFeedback && verdict != ISO_VERDICT_DROP) {
-		ktime_t now = ktime_get();
-		u64 dt = ktime_us_delta(ktime_get(), stats->last_feedback_gen_time);
-		stats->rx_since_last_feedback += skb_size(skb);
-
-		if((dt > ISO_FEEDBACK_INTERVAL_US) ||							\
-		   (stats->rx_since_last_feedback >= ISO_FEEDBACK_INTERVAL_BYTES)) {
-			iso_generate_feedback(iso_vq_over_limits(vq), skb);
-			stats->last_feedback_gen_time = now;
-			stats->rx_since_last_feedback = 0;
-			stats->network_marked = 0;
-		}
+	/* Feedback is for our sender side state, not the stack */
+	if(unlikely(iso_is_generated_feedback(skb))) {
+		txc = iso_txc_find(klass, txctx);
+		if(txc != NULL)
+			iso_feedback_rx(txc, skb, now);
+		verdict = ISO_VERDICT_DROP;
+		goto accept;
 	}
 
+	/* A CE mark is for us, not the stack, if the sender runs
+	 * perfiso: clear it back to ECT(0), unless the policer marked it for the stack
+	 * to see.  Other senders' transports may rely on ECN end to end,
+	 * so theirs is left alone. */
+	if(police == ISO_VERDICT_SUCCESS && iso_is_ce_set(skb) &&
+	   (peer || iso_rx_from_peer(txctx, klass, skb)))
+		iso_clear_ce(skb);
+
+	if(cfg->auto_generate_feedback)
+		iso_feedback_note(rxctx, vq, skb, now);
+
  accept:
+	iso_cost_end(cfg, ISO_COST_RX, start, 1, len);
 	rcu_read_unlock();
 	return verdict;
 }
@@ -1,16 +1,27 @@
 #ifndef __RX_H__
 #define __RX_H__
 
+#include <linux/jhash.h>
 #include "tx.h"
+#include "feedback.h"
 
+/* Monotonic, like struct iso_vq_stats */
+/* Per-cpu running totals; see counter.h */
 struct iso_rx_stats {
 	u64 rx_bytes;
 	u64 rx_packets;
+	u64 published_bytes;
+	u64 published_packets;
+	ktime_t last_publish;
 };
 
 struct iso_rx_context {
 	ktime_t vq_last_update_time;
 	spinlock_t vq_spinlock;
+	/* Periodic control loop: recomputes rx_rate, rcp_rate and
+	 * every VQ's rate each ISO_VQ_UPDATE_INTERVAL_US */
+	struct hrtimer vq_timer;
+	struct tasklet_struct vq_tasklet;
 	struct list_head vq_list;
 	struct hlist_head vq_bucket[ISO_MAX_VQ_BUCKETS];
 	atomic_t vq_active_rate;
@@ -20,12 +31,37 @@ struct iso_rx_context {
 
 	/* Hierarchical RCP state */
 	struct iso_rx_stats __percpu *stats;
+	struct iso_counter rx_bytes;
+	struct iso_counter rx_packets;
+	/* Drops and skipped updates; see reason.h */
+	struct iso_reasons __percpu *reasons;
 	struct iso_rx_stats global_stats;
 	struct iso_rx_stats global_stats_last;
 	ktime_t last_stats_update_time;
 	ktime_t last_rcp_time;
-	u32 rcp_rate;
-	u32 rx_rate;
+	u64 rcp_rate;
+	u64 rx_rate;
+
+	/* Rates for this device's link; see devparams.h */
+	struct iso_dev_params __rcu *params;
+
+	/* Host-wide group this device belongs to, if any */
+	struct iso_group *group;
+	struct list_head group_list;
+
+	/* See struct iso_tx_context */
+	int config_batch;
+	int recompute_pending;
+
+	/* Feedback header templates and skb pools */
+	struct iso_feedback_cpu __percpu *fbcache;
+	/* Feedback owed to each sender */
+	struct iso_feedback_peer_set *fbpeers;
+	/* Sequence number of the last feedback message we sent */
+	atomic_t fb_seq;
+	/* Random, nonzero; see ISO_FEEDBACK_VERSION */
+	u8 fb_epoch;
+	struct work_struct fb_refill;
 };
 
 struct iso_rx_context *iso_rxctx_dev(const struct net_device *dev);
@@ -37,8 +73,15 @@ extern struct iso_rx_context global_rxcontext;
 extern struct list_head rxctx_list;
 #define for_each_rx_context(rxctx) list_for_each_entry_safe(rxctx, rxctx_next, &rxctx_list, list)
 
+/* Under rcu_read_lock, or rtnl */
+static inline struct iso_dev_params *iso_rxctx_params(struct iso_rx_context *rxctx) {
+	return rcu_dereference_check(rxctx->params, rtnl_is_locked());
+}
+
 int iso_rx_init(struct iso_rx_context *);
 void iso_rx_exit(struct iso_rx_context *);
+void iso_rx_control(unsigned long);
+enum hrtimer_restart iso_rx_control_timeout(struct hrtimer *);
 
 enum iso_verdict iso_rx(struct sk_buff *skb, const struct net_device *out, struct iso_rx_context *rxctx);
 
@@ -46,75 +89,16 @@ static inline iso_class_t iso_rx_classify(struct sk_buff *);
 
 int iso_vq_install(char *, struct iso_rx_context *);
 
-static inline int iso_generate_feedback(int bit, struct sk_buff *pkt);
 static inline int iso_is_generated_feedback(struct sk_buff *);
 
 
-/* Create a feebdack packet and prepare for transmission.  Returns 1 if successful. */
-static inline int iso_generate_feedback(int bit, struct sk_buff *pkt) {
-	struct sk_buff *skb;
-	struct ethhdr *eth_to, *eth_from;
-	struct iphdr *iph_to, *iph_from;
-
-	eth_from = eth_hdr(pkt);
-	if(unlikely(eth_from->h_proto != __constant_htons(ETH_P_IP)))
-		return 0;
-
-	/* XXX: netdev_alloc_skb's meant to allocate packets for receiving.
-	 * Is it okay to use for transmitting?
-	 */
-	skb = netdev_alloc_skb(pkt->dev, ISO_FEEDBACK_PACKET_SIZE);
-	if(likely(skb)) {
-		skb_set_queue_mapping(skb, 0);
-		skb->len = ISO_FEEDBACK_PACKET_SIZE;
-		skb->protocol = __constant_htons(ETH_P_IP);
-		skb->pkt_type = PACKET_OUTGOING;
-
-		skb_reset_mac_header(skb);
-		skb_set_tail_pointer(skb, ISO_FEEDBACK_PACKET_SIZE);
-		eth_to = eth_hdr(skb);
-
-		memcpy(eth_to->h_source, eth_from->h_dest, ETH_ALEN);
-		memcpy(eth_to->h_dest, eth_from->h_source, ETH_ALEN);
-		eth_to->h_proto = eth_from->h_proto;
-
-		skb_pull(skb, ETH_HLEN);
-		skb_reset_network_header(skb);
-		iph_to = ip_hdr(skb);
-		iph_from = ip_hdr(pkt);
-
-		iph_to->ihl = 5;
-		iph_to->version = 4;
-		iph_to->tos = 0x2 | (bit ? ISO_ECN_REFLECT_MASK : 0);
-		iph_to->tot_len = __constant_htons(ISO_FEEDBACK_HEADER_SIZE);
-		iph_to->id = bit; //iph_from->id;
-		iph_to->frag_off = 0;
-		iph_to->ttl = ISO_FEEDBACK_PACKET_TTL;
-		iph_to->protocol = (u8)ISO_FEEDBACK_PACKET_IPPROTO;
-		iph_to->saddr = iph_from->daddr;
-		iph_to->daddr = iph_from->saddr;
-
-		/* NB: this function doesn't "send" the packet */
-		ip_send_check(iph_to);
-
-#if defined(QDISC) || defined(DIRECT)
-		skb_push(skb, ETH_HLEN);
-#endif
-		/* Driver owns the buffer now; we don't need to free it */
-		skb_xmit(skb);
-		return 1;
-	}
-
-	return 0;
-}
-
 static inline int iso_is_generated_feedback(struct sk_buff *skb) {
 	struct ethhdr *eth;
 	struct iphdr *iph;
 	eth = eth_hdr(skb);
 	if(likely(eth->h_proto == __constant_htons(ETH_P_IP))) {
 		iph = ip_hdr(skb);
-		if(unlikely(iph->protocol == ISO_FEEDBACK_PACKET_IPPROTO))
+		if(unlikely(iph->protocol == iso_config()->feedback_packet_ipproto))
 			return 1;
 	}
 	return 0;
@@ -126,12 +110,27 @@ static inline int iso_is_feedback_marked(struct sk_buff *skb) {
 	eth = eth_hdr(skb);
 	if(likely(eth->h_proto == __constant_htons(ETH_P_IP))) {
 		iph = ip_hdr(skb);
-		if(unlikely(iph->protocol == ISO_FEEDBACK_PACKET_IPPROTO))
+		if(unlikely(iph->protocol == iso_config()->feedback_packet_ipproto))
 			return (iph->id);
 	}
 	return 0;
 }
 
+static inline struct iso_feedback_peer_set *iso_feedback_set(struct iso_rx_context *rxctx, __be32 ip) {
+	return &rxctx->fbpeers[jhash_1word(ip, 0xfeedface) & (ISO_FEEDBACK_PEER_SETS - 1)];
+}
+
+static inline int iso_has_ip_options(struct sk_buff *skb) {
+	return eth_hdr(skb)->h_proto == __constant_htons(ETH_P_IP) && ip_hdr(skb)->ihl > 5;
+}
+
+/* CE only: ECT(0) and ECT(1) just say the transport does ECN */
+static inline int iso_is_ce_set(struct sk_buff *skb) {
+	if(likely(eth_hdr(skb)->h_proto == __constant_htons(ETH_P_IP)))
+		return INET_ECN_is_ce(ip_hdr(skb)->tos);
+	return 0;
+}
+
 #endif /* __RX_H__ */
 
 /* Local Variables: */
@@ -6,6 +6,7 @@
 #include "stats.h"
 #include "tx.h"
 #include "vq.h"
+#include "cost.h"
 
 extern char *iso_param_dev;
 
@@ -42,11 +43,17 @@ static int iso_stats_proc_seq_show(struct seq_file *s, void *v)
 	struct iso_vq *vq, *vq_next;
 	struct iso_tx_context *txctx, *txctx_next;
 	struct iso_rx_context *rxctx, *rxctx_next;
+	struct iso_dev_params *p;
+	struct iso_cost cost;
 	int i;
 
+	rcu_read_lock();
 	for_each_tx_context(txctx) {
-		seq_printf(s, "tx->dev %s, tx_rate %u, rate %u\n",
-			   txctx->netdev->name, txctx->tx_rate, txctx->rate);
+		p = iso_txctx_params(txctx);
+		seq_printf(s, "tx->dev %s, tx_rate %llu, rate %llu, link %u, max_rate %llu\n",
+			   txctx->netdev->name, txctx->tx_rate, txctx->rate,
+			   p->link_speed, p->max_tx_rate);
+		iso_reason_show(txctx->reasons, "tx drops", s);
 
 		for(i = 0; i < ISO_MAX_TX_BUCKETS; i++) {
 			head = &txctx->iso_tx_bucket[i];
@@ -57,17 +64,30 @@ static int iso_stats_proc_seq_show(struct seq_file *s, void *v)
 	}
 
 	for_each_rx_context(rxctx) {
-		seq_printf(s, "\nvqs->dev %s   last_update %llx   active_rate %d   rx_rate %d   rcp_rate %d\n",
+		seq_printf(s, "\nvqs->dev %s   last_update %llx   active_rate %d   rx_rate %llu   rcp_rate %llu   drain_rate %llu\n",
 			   rxctx->netdev->name,
 			   rxctx->vq_last_update_time.tv64,
 			   atomic_read(&rxctx->vq_active_rate),
 			   rxctx->rx_rate,
-			   rxctx->rcp_rate);
+			   rxctx->rcp_rate,
+			   iso_rxctx_params(rxctx)->drain_rate);
+		iso_reason_show(rxctx->reasons, "rx drops", s);
 
 		for_each_vq(vq, rxctx) {
 			iso_vq_show(vq, s);
 		}
 	}
+	rcu_read_unlock();
+
+	seq_printf(s, "\ncpu cost (ISO_CPU_ACCOUNTING %d)\n", ISO_CPU_ACCOUNTING);
+	for(i = 0; i < ISO_COST_MAX; i++) {
+		iso_cost_read(i, &cost);
+		seq_printf(s, "cost %s   calls %llu   packets %llu   bytes %llu   cycles %llu"
+			   "   cycles/pkt %llu   cycles/100B %llu\n",
+			   iso_cost_names[i], cost.calls, cost.packets, cost.bytes, cost.cycles,
+			   cost.packets ? div64_u64(cost.cycles, cost.packets) : 0,
+			   cost.bytes ? div64_u64(cost.cycles * 100, cost.bytes) : 0);
+	}
 
 	return 0;
 }
@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# Exercise the delay signal on one machine.  EyeQ looks devices up in
+# the initial namespace, so both ends live there: traffic from $src on
+# eq0 crosses a router namespace that adds $delay each way, and comes
+# back in on eq1 to $dst.  Policy routing keeps the kernel from
+# delivering it locally.
+#
+#   eq0 ($src) -- eq0r [router, netem] eq1r -- eq1 ($dst)
+
+dir=/sys/module/perfiso/parameters
+ns=eyeq-router
+src=10.9.1.1
+dst=10.9.2.1
+delay=${1:-1ms}
+time=${2:-20}
+
+cleanup() {
+	killall -q iperf
+	ip netns del $ns 2>/dev/null
+	ip link del eq0 2>/dev/null
+	ip link del eq1 2>/dev/null
+	ip rule del pref 10 2>/dev/null
+	ip rule del pref 10 2>/dev/null
+	ip rule add pref 0 lookup local 2>/dev/null
+	ip rule del pref 100 2>/dev/null
+	ip route flush table 100 2>/dev/null
+	rmmod perfiso 2>/dev/null
+}
+
+cleanup
+trap cleanup EXIT
+
+ip netns add $ns
+ip link add eq0 type veth peer name eq0r
+ip link add eq1 type veth peer name eq1r
+ip link set eq0r netns $ns
+ip link set eq1r netns $ns
+
+ip addr add $src/24 dev eq0
+ip addr add $dst/24 dev eq1
+ip link set eq0 up
+ip link set eq1 up
+ip netns exec $ns ip addr add 10.9.1.2/24 dev eq0r
+ip netns exec $ns ip addr add 10.9.2.2/24 dev eq1r
+ip netns exec $ns ip link set eq0r up
+ip netns exec $ns ip link set eq1r up
+ip netns exec $ns sysctl -qw net.ipv4.ip_forward=1
+ip netns exec $ns tc qdisc add dev eq0r root netem delay $delay
+ip netns exec $ns tc qdisc add dev eq1r root netem delay $delay
+
+# Send to our own addresses over the wire
+for dev in all eq0 eq1; do
+	sysctl -qw net.ipv4.conf.$dev.accept_local=1
+	sysctl -qw net.ipv4.conf.$dev.rp_filter=0
+done
+ip rule add pref 100 lookup local
+ip rule del pref 0
+ip rule add pref 10 iif lo to $dst lookup 100
+ip rule add pref 10 iif lo to $src lookup 100
+ip route add $dst via 10.9.1.2 dev eq0 src $src table 100
+ip route add $src via 10.9.2.2 dev eq1 src $dst table 100
+
+insmod ./perfiso.ko || exit 1
+tc qdisc add dev eq0 root handle 1: htb
+tc qdisc add dev eq1 root handle 1: htb
+
+echo dev eq0 $src > $dir/create_txc
+echo dev eq1 $dst > $dir/create_vq
+echo dev eq1 $dst cc timely > $dir/set_vq_cc
+# Only packets that aren't GSO get stamped
+ethtool -K eq0 tso off gso off
+echo 1 > /proc/sys/perfiso/ISO_DELAY_SIGNAL
+
+iperf -s -B $dst > /dev/null &
+sleep 1
+iperf -c $dst -B $src -t $time -P 4
+grep -A3 "vq class" /proc/perfiso_stats
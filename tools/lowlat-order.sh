@@ -0,0 +1,87 @@
+#!/bin/bash
+
+# Check that low latency packets never overtake packets of their own
+# class still queued higher up a hierarchy.  $vm is low latency under
+# $tenant, whose rate is held low so the tenant's limiter backs up
+# while $vm sends bulk and ping traffic.  Every perfiso_lowlat_bypass
+# must find, on its cpu, the queues of both classes empty as the rl
+# enqueue/dequeue tracepoints last reported them.
+#
+#   eq0 ($vm) -- eq0p [namespace] ($dst)
+
+dir=/sys/module/perfiso/parameters
+tracing=/sys/kernel/debug/tracing
+ns=eyeq-peer
+tenant=10.9.0.1
+vm=10.9.1.1
+dst=10.9.1.2
+time=${1:-10}
+
+cleanup() {
+	killall -q iperf ping
+	echo 0 > $tracing/events/perfiso/enable
+	ip netns del $ns 2>/dev/null
+	ip link del eq0 2>/dev/null
+	rmmod perfiso 2>/dev/null
+}
+
+cleanup
+trap cleanup EXIT
+
+ip netns add $ns
+ip link add eq0 type veth peer name eq0p
+ip link set eq0p netns $ns
+ip addr add $vm/24 dev eq0
+ip link set eq0 up
+ip netns exec $ns ip addr add $dst/24 dev eq0p
+ip netns exec $ns ip link set eq0p up
+
+insmod ./perfiso.ko || exit 1
+tc qdisc add dev eq0 root handle 1: htb
+
+for ip in $tenant $vm; do
+	echo dev eq0 $ip > $dir/create_txc
+done
+echo dev eq0 $vm parent $tenant > $dir/set_txc_parent
+echo dev eq0 $tenant rate 100 > $dir/set_txc_rate
+echo dev eq0 $vm lowlat 1 > $dir/set_txc_lowlat
+
+echo > $tracing/trace
+for e in perfiso_rl_enqueue perfiso_rl_dequeue perfiso_lowlat_bypass; do
+	echo 1 > $tracing/events/perfiso/$e/enable
+done
+
+ip netns exec $ns iperf -s > /dev/null &
+sleep 1
+iperf -c $dst -B $vm -t $time -P 4 > /dev/null &
+ping -q -i 0.01 -c $((time * 100)) -I $vm $dst > /dev/null
+
+echo 0 > $tracing/events/perfiso/enable
+
+# queued[class,dst,cpu] is the backlog after the latest event
+awk -v tenant=$tenant -v vm=$vm '
+function field(name,   i) {
+	for(i = 1; i < NF; i++)
+		if($i == name)
+			return $(i + 1);
+	return "";
+}
+/perfiso_rl_(en|de)queue:/ {
+	queued[field("class") "," field("dst") "," field("cpu")] = field("queued");
+}
+/perfiso_lowlat_bypass:/ {
+	bypass++;
+	cpu = field("cpu");
+	for(k in queued) {
+		split(k, f, ",");
+		if((f[1] == vm || f[1] == tenant) && f[3] == cpu && queued[k] > 0) {
+			print "reordered: " $0 " with " k " holding " queued[k];
+			bad++;
+			break;
+		}
+	}
+}
+END {
+	printf("%d bypasses, %d reordered\n", bypass, bad);
+	exit(bad > 0);
+}' $tracing/trace
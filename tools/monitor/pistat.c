@@ -0,0 +1,283 @@
+/*
+ * Poll perfiso's stats over generic netlink and print per-class
+ * rates.  Unlike pimonitor, which parses /proc/csv_perfiso_stats,
+ * each sample is one dump of fixed-size records; nothing is parsed
+ * or allocated per sample once the tables have grown.
+ *
+ * Usage: pistat [interval_us] [dest] [qdelay] [cost] [reasons]
+ * Prints time,dev,kind,class,rate_mbps for each txc and vq (and,
+ * with "dest", each per-destination limiter as class/dst).  With
+ * "qdelay", txc lines also get the p50, p99 and p999 queueing delay
+ * in us, over the interval; this needs CAP_NET_ADMIN, and two pistats
+ * asking for qdelay at once split the samples between them.  With "cost", each datapath
+ * path gets a line with its cycles per packet and per byte over the
+ * interval in place of the rate (see ISO_CPU_ACCOUNTING).  With
+ * "reasons", device and txc lines end with reason=count for each drop
+ * or skipped update that happened during the interval.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include "../../perfiso_nl.h"
+
+#define BUFSIZE (64 * 1024)
+
+static int sock;
+static int family;
+static unsigned flags;
+static unsigned seq;
+static char buf[BUFSIZE];
+
+struct sample {
+	struct perfiso_stats_rec *recs;
+	int n, size;
+};
+
+static struct sample db[2];
+
+static void die(const char *msg) {
+	perror(msg);
+	exit(1);
+}
+
+static void add_attr(struct nlmsghdr *nlh, int type, const void *data, int len) {
+	struct nlattr *nla = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy((char *)nla + NLA_HDRLEN, data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+static void send_request(int type, int cmd, int flags, int attr, const void *data, int len) {
+	char req[256];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)req;
+	struct genlmsghdr *genl = NLMSG_DATA(nlh);
+
+	memset(req, 0, sizeof(req));
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_seq = ++seq;
+	genl->cmd = cmd;
+	genl->version = 1;
+	add_attr(nlh, attr, data, len);
+
+	if(send(sock, req, nlh->nlmsg_len, 0) < 0)
+		die("send");
+}
+
+/* Call @fn on each attribute of every reply to the last request,
+ * until the dump or the ack ends it.  Returns the -errno of the ack,
+ * or of the dump's end. */
+static int recv_replies(void (*fn)(struct nlattr *, void *), void *arg) {
+	struct nlmsghdr *nlh;
+	struct nlattr *nla;
+	int len, rem;
+
+	while(1) {
+		len = recv(sock, buf, sizeof(buf), 0);
+		if(len < 0)
+			die("recv");
+
+		for(nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if(nlh->nlmsg_seq != seq)
+				continue;
+			if(nlh->nlmsg_type == NLMSG_DONE)
+				return nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(int)) ?
+					*(int *)NLMSG_DATA(nlh) : 0;
+			if(nlh->nlmsg_type == NLMSG_ERROR)
+				return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+
+			rem = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+			nla = (struct nlattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+			while(rem >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= rem) {
+				fn(nla, arg);
+				rem -= NLA_ALIGN(nla->nla_len);
+				nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+			}
+		}
+	}
+}
+
+static void family_id(struct nlattr *nla, void *arg) {
+	if(nla->nla_type == CTRL_ATTR_FAMILY_ID)
+		*(int *)arg = *(unsigned short *)((char *)nla + NLA_HDRLEN);
+}
+
+static void add_rec(struct nlattr *nla, void *arg) {
+	struct sample *s = arg;
+
+	if(nla->nla_type != PERFISO_ATTR_STATS_REC ||
+	   nla->nla_len < NLA_HDRLEN + sizeof(struct perfiso_stats_rec))
+		return;
+
+	if(s->n == s->size) {
+		s->size = s->size ? 2 * s->size : 1024;
+		s->recs = realloc(s->recs, s->size * sizeof(*s->recs));
+		if(s->recs == NULL)
+			die("realloc");
+	}
+	memcpy(&s->recs[s->n++], (char *)nla + NLA_HDRLEN, sizeof(struct perfiso_stats_rec));
+}
+
+static void read_data(int i) {
+	db[i].n = 0;
+	send_request(family, PERFISO_CMD_GET_STATS, NLM_F_DUMP,
+		     PERFISO_ATTR_STATS_FLAGS, &flags, sizeof(flags));
+	errno = -recv_replies(add_rec, &db[i]);
+	if(errno)
+		die("stats dump");
+}
+
+static int same(struct perfiso_stats_rec *a, struct perfiso_stats_rec *b) {
+	return a->type == b->type && a->ifindex == b->ifindex &&
+		a->dst == b->dst && memcmp(a->klass, b->klass, sizeof(a->klass)) == 0;
+}
+
+/* Records usually come back in the same order, so try the same slot
+ * first */
+static struct perfiso_stats_rec *find_prev(struct sample *prev, int i, struct perfiso_stats_rec *r) {
+	int j;
+
+	if(i < prev->n && same(&prev->recs[i], r))
+		return &prev->recs[i];
+
+	for(j = 0; j < prev->n; j++) {
+		if(same(&prev->recs[j], r))
+			return &prev->recs[j];
+	}
+	return NULL;
+}
+
+static inline double gtod(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return ((double)tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void print_reasons(struct perfiso_stats_rec *r, struct perfiso_stats_rec *p) {
+	static const char *names[PERFISO_REASON_MAX] = {
+		[PERFISO_REASON_RL_QUEUE_FULL] = "queue_full",
+		[PERFISO_REASON_RL_TRIMMED] = "trimmed",
+		[PERFISO_REASON_RL_GSO_ERROR] = "gso_error",
+		[PERFISO_REASON_RL_SEGMENT] = "segment",
+		[PERFISO_REASON_RL_BORROW_BUSY] = "borrow_busy",
+		[PERFISO_REASON_TXQ_STOPPED] = "txq_stopped",
+		[PERFISO_REASON_TX_DROP] = "tx_drop",
+		[PERFISO_REASON_TXC_TICK_BUSY] = "tick_busy",
+		[PERFISO_REASON_VQ_POLICED] = "policed",
+		[PERFISO_REASON_FB_PEER_BUSY] = "peer_busy",
+		[PERFISO_REASON_FB_PEER_EVICT] = "peer_evict",
+		[PERFISO_REASON_RC_LOCK_BUSY] = "rc_busy",
+	};
+	int i;
+
+	for(i = 0; i < PERFISO_REASON_MAX; i++) {
+		if(r->reasons[i] != p->reasons[i])
+			printf(",%s=%llu", names[i], r->reasons[i] - p->reasons[i]);
+	}
+}
+
+static void print_data(int curr) {
+	static const char *kind[] = {
+		[PERFISO_REC_TXDEV] = "tx", [PERFISO_REC_TXC] = "txc",
+		[PERFISO_REC_RL] = "rl", [PERFISO_REC_RXDEV] = "rx",
+		[PERFISO_REC_VQ] = "vq", [PERFISO_REC_COST] = "cost",
+	};
+	struct sample *s = &db[curr], *prev = &db[curr ^ 1];
+	struct perfiso_stats_rec *r, *p;
+	char dev[IF_NAMESIZE], dst[INET_ADDRSTRLEN];
+	double now = gtod(), us;
+	unsigned long long cycles;
+	int i;
+
+	for(i = 0; i < s->n; i++) {
+		r = &s->recs[i];
+		p = find_prev(prev, i, r);
+		if(p == NULL || r->tstamp_ns <= p->tstamp_ns || r->type > PERFISO_REC_COST)
+			continue;
+
+		us = (r->tstamp_ns - p->tstamp_ns) / 1e3;
+		if(if_indextoname(r->ifindex, dev) == NULL)
+			sprintf(dev, "%u", r->ifindex);
+
+		printf("%.6f,%s,%s,%s", now, dev, kind[r->type], r->klass);
+		if(r->type == PERFISO_REC_RL)
+			printf("/%s", inet_ntop(AF_INET, &r->dst, dst, sizeof(dst)));
+		if(r->type == PERFISO_REC_COST) {
+			cycles = r->cycles - p->cycles;
+			printf(",%.1lf,%.3lf\n",
+			       r->packets > p->packets ? (double)cycles / (r->packets - p->packets) : 0.0,
+			       r->bytes > p->bytes ? (double)cycles / (r->bytes - p->bytes) : 0.0);
+			continue;
+		}
+		/* bits/us = Mbps */
+		printf(",%.3lf", (r->bytes - p->bytes) * 8.0 / us);
+		if(r->type == PERFISO_REC_TXC && (flags & PERFISO_STATS_F_QDELAY))
+			printf(",%.1lf,%.1lf,%.1lf", r->qdelay_p50_ns / 1e3,
+			       r->qdelay_p99_ns / 1e3, r->qdelay_p999_ns / 1e3);
+		if(flags & PERFISO_STATS_F_REASONS)
+			print_reasons(r, p);
+		printf("\n");
+	}
+
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	struct sockaddr_nl addr;
+	int interval_us = 100 * 1000;
+	int i;
+
+	if(argc > 1) {
+		interval_us = atoi(argv[1]);
+		if(interval_us < 1000)
+			interval_us = 1000;
+	}
+	for(i = 2; i < argc; i++) {
+		if(strcmp(argv[i], "dest") == 0)
+			flags |= PERFISO_STATS_F_DEST;
+		else if(strcmp(argv[i], "qdelay") == 0)
+			flags |= PERFISO_STATS_F_QDELAY;
+		else if(strcmp(argv[i], "cost") == 0)
+			flags |= PERFISO_STATS_F_COST;
+		else if(strcmp(argv[i], "reasons") == 0)
+			flags |= PERFISO_STATS_F_REASONS;
+	}
+
+	sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if(sock < 0)
+		die("socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("bind");
+
+	send_request(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, NLM_F_ACK, CTRL_ATTR_FAMILY_NAME,
+		     PERFISO_GENL_NAME, strlen(PERFISO_GENL_NAME) + 1);
+	if(recv_replies(family_id, &family) || family == 0) {
+		fprintf(stderr, "perfiso netlink family not found; is the module loaded?\n");
+		return 1;
+	}
+
+	printf("#time,dev,kind,class,rate\n");
+	i = 0;
+	read_data(i++);
+	while(1) {
+		usleep(interval_us);
+		read_data(i);
+		print_data(i);
+		i = (i + 1) & 1;
+	}
+
+	return 0;
+}
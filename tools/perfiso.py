@@ -8,6 +8,8 @@ from subprocess import Popen
 from collections import defaultdict, namedtuple
 import logging
 import json
+import socket
+import struct
 
 re_digits = re.compile(r'\d+')
 re_spaces = re.compile(r'\s+')
@@ -125,6 +127,11 @@ class TxClass:
     def clear_rate(self, dev, klass):
         self.set_rate(dev, klass, 0)
 
+    def set_parent(self, dev, klass, parent):
+        c = "echo dev %s %s parent %s > %s/set_txc_parent" % (dev, klass, parent, ISO_SYSFS)
+        logging.info("Setting parent of txc %s on dev %s to %s" % (klass, dev, parent))
+        return cmd(c)
+
     def associate(self, dev, klass, vq):
         c = "echo dev %s associate txc %s vq %s > %s/assoc_txc_vq" % (dev, klass, vq, ISO_SYSFS)
         return cmd(c)
@@ -146,6 +153,9 @@ class TxClass:
                 weight = val['weight']
                 vq = val['assoc']
                 self.create(dev, klass)
+                # Parents must be listed before their children
+                if val.get('parent'):
+                    self.set_parent(dev, klass, val['parent'])
                 self.set_weight(dev, klass, weight)
                 self.associate(dev, klass, vq)
                 logging.info("Created TXC %s weight %s on dev %s assoc %s" % (klass, weight, dev, vq))
@@ -183,6 +193,15 @@ class VQ:
         c = "echo dev %s %s rate %s > %s/set_vq_rate" % (dev, klass, rate, ISO_SYSFS)
         return cmd(c)
 
+    def set_cc(self, dev, klass, cc):
+        c = "echo dev %s %s cc %s > %s/set_vq_cc" % (dev, klass, cc, ISO_SYSFS)
+        logging.info("Setting cc of vq %s on dev %s to %s" % (klass, dev, cc))
+        return cmd(c)
+
+    def set_police(self, dev, klass, police):
+        c = "echo dev %s %s police %s > %s/set_vq_police" % (dev, klass, police, ISO_SYSFS)
+        return cmd(c)
+
     def clear_rate(self, dev, klass):
         self.set_rate(dev, klass, 0)
 
@@ -205,6 +224,122 @@ class VQ:
                 self.set_weight(dev, klass, weight)
                 logging.info("Created VQ %s weight %s on dev %s" % (klass, weight, dev))
 
+class Netlink:
+    """Batched txc/vq configuration through the perfiso generic
+    netlink family.  The numbers mirror ../perfiso_nl.h."""
+    NETLINK_GENERIC = 16
+    GENL_ID_CTRL = 0x10
+    CTRL_CMD_GETFAMILY = 3
+    CTRL_ATTR_FAMILY_ID = 1
+    CTRL_ATTR_FAMILY_NAME = 2
+    NLM_F_REQUEST = 1
+    NLM_F_ACK = 4
+    NLMSG_ERROR = 2
+    NLA_F_NESTED = 1 << 15
+
+    CMD_BATCH = 1
+    ATTR_OPS = 1
+    ATTR_OP = 2
+    OP_ATTR_TYPE, OP_ATTR_DEV, OP_ATTR_CLASS, OP_ATTR_VQ, OP_ATTR_WEIGHT = range(1, 6)
+    OP_CREATE_TXC, OP_CREATE_VQ, OP_ASSOC_TXC_VQ, OP_SET_TXC_WEIGHT, OP_SET_VQ_WEIGHT = range(1, 6)
+    BATCH_MAX_OPS = 1024
+    # nla_len is 16 bits, so the PERFISO_ATTR_OPS nest must stay below 64k
+    BATCH_MAX_BYTES = 60000
+
+    def __init__(self):
+        self.seq = 0
+        self.family = None
+        try:
+            self.sock = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, self.NETLINK_GENERIC)
+            self.sock.bind((0, 0))
+            self.family = self.resolve('perfiso')
+        except socket.error:
+            pass
+
+    def attr(self, type, data):
+        n = 4 + len(data)
+        return struct.pack('HH', n, type) + data + '\0' * ((4 - n % 4) % 4)
+
+    def attr_str(self, type, s):
+        return self.attr(type, str(s) + '\0')
+
+    def attr_u32(self, type, v):
+        return self.attr(type, struct.pack('I', int(v)))
+
+    def nest(self, type, attrs):
+        return self.attr(type | self.NLA_F_NESTED, ''.join(attrs))
+
+    def parse(self, data):
+        attrs = {}
+        off = 0
+        while off + 4 <= len(data):
+            n, type = struct.unpack('HH', data[off:off+4])
+            if n < 4:
+                break
+            attrs[type & ~self.NLA_F_NESTED] = data[off+4:off+n]
+            off += (n + 3) & ~3
+        return attrs
+
+    def request(self, type, cmd, attrs):
+        """Send one request and wait for its ack.  Returns (errno,
+        attributes of the reply, if there was one)."""
+        self.seq += 1
+        payload = struct.pack('BBH', cmd, 1, 0) + ''.join(attrs)
+        hdr = struct.pack('IHHII', 16 + len(payload), type,
+                          self.NLM_F_REQUEST | self.NLM_F_ACK, self.seq, 0)
+        self.sock.send(hdr + payload)
+        attrs = {}
+        while True:
+            data = self.sock.recv(65536)
+            off = 0
+            while off + 16 <= len(data):
+                n, type, flags, seq, pid = struct.unpack('IHHII', data[off:off+16])
+                if n < 16:
+                    break
+                if seq == self.seq:
+                    if type == self.NLMSG_ERROR:
+                        err, = struct.unpack('i', data[off+16:off+20])
+                        return -err, attrs
+                    # skip the genlmsghdr
+                    attrs = self.parse(data[off+20:off+n])
+                off += (n + 3) & ~3
+
+    def resolve(self, name):
+        err, attrs = self.request(self.GENL_ID_CTRL, self.CTRL_CMD_GETFAMILY,
+                                  [self.attr_str(self.CTRL_ATTR_FAMILY_NAME, name)])
+        if err or self.CTRL_ATTR_FAMILY_ID not in attrs:
+            return None
+        return struct.unpack('H', attrs[self.CTRL_ATTR_FAMILY_ID][:2])[0]
+
+    def op(self, type, dev, klass, vq=None, weight=None):
+        attrs = [self.attr_u32(self.OP_ATTR_TYPE, type),
+                 self.attr_str(self.OP_ATTR_DEV, dev),
+                 self.attr_str(self.OP_ATTR_CLASS, klass)]
+        if vq is not None:
+            attrs.append(self.attr_str(self.OP_ATTR_VQ, vq))
+        if weight is not None:
+            attrs.append(self.attr_u32(self.OP_ATTR_WEIGHT, weight))
+        return self.nest(self.ATTR_OP, attrs)
+
+    def send_batch(self, ops):
+        err, _ = self.request(self.family, self.CMD_BATCH,
+                              [self.nest(self.ATTR_OPS, ops)])
+        if err:
+            die("netlink batch failed: %s (dmesg has the op)" % os.strerror(err))
+
+    def batch(self, ops):
+        """Apply @ops in order, in as few requests as the kernel takes.
+        Later ops may refer to classes created by earlier ones."""
+        chunk, size = [], 0
+        for op in ops:
+            if len(chunk) == self.BATCH_MAX_OPS or size + len(op) > self.BATCH_MAX_BYTES:
+                self.send_batch(chunk)
+                chunk, size = [], 0
+            chunk.append(op)
+            size += len(op)
+        if chunk:
+            self.send_batch(chunk)
+
 def get(args):
     print params.__str__()
 
@@ -239,12 +374,44 @@ def save(args):
     json.dump(config, where, indent=4)
     where.close()
 
+def load_config_netlink(config):
+    """Create and configure all vqs and txcs with netlink batches.
+    Returns False if the caller should fall back to sysfs."""
+    devs = config.get('config', {})
+    for dev in devs.keys():
+        # Parents are only settable through sysfs
+        for val in devs[dev]['txcs']:
+            if val.get('parent'):
+                return False
+        install(dev)
+    nl = Netlink()
+    if nl.family is None:
+        return False
+
+    ops = []
+    for dev in devs.keys():
+        for val in devs[dev]['vqs']:
+            klass = val['klass']
+            if klass not in vqs.vqs_dev[dev]:
+                ops.append(nl.op(Netlink.OP_CREATE_VQ, dev, klass))
+            ops.append(nl.op(Netlink.OP_SET_VQ_WEIGHT, dev, klass, weight=val['weight']))
+        for val in devs[dev]['txcs']:
+            klass = val['klass']
+            if klass not in txc.txcs_dev[dev]:
+                ops.append(nl.op(Netlink.OP_CREATE_TXC, dev, klass))
+            ops.append(nl.op(Netlink.OP_SET_TXC_WEIGHT, dev, klass, weight=val['weight']))
+            ops.append(nl.op(Netlink.OP_ASSOC_TXC_VQ, dev, klass, vq=val['assoc']))
+    nl.batch(ops)
+    logging.info("Loaded %d netlink ops" % len(ops))
+    return True
+
 def load_config(args):
     global config
     config = json.load(open(args.load))
     params.load(config.get('params'))
-    vqs.load(config)
-    txc.load(config)
+    if not load_config_netlink(config):
+        vqs.load(config)
+        txc.load(config)
 
 def clear():
     global params, txc, vqs, ISO_CREATED, ISO_INSMOD
@@ -299,7 +466,7 @@ def stats(filterdev=None):
             keys = ['klass', 'min_rate', 'rate', 'tx_rate', 'assoc']
             return Data.str(self, 'TXC', keys)
         def get(self):
-            keys = ['klass', 'weight', 'assoc']
+            keys = ['klass', 'weight', 'assoc', 'parent']
             return self.getdict(keys)
     class Vq(Data):
         def __str__(self):
@@ -346,7 +513,11 @@ def stats(filterdev=None):
             klass = data[2]
             weight = data[4]
             assoc = data[7]
-            txc = Txc(klass=klass, rls=[], rate='', tx_rate='', min_rate='', weight=weight, assoc=assoc)
+            parent = data[11]
+            if parent == '(none)':
+                parent = None
+            txc = Txc(klass=klass, rls=[], rate='', tx_rate='', min_rate='', weight=weight, assoc=assoc,
+                      parent=parent)
             rl_parse = False
         if line.startswith('txc rl'):
             data = re_spaces.split(line)
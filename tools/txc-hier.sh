@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# The EyeQ equivalent of tc-htb.sh: a tenant with a 10G guarantee,
+# split 1:2 between two of its VMs.  Parents must be created before
+# their children.
+
+dir=/sys/module/perfiso/parameters
+dev=eth2
+
+tenant=11.0.0.1
+vm1=11.0.1.1
+vm2=11.0.1.2
+
+for ip in $tenant $vm1 $vm2; do
+    echo dev $dev $ip > $dir/create_txc
+done
+
+echo dev $dev $vm1 parent $tenant > $dir/set_txc_parent
+echo dev $dev $vm2 parent $tenant > $dir/set_txc_parent
+
+echo dev $dev $vm1 weight 1 > $dir/set_txc_weight
+echo dev $dev $vm2 weight 2 > $dir/set_txc_weight
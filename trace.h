@@ -0,0 +1,287 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM perfiso
+
+#if !defined(__PERFISO_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __PERFISO_TRACE_H__
+
+/*
+ * Static tracepoints, for perf and bpftrace:
+ *   perf record -e 'perfiso:*' -a
+ *   bpftrace -e 'tracepoint:perfiso:perfiso_rl_enqueue /args->reason/ { @[args->reason] = count(); }'
+ * Disabled tracepoints cost a patched-out branch; the fields are
+ * only filled in when one is enabled.  Classes are recorded as
+ * iso_class_show() prints them, rates are Mb/s and addresses are in
+ * network order.
+ */
+#include <linux/tracepoint.h>
+#include "tx.h"
+#include "vq.h"
+#include "feedback.h"
+
+#define ISO_TRACE_CLASS_LEN (32)
+
+#define iso_trace_rl_reasons					\
+	{ ISO_RL_ENQUEUED,		"enqueued" },		\
+	{ ISO_RL_TRIMMED,		"trimmed" },		\
+	{ ISO_RL_DROP_QUEUE_FULL,	"queue_full" },		\
+	{ ISO_RL_DROP_GSO_ERROR,	"gso_error" },		\
+	{ ISO_RL_DROP_SEGMENT,		"segment_queue_full" }
+
+TRACE_EVENT(perfiso_rl_enqueue,
+	TP_PROTO(struct iso_rl *rl, struct iso_rl_queue *q, u32 bytes,
+		 enum iso_rl_reason reason),
+	TP_ARGS(rl, q, bytes, reason),
+
+	TP_STRUCT__entry(
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(u32, dst)
+		__field(u32, bytes)
+		__field(u64, rate)
+		__field(u64, queued)
+		__field(int, cpu)
+		__field(int, reason)
+	),
+
+	TP_fast_assign(
+		iso_class_show(iso_rl_txc(rl)->klass, __entry->klass);
+		__entry->dst = rl->ip;
+		__entry->bytes = bytes;
+		__entry->rate = rl->rate;
+		__entry->queued = q->bytes_enqueued;
+		__entry->cpu = q->cpu;
+		__entry->reason = reason;
+	),
+
+	TP_printk("class %s dst %pI4 bytes %u rate %llu queued %llu cpu %d %s",
+		  __entry->klass, &__entry->dst, __entry->bytes, __entry->rate,
+		  __entry->queued, __entry->cpu,
+		  __print_symbolic(__entry->reason, iso_trace_rl_reasons))
+);
+
+TRACE_EVENT(perfiso_rl_dequeue,
+	TP_PROTO(struct iso_rl *rl, struct iso_rl_queue *q, u32 bytes),
+	TP_ARGS(rl, q, bytes),
+
+	TP_STRUCT__entry(
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(u32, dst)
+		__field(u32, bytes)
+		__field(u64, rate)
+		__field(u64, queued)
+		__field(u64, tokens)
+		__field(int, cpu)
+		__field(int, to_parent)
+	),
+
+	TP_fast_assign(
+		iso_class_show(iso_rl_txc(rl)->klass, __entry->klass);
+		__entry->dst = rl->ip;
+		__entry->bytes = bytes;
+		__entry->rate = rl->rate;
+		__entry->queued = q->bytes_enqueued;
+		__entry->tokens = q->tokens;
+		__entry->cpu = q->cpu;
+		__entry->to_parent = rl->parent != NULL;
+	),
+
+	TP_printk("class %s dst %pI4 bytes %u rate %llu queued %llu tokens %llu cpu %d%s",
+		  __entry->klass, &__entry->dst, __entry->bytes, __entry->rate,
+		  __entry->queued, __entry->tokens, __entry->cpu,
+		  __entry->to_parent ? " to parent" : "")
+);
+
+TRACE_EVENT(perfiso_rl_borrow_fail,
+	TP_PROTO(struct iso_rl *rl, struct iso_rl_queue *q, int contended),
+	TP_ARGS(rl, q, contended),
+
+	TP_STRUCT__entry(
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(u32, dst)
+		__field(u32, bytes)
+		__field(u64, rate)
+		__field(u64, queued)
+		__field(u64, total_tokens)
+		__field(int, cpu)
+		__field(int, contended)
+	),
+
+	TP_fast_assign(
+		iso_class_show(iso_rl_txc(rl)->klass, __entry->klass);
+		__entry->dst = rl->ip;
+		__entry->bytes = q->first_pkt_size;
+		__entry->rate = rl->rate;
+		__entry->queued = q->bytes_enqueued;
+		__entry->total_tokens = rl->total_tokens;
+		__entry->cpu = q->cpu;
+		__entry->contended = contended;
+	),
+
+	TP_printk("class %s dst %pI4 bytes %u rate %llu queued %llu total_tokens %llu cpu %d %s",
+		  __entry->klass, &__entry->dst, __entry->bytes, __entry->rate,
+		  __entry->queued, __entry->total_tokens, __entry->cpu,
+		  __entry->contended ? "contended" : "no tokens")
+);
+
+/* Only the first entry of the message; @count says how many more */
+TRACE_EVENT(perfiso_feedback_generate,
+	TP_PROTO(struct net_device *dev, struct iso_feedback_msg *msg, __be32 dst),
+	TP_ARGS(dev, msg, dst),
+
+	TP_STRUCT__entry(
+		__field(int, ifindex)
+		__field(u32, dst)
+		__field(u32, seq)
+		__field(u32, count)
+		__field(u32, klass)
+		__field(u32, rate)
+		__field(u16, alpha)
+		__field(u16, congestion)
+	),
+
+	TP_fast_assign(
+		__entry->ifindex = dev->ifindex;
+		__entry->dst = dst;
+		__entry->seq = ntohl(msg->seq);
+		__entry->count = msg->count;
+		__entry->klass = msg->count ? ntohl(msg->entries[0].klass) : 0;
+		__entry->rate = msg->count ? ntohl(msg->entries[0].rate) : 0;
+		__entry->alpha = msg->count ? ntohs(msg->entries[0].alpha) : 0;
+		__entry->congestion = msg->count ? ntohs(msg->entries[0].congestion) : 0;
+	),
+
+	TP_printk("ifindex %d dst %pI4 seq %u count %u class-hash %x rate %u alpha %u congestion %u",
+		  __entry->ifindex, &__entry->dst, __entry->seq, __entry->count,
+		  __entry->klass, __entry->rate, __entry->alpha, __entry->congestion)
+);
+
+TRACE_EVENT(perfiso_feedback_rx,
+	TP_PROTO(struct iso_tx_class *txc, struct iso_per_dest_state *state,
+		 u32 ip, u32 rate, u32 congestion),
+	TP_ARGS(txc, state, ip, rate, congestion),
+
+	TP_STRUCT__entry(
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(u32, dst)
+		__field(u32, fb_rate)
+		__field(u32, congestion)
+		__field(u64, rfair)
+		__field(u64, rl_rate)
+	),
+
+	TP_fast_assign(
+		iso_class_show(txc->klass, __entry->klass);
+		__entry->dst = htonl(ip);
+		__entry->fb_rate = rate;
+		__entry->congestion = congestion;
+		__entry->rfair = state->tx_rc.rfair;
+		__entry->rl_rate = state->rl ? state->rl->rate : 0;
+	),
+
+	TP_printk("class %s dst %pI4 fb_rate %u congestion %u rfair %llu rate %llu",
+		  __entry->klass, &__entry->dst, __entry->fb_rate, __entry->congestion,
+		  __entry->rfair, __entry->rl_rate)
+);
+
+TRACE_EVENT(perfiso_txc_tick,
+	TP_PROTO(struct iso_tx_class *txc, u64 old_rate),
+	TP_ARGS(txc, old_rate),
+
+	TP_STRUCT__entry(
+		__field(int, ifindex)
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(int, weight)
+		__field(u64, tx_rate)
+		__field(u64, old_rate)
+		__field(u64, rate)
+		__field(u64, min_rate)
+		__field(u64, dev_rate)
+	),
+
+	TP_fast_assign(
+		__entry->ifindex = txc->txctx->netdev->ifindex;
+		iso_class_show(txc->klass, __entry->klass);
+		__entry->weight = txc->weight;
+		__entry->tx_rate = txc->tx_rate;
+		__entry->old_rate = old_rate;
+		__entry->rate = txc->rl.rate;
+		__entry->min_rate = txc->min_rate;
+		__entry->dev_rate = txc->txctx->rate;
+	),
+
+	TP_printk("ifindex %d class %s weight %d tx_rate %llu rate %llu -> %llu min_rate %llu dev_rate %llu",
+		  __entry->ifindex, __entry->klass, __entry->weight, __entry->tx_rate,
+		  __entry->old_rate, __entry->rate, __entry->min_rate, __entry->dev_rate)
+);
+
+TRACE_EVENT(perfiso_vq_drain,
+	TP_PROTO(struct iso_vq *vq, struct iso_vq_sample *sample),
+	TP_ARGS(vq, sample),
+
+	TP_STRUCT__entry(
+		__field(int, ifindex)
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(u64, bytes)
+		__field(u64, rx_rate)
+		__field(u64, rate)
+		__field(u64, feedback_rate)
+		__field(u64, backlog)
+		__field(u32, alpha)
+		__field(u32, delay_us)
+	),
+
+	TP_fast_assign(
+		__entry->ifindex = vq->rxctx->netdev->ifindex;
+		iso_class_show(vq->klass, __entry->klass);
+		__entry->bytes = sample->rx_bytes;
+		__entry->rx_rate = sample->rx_rate;
+		__entry->rate = sample->rate;
+		__entry->feedback_rate = vq->feedback_rate;
+		__entry->backlog = sample->backlog;
+		__entry->alpha = vq->alpha;
+		__entry->delay_us = sample->delay_us;
+	),
+
+	TP_printk("ifindex %d class %s bytes %llu rx_rate %llu rate %llu feedback_rate %llu backlog %llu alpha %u delay_us %u",
+		  __entry->ifindex, __entry->klass, __entry->bytes, __entry->rx_rate,
+		  __entry->rate, __entry->feedback_rate, __entry->backlog,
+		  __entry->alpha, __entry->delay_us)
+);
+
+/* A low latency packet skipped every limiter from @rl up */
+TRACE_EVENT(perfiso_lowlat_bypass,
+	TP_PROTO(struct iso_tx_class *txc, struct iso_rl *rl, int cpu, u32 bytes),
+	TP_ARGS(txc, rl, cpu, bytes),
+
+	TP_STRUCT__entry(
+		__array(char, klass, ISO_TRACE_CLASS_LEN)
+		__field(u32, dst)
+		__field(u32, bytes)
+		__field(int, cpu)
+		__field(int, depth)
+	),
+
+	TP_fast_assign(
+		iso_class_show(txc->klass, __entry->klass);
+		__entry->dst = rl->ip;
+		__entry->bytes = bytes;
+		__entry->cpu = cpu;
+		__entry->depth = txc->depth;
+	),
+
+	TP_printk("class %s dst %pI4 bytes %u cpu %d depth %d",
+		  __entry->klass, &__entry->dst, __entry->bytes,
+		  __entry->cpu, __entry->depth)
+);
+
+#endif /* __PERFISO_TRACE_H__ */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
+
+/* Local Variables: */
+/* indent-tabs-mode:t */
+/* End: */
@@ -2,7 +2,11 @@
 #include <linux/netfilter_bridge.h>
 #include <linux/if_ether.h>
 #include "tx.h"
+#include "rx.h"
 #include "vq.h"
+#include "delay.h"
+#include "trace.h"
+#include "cost.h"
 
 extern char *iso_param_dev;
 
@@ -42,12 +46,38 @@ int iso_tx_init(struct iso_tx_context *context) {
 	context->rate = 2;
 	context->tx_rate = 0;
 	context->tx_bytes = 0;
+	iso_counter_init(&context->tx_counter);
+
+#ifndef QDISC
+	rtnl_lock();
+#endif
+	RCU_INIT_POINTER(context->params, NULL);
+	if(iso_dev_params_refresh(&context->params, context->netdev)) {
+#ifndef QDISC
+		rtnl_unlock();
+#endif
+		return -1;
+	}
+#ifndef QDISC
+	rtnl_unlock();
+#endif
 
 	spin_lock_init(&context->txc_spinlock);
-	if(iso_rl_prep(&context->rlcb))
+	context->reasons = alloc_percpu(struct iso_reasons);
+	if(context->reasons == NULL) {
+		iso_dev_params_free(&context->params);
 		return -1;
+	}
+
+	if(iso_rl_prep(&context->rlcb, &context->tx_counter)) {
+		free_percpu(context->reasons);
+		iso_dev_params_free(&context->params);
+		return -1;
+	}
 
 	context->txc_total_weight = 0;
+	context->group = NULL;
+	INIT_LIST_HEAD(&context->group_list);
 	list_add_tail(&context->list, &txctx_list);
 	context->__prev_ISO_GSO_MAX_SIZE = context->netdev->gso_max_size;
 	netif_set_gso_max_size(context->netdev, ISO_GSO_MAX_SIZE);
@@ -60,6 +90,7 @@ void iso_tx_exit(struct iso_tx_context *context) {
 	struct hlist_node *node, *nextnode;
 	struct iso_tx_class *txc;
 
+	iso_group_leave_tx(context);
 	iso_rl_exit(context->rlcb);
 	list_del_init(&context->list);
 	printk(KERN_INFO "perfiso: Exit TX path for %s\n", context->netdev->name);
@@ -74,69 +105,117 @@ void iso_tx_exit(struct iso_tx_context *context) {
 
 	netif_set_gso_max_size(context->netdev, context->__prev_ISO_GSO_MAX_SIZE);
 	free_percpu(context->rlcb);
+	free_percpu(context->reasons);
+	iso_dev_params_free(&context->params);
 }
 
 inline void iso_txctx_accum(struct iso_tx_context *context) {
-	u64 tx = 0;
-	int i;
-
-	for_each_online_cpu(i) {
-		struct iso_rl_cb *rlcb = per_cpu_ptr(context->rlcb, i);
-		tx += rlcb->tx_bytes;
-	}
+	context->tx_bytes = iso_counter_read(&context->tx_counter);
+}
 
-	context->tx_bytes = tx;
+/*
+ * Weighted RCP among the children of @txc, like the top level's, but
+ * the capacity being shared is @txc's own rate.  The load is what
+ * the children offered this tick, not what @txc sent: that is
+ * already shaped to @txc's rate, and would never look congested.
+ * The active children together are never allowed more than @txc's
+ * rate, so they share it by weight instead of racing for the
+ * parent's queue.
+ */
+static inline void iso_txc_child_rcp(struct iso_tx_class *txc, const struct iso_config *cfg) {
+	u64 cap = max_t(u64, txc->rl.rate, 1);
+	u64 used = min_t(u64, txc->child_demand, 3 * cap);
+	u64 rate;
+
+	rate = txc->child_rate * (3 * cap - used) / (cap << 1);
+	rate = min_t(u64, div64_u64(cap, max(txc->child_active_weight, 1)), rate);
+	rate = max_t(u64, cfg->min_rfair, rate);
+	txc->child_rate = rate;
+
+	txc->child_demand = 0;
+	txc->child_active_weight = 0;
 }
 
-inline void iso_txc_tick(struct iso_tx_context *context) {
-	ktime_t now;
+inline void iso_txc_tick(struct iso_tx_context *context, const struct iso_config *cfg, ktime_t now) {
 	u64 dt;
 	unsigned long flags;
 	struct iso_tx_class *txc, *txc_next;
 	struct iso_rl *rl;
-	u64 total_weight, active_weight, last_xmit;
+	u64 total_weight, active_weight, last_xmit, last_arrived, max_rate, used, old_rate;
+	u64 demand;
 
-	now = ktime_get();
-	dt = ktime_us_delta(now, context->txc_last_update_time);
+	dt = iso_clock_us_since(now, context->txc_last_update_time);
 
-	if(likely(dt < ISO_TXC_UPDATE_INTERVAL_US))
+	if(likely(dt < cfg->txc_update_interval_us))
 		return;
 
 	if(spin_trylock_irqsave(&context->txc_spinlock, flags)) {
-		dt = ktime_us_delta(now, context->txc_last_update_time);
-		if(unlikely(dt < ISO_TXC_UPDATE_INTERVAL_US))
+		dt = iso_clock_us_since(now, context->txc_last_update_time);
+		if(unlikely(dt < cfg->txc_update_interval_us))
 			goto skip;
 
 		context->txc_last_update_time = now;
 		active_weight = 0;
 		total_weight = 0;
+		max_rate = iso_txctx_params(context)->max_tx_rate;
 
 		last_xmit = context->tx_bytes;
 		iso_txctx_accum(context);
-		/* the total tx rate.  we want this to match ISO_MAX_TX_RATE */
+		/* the total tx rate.  we want this to match max_rate */
 		context->tx_rate = ((context->tx_bytes - last_xmit) << 3) / dt;
 
 		/* Weighted RCP */
-		context->rate = context->rate * (3 * ISO_MAX_TX_RATE - context->tx_rate) / (ISO_MAX_TX_RATE << 1);
-		context->rate = min_t(u64, ISO_MAX_TX_RATE, context->rate);
-		context->rate = max_t(u64, ISO_MIN_RFAIR, context->rate);
+		used = min_t(u64, context->tx_rate, 3 * max_rate);
+		context->rate = context->rate * (3 * max_rate - used) / (max_rate << 1);
+		context->rate = min_t(u64, max_rate, context->rate);
+		context->rate = max_t(u64, cfg->min_rfair, context->rate);
 
 		for_each_txc(txc, context) {
 			rl = &txc->rl;
 			last_xmit = rl->accum_xmit;
+			last_arrived = rl->accum_arrived;
 			iso_rl_accum(rl);
 			txc->tx_rate = ((rl->accum_xmit - last_xmit) << 3) / dt;
 			txc->tx_rate_smooth = (txc->tx_rate_smooth * 15 + txc->tx_rate) / 16;
-
-			rl->rate = context->rate * txc->weight;
-			rl->rate = min_t(u64, ISO_MAX_TX_RATE, rl->rate);
+			old_rate = rl->rate;
+
+			if(txc->parent == NULL) {
+				rl->rate = context->rate * txc->weight;
+				rl->rate = min_t(u64, max_rate, rl->rate);
+			} else {
+				/* Children never get more than the parent is allowed */
+				rl->rate = txc->parent->child_rate * txc->weight;
+				rl->rate = min_t(u64, txc->parent->rl.rate, rl->rate);
+			}
 			rl->rate = max_t(u64, txc->min_rate, rl->rate);
 			if (txc->is_static) {
 				rl->rate = min_t(u64, txc->max_rate, rl->rate);
 			}
+			trace_perfiso_txc_tick(txc, old_rate);
+
+			if(txc->parent != NULL) {
+				demand = ((rl->accum_arrived - last_arrived) << 3) / dt;
+				txc->parent->child_demand += demand;
+				if(demand)
+					txc->parent->child_active_weight += txc->weight;
+			}
+
+			if(txc->is_lowlat)
+				iso_txc_lowlat_refill(txc, cfg, dt);
+		}
+
+		/* Every child has added its demand by now */
+		for_each_txc(txc, context) {
+			if(txc->num_children)
+				iso_txc_child_rcp(txc, cfg);
 		}
 	skip:
 		spin_unlock_irqrestore(&context->txc_spinlock, flags);
+
+		if(context->group)
+			iso_group_tick(context->group, now);
+	} else {
+		iso_reason_inc(context->reasons, ISO_REASON_TXC_TICK_BUSY);
 	}
 }
 
@@ -147,9 +226,11 @@ void iso_txc_show(struct iso_tx_class *txc, struct seq_file *s) {
 	struct hlist_head *head;
 	struct iso_rl *rl;
 	struct iso_per_dest_state *state;
+	struct iso_hist_pct pct;
 
 	char buff[128];
 	char vqc[128];
+	char pc[128];
 
 	iso_class_show(txc->klass, buff);
 	if(txc->vq) {
@@ -158,11 +239,30 @@ void iso_txc_show(struct iso_tx_class *txc, struct seq_file *s) {
 		sprintf(vqc, "(none)");
 	}
 
-	seq_printf(s, "txc class %s   weight %d   assoc vq %s   freelist %d\n",
-		   buff, txc->weight, vqc, txc->freelist_count);
-	seq_printf(s, "txc rl tx_rate %u,%u   rate %u   min_rate %u   xmit %llu   queued %llu\n",
+	if(txc->parent) {
+		iso_class_show(txc->parent->klass, pc);
+	} else {
+		sprintf(pc, "(none)");
+	}
+
+	seq_printf(s, "txc class %s   weight %d   assoc vq %s   freelist %d   parent %s   depth %d\n",
+		   buff, txc->weight, vqc, txc->freelist_count, pc, txc->depth);
+	if(txc->num_children) {
+		seq_printf(s, "txc children %d   child_weight %d   child_rate %llu\n",
+			   txc->num_children, txc->child_weight, txc->child_rate);
+	}
+	if(txc->is_lowlat) {
+		seq_printf(s, "txc lowlat   tokens %lld\n",
+			   (long long)atomic64_read(&txc->ll_tokens));
+	}
+	iso_rl_accum_queued(&txc->rl);
+	seq_printf(s, "txc rl tx_rate %llu,%llu   rate %llu   min_rate %llu   xmit %llu   queued %llu\n",
 		   txc->tx_rate, txc->tx_rate_smooth, txc->rl.rate, txc->min_rate,
 		   txc->rl.accum_xmit, txc->rl.accum_enqueued);
+	iso_hist_percentiles(txc->qdelay, txc->qdelay_snap, &pct);
+	seq_printf(s, "txc qdelay_ns p50 %llu   p99 %llu   p999 %llu   samples %llu\n",
+		   pct.p50, pct.p99, pct.p999, pct.samples);
+	iso_reason_show(txc->reasons, "txc drops", s);
 	iso_rl_show(&txc->rl, s);
 	seq_printf(s, "\n");
 
@@ -194,18 +294,56 @@ void iso_txc_show(struct iso_tx_class *txc, struct seq_file *s) {
 	seq_printf(s, "\n");
 }
 
+/*
+ * Low latency fast path: if the class is within its guarantee and
+ * nothing is queued on this CPU in its limiter or any above it (so we
+ * don't reorder), let the packet skip the rate limiters.  It is still charged to every limiter it
+ * skipped, up to the top of the hierarchy, so it comes out of the
+ * class's rate and its parents' instead of on top of them; and the
+ * RCP loops see it.
+ */
+static inline int iso_tx_lowlat(struct iso_tx_class *txc, struct iso_rl *rl, struct sk_buff *skb,
+				int cpu, const struct iso_config *cfg, ktime_t now) {
+	struct iso_rl_cb *cb = per_cpu_ptr(txc->rl.rlcb, cpu);
+	u32 size = skb_size(skb);
+	struct iso_rl *r;
+
+	/* Earlier packets of this class may still wait in the
+	 * destination's limiter, the class's, or any parent's */
+	for(r = rl; r != NULL; r = r->parent) {
+		if(skb_queue_len(&per_cpu_ptr(r->queue, cpu)->list))
+			return 0;
+	}
+
+	if(!iso_txc_lowlat_admit(txc, size))
+		return 0;
+
+	trace_perfiso_lowlat_bypass(txc, rl, cpu, size);
+	for(r = rl; r != NULL; r = r->parent)
+		iso_rl_bypass(r, per_cpu_ptr(r->queue, cpu), cfg, size, now);
+	iso_rl_cb_account_xmit(cb, cfg, size, now);
+	return 1;
+}
+
 enum iso_verdict iso_tx(struct sk_buff *skb, const struct net_device *out, struct iso_tx_context *context)
 {
 	struct iso_tx_class *txc;
 	struct iso_per_dest_state *state;
 	struct iso_rl *rl;
 	struct iso_rl_queue *q;
+	const struct iso_config *cfg;
 	enum iso_verdict verdict = ISO_VERDICT_PASS;
 	int cpu = smp_processor_id();
+	/* The only clock read for this packet */
+	ktime_t now = iso_clock_now();
+	u32 len = skb_size(skb);
+	cycles_t start;
 
 	rcu_read_lock();
+	cfg = iso_config();
+	start = iso_cost_start(cfg);
 
-	iso_txc_tick(context);
+	iso_txc_tick(context, cfg, now);
 
 	txc = iso_txc_find(iso_txc_classify(skb), context);
 	if(txc == NULL)
@@ -223,11 +361,23 @@ enum iso_verdict iso_tx(struct sk_buff *skb, const struct net_device *out, struc
 	/* Enable ECT: this packet is guaranteed to be IP */
 	iso_enable_ecn(skb);
 
+	/* Feedback we owe the destination can ride along */
+	if(cfg->feedback_piggyback && cfg->auto_generate_feedback && !skb_is_gso(skb))
+		iso_feedback_piggyback(iso_rxctx_dev(out), skb, out, now);
+
+	if(txc->is_lowlat && iso_tx_lowlat(txc, rl, skb, cpu, cfg, now)) {
+		/* Caller sends it right away */
+		iso_delay_stamp(skb, cfg);
+		verdict = ISO_VERDICT_PASS;
+		goto accept;
+	}
+
 	/* Enqueue in RL */
 	verdict = iso_rl_enqueue(rl, skb, cpu);
 	q = per_cpu_ptr(rl->queue, cpu);
 	iso_rl_dequeue((unsigned long)q);
  accept:
+	iso_cost_end(cfg, ISO_COST_TX, start, 1, len);
 	rcu_read_unlock();
 	return verdict;
 }
@@ -241,11 +391,7 @@ struct iso_per_dest_state
 {
 	struct ethhdr *eth;
 	struct iphdr *iph;
-	struct iso_per_dest_state *state = NULL, *nextstate;
-	struct hlist_head *head;
-	struct hlist_node *node;
-
-	u32 ip, hash;
+	u32 ip;
 
 	eth = eth_hdr(skb);
 
@@ -260,6 +406,20 @@ struct iso_per_dest_state
 	ip = ntohl(iph->daddr);
 	if(rx) ip = ntohl(iph->saddr);
 
+	return iso_state_get_ip(txc, ip, create_flags);
+}
+
+/* Called with rcu lock.  @ip is in host byte order. */
+struct iso_per_dest_state
+*iso_state_get_ip(struct iso_tx_class *txc,
+		  u32 ip,
+		  enum iso_create_t create_flags)
+{
+	struct iso_per_dest_state *state = NULL, *nextstate;
+	struct hlist_head *head;
+	struct hlist_node *node;
+	u32 hash;
+
 	hash = jhash_1word(ip, 0xfacedead) & (ISO_MAX_STATE_BUCKETS - 1);
 	head = &txc->state_bucket[hash];
 
@@ -360,15 +520,36 @@ void iso_txc_init(struct iso_tx_class *txc) {
 	txc->freelist_count = 0;
 
 	iso_rl_init(&txc->rl, txc->txctx->rlcb);
+	txc->qdelay = alloc_percpu(struct iso_hist);
+	txc->qdelay_snap = kmalloc(sizeof(*txc->qdelay_snap), GFP_KERNEL);
+	if(txc->qdelay_snap)
+		iso_hist_snap_init(txc->qdelay_snap);
+	txc->reasons = alloc_percpu(struct iso_reasons);
 	txc->weight = 1;
 	txc->active = 0;
 	txc->tx_rate = 0;
-	txc->min_rate = ISO_MAX_TX_RATE;
+	rcu_read_lock();
+	txc->min_rate = iso_txctx_params(txc->txctx)->max_tx_rate;
+	rcu_read_unlock();
 	txc->tx_rate_smooth = 0;
 
-	txc->max_rate = ISO_MAX_TX_RATE;
+	txc->max_rate = txc->min_rate;
 	txc->is_static = 0;
 
+	txc->parent = NULL;
+	txc->depth = 0;
+	txc->num_children = 0;
+	txc->child_weight = 0;
+	txc->child_demand = 0;
+	txc->child_active_weight = 0;
+	rcu_read_lock();
+	txc->child_rate = iso_config()->min_rfair;
+	rcu_read_unlock();
+
+	txc->is_lowlat = 0;
+	atomic64_set(&txc->ll_tokens, 0);
+	txc->group_min_rate = 0;
+
 	INIT_WORK(&txc->allocator, iso_txc_allocator);
 }
 
@@ -389,6 +570,14 @@ struct iso_tx_class *iso_txc_alloc(iso_class_t klass, struct iso_tx_context *con
 	txc->txctx = context;
 	iso_txc_init(txc);
 	txc->klass = klass;
+	if(txc->qdelay == NULL || txc->qdelay_snap == NULL || txc->reasons == NULL) {
+		free_percpu(txc->reasons);
+		kfree(txc->qdelay_snap);
+		free_percpu(txc->qdelay);
+		free_percpu(txc->rl.queue);
+		kfree(txc);
+		return NULL;
+	}
 
 	/* Preallocate some perdest state and rate limiters.  32 entries
 	 * ought to be enough for everybody ;) */
@@ -405,6 +594,119 @@ struct iso_tx_class *iso_txc_alloc(iso_class_t klass, struct iso_tx_context *con
 	return txc;
 }
 
+/*
+ * Called with the config lock held.  Moves @txc under @parent, or to
+ * the top level if @parent is NULL.  Only classes without children
+ * can be moved, so hierarchies are built top-down.
+ */
+int iso_txc_set_parent(struct iso_tx_class *txc, struct iso_tx_class *parent) {
+	struct iso_tx_context *context = txc->txctx;
+	struct iso_tx_class *p;
+	unsigned long flags;
+	int depth = 0;
+
+	if(txc->num_children)
+		return -EBUSY;
+
+	if(parent) {
+		if(parent->txctx != context)
+			return -EINVAL;
+
+		for(p = parent; p != NULL; p = p->parent) {
+			if(p == txc)
+				return -EINVAL;
+		}
+
+		depth = parent->depth + 1;
+		if(depth >= ISO_MAX_TXC_DEPTH)
+			return -EINVAL;
+	}
+
+	spin_lock_irqsave(&context->txc_spinlock, flags);
+	if(txc->parent) {
+		txc->parent->child_weight -= txc->weight;
+		txc->parent->num_children--;
+	} else {
+		context->txc_total_weight -= txc->weight;
+	}
+
+	if(parent) {
+		parent->child_weight += txc->weight;
+		parent->num_children++;
+	} else {
+		context->txc_total_weight += txc->weight;
+	}
+
+	txc->parent = parent;
+	txc->depth = depth;
+	/* Packets leaving this class now queue up in the parent's limiter */
+	txc->rl.parent = parent ? &parent->rl : NULL;
+	spin_unlock_irqrestore(&context->txc_spinlock, flags);
+
+	iso_txc_recompute_rates(context);
+	return 0;
+}
+
+/* Called with the config lock held */
+void iso_txc_set_lowlat(struct iso_tx_class *txc, int lowlat) {
+	/* Start with a full bucket so the first RPCs go out inline */
+	rcu_read_lock();
+	atomic64_set(&txc->ll_tokens, lowlat ? iso_txc_lowlat_burst(txc, iso_config()) : 0);
+	rcu_read_unlock();
+	txc->is_lowlat = !!lowlat;
+}
+
+/*
+ * Called with the config lock held.  Takes @txc off the hash table
+ * and the class list, and out of its parent's or the device's
+ * weight; the caller frees it with iso_txc_free, which waits out rcu
+ * readers still walking either.  @txc must have no children.
+ */
+void iso_txc_unlink(struct iso_tx_class *txc) {
+	struct iso_tx_context *context = txc->txctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&context->txc_spinlock, flags);
+	hlist_del_rcu(&txc->hash_node);
+	list_del_rcu(&txc->list);
+	if(txc->parent) {
+		txc->parent->child_weight -= txc->weight;
+		txc->parent->num_children--;
+	} else {
+		context->txc_total_weight -= txc->weight;
+	}
+	spin_unlock_irqrestore(&context->txc_spinlock, flags);
+
+	iso_txc_recompute_rates(context);
+}
+
+/* Called with the config lock held.  XXX: the datapath doesn't
+ * synchronise with this */
+void iso_txc_set_vq(struct iso_tx_class *txc, struct iso_vq *vq) {
+	if(txc->vq)
+		atomic_dec(&txc->vq->refcnt);
+
+	txc->vq = vq;
+	atomic_inc(&vq->refcnt);
+}
+
+/* Called with the config lock held */
+void iso_txc_set_weight(struct iso_tx_class *txc, int weight) {
+	struct iso_tx_context *context = txc->txctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&context->txc_spinlock, flags);
+	if(txc->parent) {
+		txc->parent->child_weight += weight - txc->weight;
+	} else {
+		context->txc_total_weight += weight - txc->weight;
+	}
+	txc->weight = weight;
+	spin_unlock_irqrestore(&context->txc_spinlock, flags);
+
+	iso_txc_recompute_rates(context);
+}
+
 void iso_state_init(struct iso_per_dest_state *state) {
 	state->rl = NULL;
 	iso_rc_init(&state->tx_rc);
@@ -441,6 +743,7 @@ void iso_txc_prealloc(struct iso_tx_class *txc, int num) {
 		iso_state_init(state);
 		iso_rl_init(rl, txc->txctx->rlcb);
 		rl->txc = txc;
+		rl->parent = &txc->rl;
 
 		spin_lock_irqsave(&txc->writelock, flags);
 		txc->freelist_count++;
@@ -496,6 +799,9 @@ void iso_txc_free(struct iso_tx_class *txc) {
 		atomic_dec(&txc->vq->refcnt);
 	}
 
+	free_percpu(txc->reasons);
+	kfree(txc->qdelay_snap);
+	free_percpu(txc->qdelay);
 	free_percpu(txc->rl.queue);
 	kfree(txc);
 }
@@ -6,7 +6,11 @@
 #include <linux/seq_file.h>
 #include <linux/workqueue.h>
 #include "rl.h"
+#include "hist.h"
+#include "reason.h"
 #include "rc.h"
+#include "group.h"
+#include "devparams.h"
 
 #ifdef QDISC
 #include <net/pkt_sched.h>
@@ -46,22 +50,59 @@ struct iso_tx_class {
 
 	/* Rate limiter assigned to this TX class as a whole */
 	struct iso_rl rl;
+	/* Time packets spent in this class's rate limiter queues,
+	 * per-destination ones included */
+	struct iso_hist __percpu *qdelay;
+	struct iso_hist_snap *qdelay_snap;
+	/* Drops and skipped updates; see reason.h */
+	struct iso_reasons __percpu *reasons;
 	int weight;
 	int active;
-	u32 tx_rate, tx_rate_smooth;
-	u32 min_rate;
+	u64 tx_rate, tx_rate_smooth;
+	u64 min_rate;
 
-	u32 max_rate;
+	u64 max_rate;
 	u8 is_static;
 
+	/* Class hierarchy (tenant -> VM -> service).  A child's weight
+	 * is relative to its siblings, and its guarantee is carved out
+	 * of its parent's guarantee. */
+	struct iso_tx_class *parent;
+	int depth;
+	int num_children;
+	int child_weight;
+	/* RCP state: fair rate per unit weight among our children */
+	u64 child_rate;
+	/* What our children offered, and the weight of those that
+	 * offered anything, summed over one tick */
+	u64 child_demand;
+	int child_active_weight;
+
+	/* Low latency classes send inline while within their
+	 * guarantee.  ll_tokens is refilled at min_rate every tick and
+	 * may go negative: that's the debt the class has to repay
+	 * before it can bypass the queues again. */
+	u8 is_lowlat;
+	atomic64_t ll_tokens;
+
+	/* Share of a top-level class's guarantee that this device
+	 * provides on behalf of its host-wide group; 0 if ungrouped */
+	u64 group_min_rate;
+
 	/* Allocate from process context */
 	struct work_struct allocator;
 	struct iso_tx_context *txctx;
 };
 
+/* The class @rl shapes: the owner of a per-destination limiter, or
+ * the class the limiter is embedded in */
+static inline struct iso_tx_class *iso_rl_txc(struct iso_rl *rl) {
+	return rl->txc ? rl->txc : container_of(rl, struct iso_tx_class, rl);
+}
+
 /*
- * Create one per device.  We do not support multiple interface
- * fairness yet.
+ * Create one per device.  Devices that should share tenant
+ * guarantees (e.g., bond slaves) can be put in an iso_group.
  */
 struct iso_tx_context {
 	struct net_device *netdev;
@@ -77,12 +118,30 @@ struct iso_tx_context {
 	int txc_total_weight;
 	spinlock_t txc_spinlock;
 
+	/* Bytes sent by all cpus, published by each cpu's iso_rl_cb */
+	struct iso_counter tx_counter;
+	struct iso_reasons __percpu *reasons;
 	u64 tx_bytes;
-	u32 tx_rate;
+	u64 tx_rate;
 	/* RCP state */
-	u32 rate;
+	u64 rate;
+
+	/* Rates for this device's link; see devparams.h */
+	struct iso_dev_params __rcu *params;
+
+	/* Host-wide group this device belongs to, if any */
+	struct iso_group *group;
+	struct list_head group_list;
+
+	/* Set while a netlink batch configures this device: rates are
+	 * recomputed once at the end instead of after every change */
+	int config_batch;
+	int recompute_pending;
 };
 
+/* Maximum depth of the tx class hierarchy, counting the top level */
+#define ISO_MAX_TXC_DEPTH (4)
+
 enum iso_create_t {
 	ISO_DONT_CREATE_RL = 0,
 	ISO_CREATE_RL = 1,
@@ -100,8 +159,15 @@ extern struct iso_tx_context global_txcontext;
 #endif
 
 #define for_each_txc(txc, context) list_for_each_entry_safe(txc, txc_next, &context->txc_list, list)
+/* Under rcu_read_lock: the list is changed with the _rcu list ops */
+#define for_each_txc_rcu(txc, context) list_for_each_entry_rcu(txc, &(context)->txc_list, list)
 #define for_each_tx_context(txctx) list_for_each_entry_safe(txctx, txctx_next, &txctx_list, list)
 
+/* Under rcu_read_lock, or rtnl */
+static inline struct iso_dev_params *iso_txctx_params(struct iso_tx_context *txctx) {
+	return rcu_dereference_check(txctx->params, rtnl_is_locked());
+}
+
 int iso_tx_init(struct iso_tx_context *);
 void iso_tx_exit(struct iso_tx_context *);
 
@@ -111,6 +177,11 @@ void iso_txc_init(struct iso_tx_class *);
 struct iso_tx_class *iso_txc_alloc(iso_class_t, struct iso_tx_context *);
 void iso_txc_free(struct iso_tx_class *);
 void iso_txc_show(struct iso_tx_class *, struct seq_file *);
+int iso_txc_set_parent(struct iso_tx_class *, struct iso_tx_class *);
+void iso_txc_set_lowlat(struct iso_tx_class *, int);
+void iso_txc_set_weight(struct iso_tx_class *, int);
+void iso_txc_set_vq(struct iso_tx_class *, struct iso_vq *);
+void iso_txc_unlink(struct iso_tx_class *);
 
 #if defined ISO_TX_CLASS_DEV
 int iso_txc_dev_install(char *);
@@ -123,11 +194,12 @@ int iso_txc_mark_install(char *mark);
 int iso_txc_install(char *klass, struct iso_tx_context *);
 void iso_txc_prealloc(struct iso_tx_class *, int);
 void iso_txc_allocator(struct work_struct *);
-inline void iso_txc_tick(struct iso_tx_context *);
+inline void iso_txc_tick(struct iso_tx_context *, const struct iso_config *, ktime_t now);
 static inline void iso_txc_recompute_rates(struct iso_tx_context *);
 
 void iso_state_init(struct iso_per_dest_state *);
 struct iso_per_dest_state *iso_state_get(struct iso_tx_class *, struct sk_buff *, int rx, enum iso_create_t);
+struct iso_per_dest_state *iso_state_get_ip(struct iso_tx_class *, u32 ip, enum iso_create_t);
 struct iso_rl *iso_pick_rl(struct iso_tx_class *txc, __le32);
 void iso_state_free(struct iso_per_dest_state *);
 
@@ -153,24 +225,101 @@ static inline struct iso_tx_class *iso_txc_find(iso_class_t klass, struct iso_tx
 	return found;
 }
 
+/* The total weight @txc competes with: its siblings' or the top level's */
+static inline int iso_txc_sibling_weight(struct iso_tx_class *txc) {
+	if(txc->parent)
+		return txc->parent->child_weight;
+	return txc->txctx->txc_total_weight;
+}
+
+/* Each level takes its weighted share of the level above it */
+static inline u64 iso_txc_guarantee(struct iso_tx_class *txc) {
+	u64 rate = iso_txctx_params(txc->txctx)->max_tx_rate;
+	int total;
+
+	for(; txc != NULL; txc = txc->parent) {
+		if(txc->parent == NULL && txc->txctx->group != NULL && txc->group_min_rate) {
+			/* The group decides the top level's share */
+			rate = rate * txc->group_min_rate / iso_txctx_params(txc->txctx)->max_tx_rate;
+			break;
+		}
+
+		total = iso_txc_sibling_weight(txc);
+		if(total == 0)
+			return 0;
+		rate = rate * txc->weight / total;
+	}
+
+	return rate;
+}
+
+/* Refresh guarantees without resetting the rates RCP converged to */
+static inline void iso_txc_update_guarantees(struct iso_tx_context *context) {
+	struct iso_tx_class *txc, *txc_next;
+	unsigned long flags;
+
+	rcu_read_lock();
+	spin_lock_irqsave(&context->txc_spinlock, flags);
+	for_each_txc(txc, context) {
+		txc->min_rate = iso_txc_guarantee(txc);
+	}
+	spin_unlock_irqrestore(&context->txc_spinlock, flags);
+	rcu_read_unlock();
+}
+
 static inline void iso_txc_recompute_rates(struct iso_tx_context *context) {
 	struct iso_tx_class *txc, *txc_next;
 	unsigned long flags;
 
+	if (context->config_batch) {
+		context->recompute_pending = 1;
+		return;
+	}
+
 	if (context->txc_total_weight == 0) {
 		printk(KERN_INFO "%s warning: context has zero weight.\n", __FUNCTION__);
 		return;
 	}
 
+	rcu_read_lock();
 	spin_lock_irqsave(&context->txc_spinlock, flags);
 	for_each_txc(txc, context) {
-		txc->min_rate = txc->weight * ISO_MAX_TX_RATE / context->txc_total_weight;
+		txc->min_rate = iso_txc_guarantee(txc);
 		txc->rl.rate = txc->min_rate;
 		if (txc->is_static) {
 			txc->rl.rate = min_t(u64, txc->max_rate, txc->rl.rate);
 		}
 	}
 	spin_unlock_irqrestore(&context->txc_spinlock, flags);
+	rcu_read_unlock();
+}
+
+static inline s64 iso_txc_lowlat_burst(struct iso_tx_class *txc, const struct iso_config *cfg) {
+	return max_t(s64, ((u64)txc->min_rate * cfg->max_burst_time_us) >> 3, cfg->min_burst_bytes);
+}
+
+/* Called every tick with the context lock */
+static inline void iso_txc_lowlat_refill(struct iso_tx_class *txc, const struct iso_config *cfg, u64 dt) {
+	s64 cap = iso_txc_lowlat_burst(txc, cfg);
+	s64 old, new;
+
+	do {
+		old = atomic64_read(&txc->ll_tokens);
+		new = min_t(s64, cap, old + (((u64)txc->min_rate * dt) >> 3));
+	} while(atomic64_cmpxchg(&txc->ll_tokens, old, new) != old);
+}
+
+/*
+ * Charge @len bytes to the class's guarantee.  Returns 1 if the class
+ * had credit left, in which case the packet can skip the queues;
+ * the class may end up in debt.
+ */
+static inline int iso_txc_lowlat_admit(struct iso_tx_class *txc, u32 len) {
+	if(atomic64_read(&txc->ll_tokens) <= 0)
+		return 0;
+
+	atomic64_sub(len, &txc->ll_tokens);
+	return 1;
 }
 
 static inline void iso_enable_ecn(struct sk_buff *skb)
@@ -179,10 +328,11 @@ static inline void iso_enable_ecn(struct sk_buff *skb)
 	ipv4_change_dsfield(iph, 0xff, iph->tos | INET_ECN_ECT_0);
 }
 
-static inline void iso_clear_ecn(struct sk_buff *skb)
+/* Turn CE back into ECT(0), so the flow stays ECN capable */
+static inline void iso_clear_ce(struct sk_buff *skb)
 {
 	struct iphdr *iph = ip_hdr(skb);
-	ipv4_change_dsfield(iph, 0xff, iph->tos & ~0x3);
+	ipv4_change_dsfield(iph, 0xff, (iph->tos & ~INET_ECN_MASK) | INET_ECN_ECT_0);
 }
 
 #endif /* __TX_H__ */
@@ -1,5 +1,6 @@
 
 #include "vq.h"
+#include "trace.h"
 
 /*
 s64 vq_total_tokens;
@@ -60,16 +61,25 @@ struct iso_vq *iso_vq_alloc(iso_class_t klass, struct iso_rx_context *rxctx) {
 void iso_vq_calculate_rates(struct iso_rx_context *rxctx) {
 	u32 total_weight = 0;
 	struct iso_vq *vq, *vq_next;
+	u64 drain_rate;
+
+	if(rxctx->config_batch) {
+		rxctx->recompute_pending = 1;
+		return;
+	}
 
 	for_each_vq(vq, rxctx) {
 		total_weight += vq->weight;
 	}
 
 	if(total_weight > 0) {
+		rcu_read_lock();
+		drain_rate = iso_rxctx_params(rxctx)->drain_rate;
+		rcu_read_unlock();
 		for_each_vq(vq, rxctx) {
 			if (vq->is_static)
 				continue;
-			vq->rate = ISO_VQ_DRAIN_RATE_MBPS * vq->weight / total_weight;
+			vq->rate = drain_rate * vq->weight / total_weight;
 		}
 	}
 }
@@ -78,31 +88,54 @@ int iso_vq_init(struct iso_vq *vq) {
 	int i;
 	vq->enabled = 1;
 	vq->is_static = 0;
-	vq->rate = ISO_MIN_RFAIR;
+	rcu_read_lock();
+	vq->rate = iso_config()->min_rfair;
+	rcu_read_unlock();
 	vq->total_bytes_queued = 0;
-	vq->feedback_rate = ISO_MIN_RFAIR;
+	vq->feedback_rate = vq->rate;
 	vq->last_rx_bytes = 0;
+	vq->last_rx_packets = 0;
+	vq->last_rx_marked = 0;
+	vq->last_delay_sum_us = 0;
+	vq->last_delay_samples = 0;
+	vq->delay_us = 0;
 	vq->rx_rate = 0;
 	vq->weight = 1;
 	vq->alpha = 0;
+	vq->group_min_rate = 0;
+	iso_vq_set_cc(vq, iso_vq_cc_default);
+	vq->police = 0;
+	atomic64_set(&vq->police_tokens, 0);
 	vq->last_update_time = vq->last_borrow_time = ktime_get();
 
 	vq->percpu_stats = alloc_percpu(struct iso_vq_stats);
 	if(vq->percpu_stats == NULL)
 		return -ENOMEM;
 
+	iso_counter_init(&vq->rx_bytes);
+	iso_counter_init(&vq->rx_packets);
+	iso_counter_init(&vq->rx_marked);
+	iso_counter_init(&vq->delay_sum_us);
+	iso_counter_init(&vq->delay_samples);
+
 	for_each_possible_cpu(i) {
 		struct iso_vq_stats *stats = per_cpu_ptr(vq->percpu_stats, i);
-		stats->bytes_queued = 0;
 		stats->network_marked = 0;
 		stats->rx_bytes = 0;
 		stats->rx_packets = 0;
-		stats->rx_since_last_feedback = 0;
-		stats->rx_marked_since_last_feedback = 0;
+		stats->police_tokens = 0;
+		stats->police_marked = 0;
+		stats->police_dropped = 0;
+		stats->delay_sum_us = 0;
+		stats->delay_samples = 0;
+		stats->published_marked = 0;
+		stats->published_packets = 0;
+		stats->published_bytes = 0;
+		stats->published_delay_sum_us = 0;
+		stats->published_delay_samples = 0;
+		stats->last_publish = vq->last_update_time;
 	}
 
-	spin_lock_init(&vq->spinlock);
-
 	INIT_LIST_HEAD(&vq->list);
 	INIT_HLIST_NODE(&vq->hash_node);
 
@@ -114,144 +147,221 @@ void iso_vq_free(struct iso_vq *vq) {
 	if(atomic_read(&vq->refcnt) > 0)
 		return;
 
+	/* The rx control loop walks the list under rcu */
+	list_del_rcu(&vq->list);
+	hlist_del_rcu(&vq->hash_node);
 	synchronize_rcu();
-	list_del(&vq->list);
 	free_percpu(vq->percpu_stats);
 	kfree(vq);
 }
 
-void iso_vq_enqueue(struct iso_vq *vq, struct sk_buff *pkt) {
-	ktime_t now;
-	u64 dt;
-	unsigned long flags;
-	int cpu = smp_processor_id();
-	struct iso_vq_stats *stats = per_cpu_ptr(vq->percpu_stats, cpu);
-	u32 len = skb_size(pkt);
+/*
+ * Take @len bytes from this cpu's share of the VQ's tokens, borrowing
+ * another chunk from the VQ when it runs out.  How far the VQ is in
+ * debt says how far beyond its rate the senders are.
+ */
+static enum iso_verdict iso_vq_police(struct iso_vq *vq, struct iso_vq_stats *stats,
+				      const struct iso_config *cfg, struct sk_buff *pkt, u32 len) {
+	s64 debt;
+
+	if(unlikely(iso_is_generated_feedback(pkt)))
+		return ISO_VERDICT_SUCCESS;
+
+	debt = -atomic64_read(&vq->police_tokens);
+
+	if(stats->police_tokens < len) {
+		if(debt > cfg->vq_max_bytes) {
+			stats->police_dropped++;
+			return ISO_VERDICT_DROP;
+		}
+
+		atomic64_sub(ISO_VQ_POLICE_CHUNK_BYTES, &vq->police_tokens);
+		stats->police_tokens += ISO_VQ_POLICE_CHUNK_BYTES;
+	}
+
+	stats->police_tokens -= len;
+
+	if(debt > cfg->vq_mark_thresh_bytes &&
+	   eth_hdr(pkt)->h_proto == __constant_htons(ETH_P_IP) &&
+	   IP_ECN_set_ce(ip_hdr(pkt))) {
+		stats->police_marked++;
+		return ISO_VERDICT_PASS;
+	}
+
+	return ISO_VERDICT_SUCCESS;
+}
+
+/* Publish this cpu's counts, including delay samples iso_delay_rx
+ * added for the packet being enqueued */
+static inline void iso_vq_publish(struct iso_vq *vq, struct iso_vq_stats *stats) {
+	iso_counter_publish(&vq->rx_bytes, stats->rx_bytes, &stats->published_bytes);
+	iso_counter_publish(&vq->rx_packets, stats->rx_packets, &stats->published_packets);
+	iso_counter_publish(&vq->rx_marked, stats->network_marked, &stats->published_marked);
+	iso_counter_publish(&vq->delay_sum_us, stats->delay_sum_us, &stats->published_delay_sum_us);
+	iso_counter_publish(&vq->delay_samples, stats->delay_samples, &stats->published_delay_samples);
+}
+
+/*
+ * Rx fast path: only bump this cpu's counters, and police if asked
+ * to.  Returns ISO_VERDICT_DROP if the packet should be dropped, and
+ * ISO_VERDICT_PASS if we CE marked it and the mark must reach the
+ * stack.
+ */
+enum iso_verdict iso_vq_enqueue(struct iso_vq *vq, struct sk_buff *pkt, ktime_t now) {
+	struct iso_vq_stats *stats = per_cpu_ptr(vq->percpu_stats, smp_processor_id());
+	const struct iso_config *cfg = iso_config();
+	u32 segs = skb_segs(pkt);
+	u32 len = skb_wire_size(pkt, segs);
 	struct ethhdr *eth;
 	struct iphdr *iph;
 
 	eth = eth_hdr(pkt);
 
-	stats->rx_since_last_feedback++;
-	stats->rx_packets++;
+	stats->rx_packets += segs;
+	stats->rx_bytes += len;
 
+	/* GRO only merges segments with the same tos, so a CE mark on
+	 * a merged skb was on every one of its segments. */
 	if(likely(eth->h_proto == __constant_htons(ETH_P_IP))) {
 		iph = ip_hdr(pkt);
-		if((iph->tos & 0x3) == 0x3) {
-			stats->network_marked++;
-			stats->rx_marked_since_last_feedback++;
-		}
+		if((iph->tos & 0x3) == 0x3)
+			stats->network_marked += segs;
 	}
 
-	now = ktime_get();
-	dt = ktime_us_delta(now, vq->last_update_time);
-	if(unlikely(dt > ISO_VQ_UPDATE_INTERVAL_US)) {
-		if(spin_trylock_irqsave(&vq->spinlock, flags)) {
-			iso_vq_drain(vq, dt);
-			spin_unlock_irqrestore(&vq->spinlock, flags);
-		}
-	}
+	if(iso_counter_due(&stats->last_publish, now, cfg->counter_publish_us))
+		iso_vq_publish(vq, stats);
 
-	stats->bytes_queued += len;
-	stats->rx_bytes += len;
+	if(unlikely(vq->police))
+		return iso_vq_police(vq, stats, cfg, pkt, len);
+
+	return ISO_VERDICT_SUCCESS;
+}
+
+/* Give the VQ @rate worth of policing tokens for the last @dt us, up
+ * to a burst's worth */
+static void iso_vq_police_refill(struct iso_vq *vq, const struct iso_config *cfg, u64 rate, u64 dt) {
+	s64 burst = max_t(s64, (rate * cfg->max_burst_time_us) >> 3, cfg->min_burst_bytes);
+	s64 tokens;
+
+	tokens = atomic64_add_return((rate * dt) >> 3, &vq->police_tokens);
+	if(tokens > burst)
+		atomic64_sub(tokens - burst, &vq->police_tokens);
 }
 
-/* called with vq's lock */
-void iso_vq_drain(struct iso_vq *vq, u64 dt) {
-	u64 rx_bytes, dt2, rate;
+/* Called from the rx control loop with rxctx->vq_spinlock held */
+void iso_vq_drain(struct iso_vq *vq, ktime_t now) {
+	u64 rx_bytes, rx_packets, rx_marked_total, dt, rate, drained;
+	u64 delay_sum, delay_samples;
+	struct iso_vq_sample sample;
 	u32 rx_pkts, rx_marked;
-	int i, factor;
-	ktime_t now = ktime_get();
 	struct iso_rx_context *rxctx = vq->rxctx;
+	struct iso_dev_params *p = iso_rxctx_params(rxctx);
+	const struct iso_config *cfg = iso_config();
 
-	dt2 = ktime_us_delta(now, vq->last_update_time);
-	if(dt2 < ISO_VQ_UPDATE_INTERVAL_US)
+	dt = ktime_us_delta(now, vq->last_update_time);
+	if(unlikely(dt == 0))
 		return;
 
 	vq->last_update_time = now;
-	rx_bytes = 0;
-	factor = 0;
-
-	rx_pkts = 0;
-	rx_marked = 0;
-
-	/* assimilate and reset per-cpu counters */
-	for_each_online_cpu(i) {
-		struct iso_vq_stats *stats = per_cpu_ptr(vq->percpu_stats, i);
-		rx_bytes += stats->rx_bytes;
-		stats->bytes_queued = 0;
-
-		rx_pkts += stats->rx_since_last_feedback;
-		rx_marked += stats->rx_marked_since_last_feedback;
-
-		stats->rx_since_last_feedback = 0;
-		stats->rx_marked_since_last_feedback = 0;
-	}
-
-	if (unlikely(rx_pkts == 0)) {
-		if (net_ratelimit())
-			printk(KERN_INFO "EyeQ: BUG: rx_pkts is 0, but it shouldn't be.\n");
+	rx_bytes = iso_counter_read(&vq->rx_bytes);
+	rx_packets = iso_counter_read(&vq->rx_packets);
+	rx_marked_total = iso_counter_read(&vq->rx_marked);
+	delay_sum = iso_counter_read(&vq->delay_sum_us);
+	delay_samples = iso_counter_read(&vq->delay_samples);
+
+	rx_pkts = (u32)(rx_packets - vq->last_rx_packets);
+	rx_marked = (u32)(rx_marked_total - vq->last_rx_marked);
+	vq->last_rx_packets = rx_packets;
+	vq->last_rx_marked = rx_marked_total;
+
+	sample.delay_samples = (u32)(delay_samples - vq->last_delay_samples);
+	sample.delay_us = 0;
+	if(sample.delay_samples)
+		sample.delay_us = (u32)div_u64(delay_sum - vq->last_delay_sum_us,
+					       sample.delay_samples);
+	vq->last_delay_sum_us = delay_sum;
+	vq->last_delay_samples = delay_samples;
+	vq->delay_us = sample.delay_us;
+
+	/* Nothing arrived this interval; there is nothing marked either */
+	if(rx_pkts == 0)
 		rx_pkts = 1;
-	}
 
 	/* The rate is at least vq's rate */
 	rate = vq->weight * rxctx->rcp_rate;
+	rate = max_t(u64, rate, vq->group_min_rate);
 
 	/* If we want to cap a VQ's rate, do it now */
 	if (vq->is_static) {
 		rate = min_t(u64, rate, vq->rate);
 	}
 
-	/* The control algorithms */
-	{
-		/* RCP calculation */
-		{
-			u64 diff = rx_bytes - vq->last_rx_bytes;
-			int rx_rate = (diff << 3) / dt;
-#define ECN1
-#ifdef ECN1
-			/* ECN1 is the preferred method of
-			 * incorporating ECN feedback. It's better
-			 * than ECN2 as it explicitly accounts for the
-			 * rate mismatch at the bottleneck queue. */
-			u32 frac = (rx_marked << ECN_ALPHA_FRAC_SHIFT) / rx_pkts;
-			u32 den = (1 << ECN_ALPHA_FRAC_SHIFT);
-			/* Safeguard against races. */
-			frac = min_t(u32, den, frac);
-			vq->alpha = EWMA_G16(vq->alpha, frac);
-
-			if (frac) {
-				rx_rate += (ISO_ECN_MARK_THRESH_BYTES << 3) * (den + frac) / den / dt;
-				rx_rate = min_t(int, rx_rate, 3 * rate);
-			}
-#endif
-
-			if (ISO_VQ_DRAIN_RATE_MBPS <= ISO_MAX_TX_RATE) {
-				u32 rate2 = (rate << 1);
-				vq->feedback_rate = vq->feedback_rate * (rate2 + rate - rx_rate) / rate2;
-				vq->feedback_rate = min_t(u64, rate, vq->feedback_rate);
-				vq->feedback_rate = max_t(u64, ISO_MIN_RFAIR, vq->feedback_rate);
-			} else {
-				vq->feedback_rate = ISO_MAX_TX_RATE;
-			}
-			vq->rx_rate = rx_rate;
-			vq->last_rx_bytes = rx_bytes;
-		}
-
-#ifdef ECN2
-		/* ECN calculation */
-		{
-			u32 frac = (rx_marked << ECN_ALPHA_FRAC_SHIFT) / rx_pkts;
-			u32 mult = 1 << (ECN_ALPHA_FRAC_SHIFT + 1);
-			/* Safeguard against races. */
-			frac = min_t(u32, (1 << ECN_ALPHA_FRAC_SHIFT), frac);
-			vq->alpha = EWMA_G16(vq->alpha, frac);
-			vq->feedback_rate = (vq->feedback_rate * (mult - frac)) >> (ECN_ALPHA_FRAC_SHIFT + 1);
-			vq->feedback_rate = min_t(u64, ISO_VQ_DRAIN_RATE_MBPS, vq->feedback_rate);
-			vq->feedback_rate = max_t(u64, ISO_MIN_RFAIR, vq->feedback_rate);
-		}
-#endif
+	if(p->drain_rate > p->max_tx_rate) {
+		vq->feedback_rate = p->max_tx_rate;
+		vq->last_rx_bytes = rx_bytes;
+		return;
 	}
+
+	sample.cfg = cfg;
+	sample.dt = dt;
+	sample.rx_bytes = rx_bytes - vq->last_rx_bytes;
+	sample.rx_pkts = rx_pkts;
+	sample.rx_marked = rx_marked;
+	sample.rx_rate = (sample.rx_bytes << 3) / dt;
+	sample.rate = rate;
+
+	/* Safeguard against races. */
+	sample.frac = min_t(u32, (rx_marked << ECN_ALPHA_FRAC_SHIFT) / rx_pkts,
+			    (1 << ECN_ALPHA_FRAC_SHIFT));
+	vq->alpha = EWMA_G16(vq->alpha, sample.frac);
+
+	/* Virtual queue: what arrived beyond what @rate would drain */
+	drained = (rate * dt) >> 3;
+	sample.last_backlog = vq->total_bytes_queued;
+	if(vq->total_bytes_queued + sample.rx_bytes > drained)
+		vq->total_bytes_queued += sample.rx_bytes - drained;
+	else
+		vq->total_bytes_queued = 0;
+	sample.backlog = vq->total_bytes_queued;
+
+	if(vq->police)
+		iso_vq_police_refill(vq, cfg, rate, dt);
+
+	vq->cc->update(vq, &sample);
+
+	vq->feedback_rate = min_t(u64, rate, vq->feedback_rate);
+	vq->feedback_rate = max_t(u64, cfg->min_rfair, vq->feedback_rate);
+	vq->rx_rate = sample.rx_rate;
+	vq->last_rx_bytes = rx_bytes;
+	trace_perfiso_vq_drain(vq, &sample);
+}
+
+/* Called with rxctx->vq_spinlock */
+void iso_vq_set_police(struct iso_vq *vq, int police) {
+	int i;
+
+	atomic64_set(&vq->police_tokens, 0);
+	for_each_possible_cpu(i)
+		per_cpu_ptr(vq->percpu_stats, i)->police_tokens = 0;
+	vq->police = !!police;
+}
+
+/* Called with the config lock held */
+void iso_vq_set_weight(struct iso_vq *vq, int weight) {
+	struct iso_rx_context *rxctx = vq->rxctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rxctx->vq_spinlock, flags);
+	vq->weight = (u64)weight;
+	iso_vq_calculate_rates(rxctx);
+	spin_unlock_irqrestore(&rxctx->vq_spinlock, flags);
+}
+
+/* Called with rxctx->vq_spinlock, or before the VQ is visible */
+void iso_vq_set_cc(struct iso_vq *vq, struct iso_vq_cc_ops *cc) {
+	vq->cc = cc;
+	vq->total_bytes_queued = 0;
+	cc->init(vq);
 }
 
 void iso_vq_show(struct iso_vq *vq, struct seq_file *s) {
@@ -261,22 +371,24 @@ void iso_vq_show(struct iso_vq *vq, struct seq_file *s) {
 
 	iso_class_show(vq->klass, buff);
 	seq_printf(s, "vq class %s   flags %d,%d   rate %llu  rx_rate %llu  fb_rate %llu  alpha %u/%u  "
-		   " backlog -   weight %llu   refcnt %d\n",
+		   " backlog %llu   weight %llu   refcnt %d   cc %s   police %d,%lld   delay %u\n",
 		   buff, vq->enabled, vq->is_static,
 		   vq->rate, vq->rx_rate, vq->feedback_rate, vq->alpha, (1 << 10),
-		   vq->weight, atomic_read(&vq->refcnt));
+		   vq->total_bytes_queued, vq->weight, atomic_read(&vq->refcnt), vq->cc->name,
+		   vq->police, (s64)atomic64_read(&vq->police_tokens), vq->delay_us);
 
 	for_each_online_cpu(i) {
 		if(first) {
 			first = 0;
-			seq_printf(s, "\t cpu   enqueued   network-mark   rx\n");
+			seq_printf(s, "\t cpu   rx-pkts   network-mark   rx   police-mark   police-drop\n");
 		}
 
 		stats = per_cpu_ptr(vq->percpu_stats, i);
 
-		if(stats->bytes_queued > 0 || stats->network_marked > 0) {
-			seq_printf(s, "\t %3d   %8llu  %12llu   %llu\n",
-					   i, stats->bytes_queued, stats->network_marked, stats->rx_bytes);
+		if(stats->rx_packets > 0) {
+			seq_printf(s, "\t %3d   %8llu  %12llu   %llu   %llu   %llu\n",
+					   i, stats->rx_packets, stats->network_marked, stats->rx_bytes,
+					   stats->police_marked, stats->police_dropped);
 		}
 	}
 }
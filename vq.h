@@ -24,6 +24,7 @@
 #include "params.h"
 #include "tx.h"
 #include "rx.h"
+#include "cc.h"
 
 /*
  * We represent alpha, the fraction of ECN marked packets, as
@@ -35,17 +36,35 @@
 #define DIV16(x) ((x) >> 4)
 #define EWMA_G16(old, new) DIV16(MUL15(old) + new)
 
+/* These only ever increase.  The rx fast path bumps them and
+ * publishes them to the VQ's counters; see counter.h */
 struct iso_vq_stats {
-	u64 bytes_queued;
 	u64 network_marked;
 	u64 rx_packets;
 	u64 rx_bytes;
 
-	ktime_t last_feedback_gen_time;
-	u32 rx_since_last_feedback;
-	u32 rx_marked_since_last_feedback;
+	/* Policing: bytes this cpu borrowed from vq->police_tokens
+	 * and hasn't used yet, and what it marked or dropped */
+	s64 police_tokens;
+	u64 police_marked;
+	u64 police_dropped;
+
+	/* Queueing delay samples from timestamped packets; see delay.c */
+	u64 delay_sum_us;
+	u64 delay_samples;
+
+	/* What this cpu has published of each */
+	u64 published_marked;
+	u64 published_packets;
+	u64 published_bytes;
+	u64 published_delay_sum_us;
+	u64 published_delay_samples;
+	ktime_t last_publish;
 };
 
+/* Cpus borrow policing tokens from the VQ in chunks of this size */
+#define ISO_VQ_POLICE_CHUNK_BYTES (16 * 1024)
+
 struct iso_vq {
 	u8 enabled;
 	u8 is_static;
@@ -55,14 +74,38 @@ struct iso_vq {
 	u64 feedback_rate;
 	u64 rx_rate;
 	u64 last_rx_bytes;
+	u64 last_rx_packets;
+	u64 last_rx_marked;
+	/* Sums of the per-cpu stats, as of each cpu's last publish */
+	struct iso_counter rx_bytes;
+	struct iso_counter rx_packets;
+	struct iso_counter rx_marked;
+	struct iso_counter delay_sum_us;
+	struct iso_counter delay_samples;
+	u64 last_delay_sum_us;
+	u64 last_delay_samples;
+	/* Mean queueing delay senders saw last interval, if any */
+	u32 delay_us;
 	u64 weight;
 	/* Fraction of marked packets = alpha/1024. */
 	u32 alpha;
+	/* Congestion control that sets feedback_rate */
+	struct iso_vq_cc_ops *cc;
+	union iso_vq_cc_state cc_state;
+
+	/* Police arrivals to the VQ's rate, for senders that ignore
+	 * feedback.  The control loop refills police_tokens; when it
+	 * is in debt past ISO_VQ_MARK_THRESH_BYTES we mark, and past
+	 * ISO_VQ_MAX_BYTES we drop. */
+	u8 police;
+	atomic64_t police_tokens;
+	/* Share of the guarantee this device provides on behalf of
+	 * its host-wide group; 0 if ungrouped */
+	u64 group_min_rate;
 
 	ktime_t last_update_time, last_borrow_time;
 
 	struct iso_vq_stats __percpu *percpu_stats;
-	spinlock_t spinlock;
 
 	iso_class_t klass;
 	struct list_head list;
@@ -82,6 +125,8 @@ extern struct hlist_head vq_bucket[ISO_MAX_VQ_BUCKETS];
 */
 
 #define for_each_vq(vq, ctx) list_for_each_entry_safe(vq, vq_next, &ctx->vq_list, list)
+/* Under rcu_read_lock: the list is changed with the _rcu list ops */
+#define for_each_vq_rcu(vq, ctx) list_for_each_entry_rcu(vq, &(ctx)->vq_list, list)
 #define ISO_VQ_DEFAULT_RATE_MBPS (100) /* This parameter shouldn't matter */
 
 void iso_vqs_init(struct iso_rx_context *);
@@ -89,14 +134,17 @@ void iso_vqs_exit(struct iso_rx_context *);
 int iso_vq_init(struct iso_vq *);
 struct iso_vq *iso_vq_alloc(iso_class_t, struct iso_rx_context *);
 void iso_vq_free(struct iso_vq *);
-void iso_vq_enqueue(struct iso_vq *, struct sk_buff *);
-void iso_vq_drain(struct iso_vq *, u64);
+enum iso_verdict iso_vq_enqueue(struct iso_vq *, struct sk_buff *, ktime_t now);
+void iso_vq_drain(struct iso_vq *, ktime_t);
 static inline int iso_vq_over_limits(struct iso_vq *);
 void iso_vq_calculate_rates(struct iso_rx_context *);
 void iso_vq_check_idle(struct iso_rx_context *);
 
 static inline struct iso_vq *iso_vq_find(iso_class_t, struct iso_rx_context *);
 void iso_vq_show(struct iso_vq *, struct seq_file *);
+void iso_vq_set_cc(struct iso_vq *, struct iso_vq_cc_ops *);
+void iso_vq_set_police(struct iso_vq *, int);
+void iso_vq_set_weight(struct iso_vq *, int);
 
 /* Called with rcu lock */
 static inline struct iso_vq *iso_vq_find(iso_class_t klass, struct iso_rx_context *rxctx) {
@@ -118,6 +166,15 @@ static inline int iso_vq_over_limits(struct iso_vq *vq) {
 	return vq->feedback_rate;
 }
 
+/* Congestion signal for sender AIMD, out of 1 << ECN_ALPHA_FRAC_SHIFT:
+ * the smoothed mark fraction, or all of it if the virtual queue is
+ * past the marking threshold. */
+static inline u16 iso_vq_congestion(struct iso_vq *vq, const struct iso_config *cfg) {
+	if(vq->total_bytes_queued > cfg->vq_mark_thresh_bytes)
+		return 1 << ECN_ALPHA_FRAC_SHIFT;
+	return vq->alpha;
+}
+
 
 #endif /* __VQ_H__ */
 